@@ -0,0 +1,608 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+
+/// Microbenchmarks for the data structures on picom's hot paths.
+///
+/// These run on synthetic inputs and don't need an X server. Each benchmark is run
+/// for enough iterations to take a measurable amount of time, then the time and the
+/// number of heap allocations per iteration are reported.
+///
+/// Usage: microbench [NAME]...
+/// Runs the named benchmarks, or all of them if no name is given.
+
+#include <inttypes.h>
+#include <pixman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uthash.h>
+
+#include "backend/backend.h"
+#include "backend/gl/gl_common.h"
+#include "cache.h"
+#include "common.h"
+#include "compiler.h"
+#include "log.h"
+#include "region.h"
+#include "utils.h"
+#include "uthash_extra.h"
+#include "win.h"
+
+// === Allocation counting ===
+
+static uint64_t nallocs = 0;
+
+#ifdef __GLIBC__
+// Interpose the allocator, so allocations made by our libraries (e.g. pixman) are
+// counted as well. glibc explicitly supports replacing malloc this way.
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+
+void *malloc(size_t size) {
+	nallocs++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+	nallocs++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+	nallocs++;
+	return __libc_realloc(ptr, size);
+}
+#define HAS_ALLOC_COUNT 1
+#else
+#define HAS_ALLOC_COUNT 0
+#endif
+
+// === Helpers ===
+
+/// Deterministic pseudo random numbers, so every run sees the same inputs.
+static uint64_t rng_state = 1;
+static uint32_t rng_next(void) {
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return (uint32_t)((rng_state * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+static int rng_range(int lo, int hi) {
+	return lo + (int)(rng_next() % (uint32_t)(hi - lo + 1));
+}
+
+#define SCREEN_WIDTH 3840
+#define SCREEN_HEIGHT 2160
+
+static rect_t random_rect(int max_size) {
+	int w = rng_range(16, max_size), h = rng_range(16, max_size);
+	int x = rng_range(0, SCREEN_WIDTH - w), y = rng_range(0, SCREEN_HEIGHT - h);
+	return (rect_t){.x1 = x, .y1 = y, .x2 = x + w, .y2 = y + h};
+}
+
+/// Keep the compiler from optimizing away computations whose results are unused.
+static void do_not_optimize(const void *p) {
+	__asm__ volatile("" : : "g"(p) : "memory");
+}
+
+// === x_rect_to_coords ===
+
+#define NRECTS 64
+
+struct rect_to_coords_ctx {
+	rect_t rects[NRECTS];
+	GLint coord[NRECTS * 16];
+	GLuint indices[NRECTS * 6];
+};
+
+static void *rect_to_coords_setup(void) {
+	auto ctx = ccalloc(1, struct rect_to_coords_ctx);
+	for (int i = 0; i < NRECTS; i++) {
+		ctx->rects[i] = random_rect(512);
+	}
+	return ctx;
+}
+
+static void rect_to_coords_run(void *data, uint64_t iterations) {
+	struct rect_to_coords_ctx *ctx = data;
+	for (uint64_t i = 0; i < iterations; i++) {
+		x_rect_to_coords(NRECTS, ctx->rects, (coord_t){.x = 100, .y = 100},
+		                 SCREEN_HEIGHT, SCREEN_HEIGHT, SCREEN_HEIGHT, true,
+		                 ctx->coord, ctx->indices);
+		do_not_optimize(ctx->coord);
+	}
+}
+
+// === Region operations ===
+
+#define NWINDOWS 64
+
+/// A stack of overlapping windows, bottom to top, like the one paint_preprocess
+/// builds.
+struct region_ctx {
+	region_t screen_reg;
+	region_t damage;
+	region_t bounding[NWINDOWS];
+	region_t reg_ignore[NWINDOWS];
+};
+
+static void *region_setup(void) {
+	auto ctx = ccalloc(1, struct region_ctx);
+	pixman_region32_init_rect(&ctx->screen_reg, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+	pixman_region32_init(&ctx->damage);
+	for (int i = 0; i < 8; i++) {
+		auto r = random_rect(1024);
+		pixman_region32_union_rect(&ctx->damage, &ctx->damage, r.x1, r.y1,
+		                           (unsigned)(r.x2 - r.x1), (unsigned)(r.y2 - r.y1));
+	}
+	for (int i = 0; i < NWINDOWS; i++) {
+		auto r = random_rect(1024);
+		pixman_region32_init_rects(&ctx->bounding[i], &r, 1);
+		pixman_region32_init(&ctx->reg_ignore[i]);
+	}
+
+	// Compute reg_ignore from the top down, the same way paint_preprocess does
+	region_t acc;
+	pixman_region32_init(&acc);
+	for (int i = NWINDOWS - 1; i >= 0; i--) {
+		pixman_region32_copy(&ctx->reg_ignore[i], &acc);
+		if (i % 2 == 0) {
+			// Every other window is opaque
+			pixman_region32_union(&acc, &acc, &ctx->bounding[i]);
+		}
+	}
+	pixman_region32_fini(&acc);
+	return ctx;
+}
+
+static void region_teardown(void *data) {
+	struct region_ctx *ctx = data;
+	pixman_region32_fini(&ctx->screen_reg);
+	pixman_region32_fini(&ctx->damage);
+	for (int i = 0; i < NWINDOWS; i++) {
+		pixman_region32_fini(&ctx->bounding[i]);
+		pixman_region32_fini(&ctx->reg_ignore[i]);
+	}
+	free(ctx);
+}
+
+/// Building the reg_ignore of every window, as in paint_preprocess.
+static void region_reg_ignore_run(void *data, uint64_t iterations) {
+	struct region_ctx *ctx = data;
+	for (uint64_t n = 0; n < iterations; n++) {
+		region_t acc;
+		pixman_region32_init(&acc);
+		for (int i = NWINDOWS - 1; i >= 0; i--) {
+			region_t reg_ignore;
+			pixman_region32_init(&reg_ignore);
+			pixman_region32_copy(&reg_ignore, &acc);
+			if (i % 2 == 0) {
+				pixman_region32_union(&acc, &acc, &ctx->bounding[i]);
+			}
+			do_not_optimize(&reg_ignore);
+			pixman_region32_fini(&reg_ignore);
+		}
+		pixman_region32_fini(&acc);
+	}
+}
+
+/// The per window region computation in paint_all_new.
+static void region_paint_run(void *data, uint64_t iterations) {
+	struct region_ctx *ctx = data;
+	for (uint64_t n = 0; n < iterations; n++) {
+		region_t reg_paint, reg_visible, reg_paint_in_bound;
+		pixman_region32_init(&reg_paint);
+		pixman_region32_init(&reg_visible);
+		pixman_region32_init(&reg_paint_in_bound);
+		pixman_region32_subtract(&reg_paint, &ctx->damage, &ctx->reg_ignore[0]);
+		for (int i = 0; i < NWINDOWS; i++) {
+			pixman_region32_subtract(&reg_visible, &ctx->screen_reg,
+			                         &ctx->reg_ignore[i]);
+			pixman_region32_intersect(&reg_paint_in_bound, &ctx->bounding[i],
+			                          &ctx->damage);
+			pixman_region32_subtract(&reg_paint_in_bound, &reg_paint_in_bound,
+			                         &ctx->reg_ignore[i]);
+			do_not_optimize(&reg_paint_in_bound);
+		}
+		pixman_region32_fini(&reg_paint);
+		pixman_region32_fini(&reg_visible);
+		pixman_region32_fini(&reg_paint_in_bound);
+	}
+}
+
+// === get_damage ===
+
+#define BUFFER_AGE 5
+
+static int fake_buffer_age(backend_t *backend_data attr_unused) {
+	return BUFFER_AGE;
+}
+
+static struct backend_operations fake_backend_ops = {
+    .buffer_age = fake_buffer_age,
+    .max_buffer_age = BUFFER_AGE,
+};
+
+static void *get_damage_setup(void) {
+	auto ps = ccalloc(1, session_t);
+	auto backend_data = ccalloc(1, backend_t);
+	backend_data->ops = &fake_backend_ops;
+	ps->backend_data = backend_data;
+
+	pixman_region32_init_rect(&ps->screen_reg, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+	ps->ndamage = BUFFER_AGE;
+	ps->damage_ring = ccalloc(ps->ndamage, region_t);
+	ps->damage = ps->damage_ring;
+	for (int i = 0; i < ps->ndamage; i++) {
+		pixman_region32_init(&ps->damage_ring[i]);
+		for (int j = 0; j < 16; j++) {
+			auto r = random_rect(256);
+			pixman_region32_union_rect(&ps->damage_ring[i], &ps->damage_ring[i],
+			                           r.x1, r.y1, (unsigned)(r.x2 - r.x1),
+			                           (unsigned)(r.y2 - r.y1));
+		}
+	}
+	return ps;
+}
+
+static void get_damage_run(void *data, uint64_t iterations) {
+	session_t *ps = data;
+	for (uint64_t i = 0; i < iterations; i++) {
+		auto region = get_damage(ps, false);
+		do_not_optimize(&region);
+		pixman_region32_fini(&region);
+	}
+}
+
+static void get_damage_teardown(void *data) {
+	session_t *ps = data;
+	for (int i = 0; i < ps->ndamage; i++) {
+		pixman_region32_fini(&ps->damage_ring[i]);
+	}
+	free(ps->damage_ring);
+	pixman_region32_fini(&ps->screen_reg);
+	free(ps->backend_data);
+	free(ps);
+}
+
+// === win_set_properties_stale ===
+
+struct stale_props_ctx {
+	struct managed_win w;
+	xcb_atom_t props[8];
+};
+
+static void *stale_props_setup(void) {
+	auto ctx = ccalloc(1, struct stale_props_ctx);
+	ctx->w.name = "microbench";
+	for (size_t i = 0; i < ARR_SIZE(ctx->props); i++) {
+		// Atoms of a typical session are in the few hundreds
+		ctx->props[i] = (xcb_atom_t)rng_range(1, 600);
+	}
+	return ctx;
+}
+
+static void stale_props_teardown(void *data) {
+	struct stale_props_ctx *ctx = data;
+	free(ctx->w.stale_props);
+	free(ctx);
+}
+
+/// Marking properties stale on a window that has seen them before.
+static void stale_props_run(void *data, uint64_t iterations) {
+	struct stale_props_ctx *ctx = data;
+	for (uint64_t i = 0; i < iterations; i++) {
+		win_set_properties_stale(&ctx->w, ctx->props, ARR_SIZE(ctx->props));
+		do_not_optimize(ctx->w.stale_props);
+	}
+}
+
+/// Marking properties stale on a fresh window, which has to allocate the bitmap.
+static void stale_props_cold_run(void *data, uint64_t iterations) {
+	struct stale_props_ctx *ctx = data;
+	for (uint64_t i = 0; i < iterations; i++) {
+		free(ctx->w.stale_props);
+		ctx->w.stale_props = NULL;
+		ctx->w.stale_props_capacity = 0;
+		win_set_properties_stale(&ctx->w, ctx->props, ARR_SIZE(ctx->props));
+		do_not_optimize(ctx->w.stale_props);
+	}
+}
+
+// === cache_get ===
+
+#define NCACHE_KEYS 256
+
+struct cache_ctx {
+	struct cache *cache;
+	char *keys[NCACHE_KEYS];
+};
+
+static void *
+cache_getter(void *user_data attr_unused, const void *key, size_t key_size, int *err) {
+	*err = 0;
+	auto ret = malloc(key_size);
+	memcpy(ret, key, key_size);
+	return ret;
+}
+
+static void cache_free_value(void *user_data attr_unused, void *data) {
+	free(data);
+}
+
+static void *cache_setup(void) {
+	auto ctx = ccalloc(1, struct cache_ctx);
+	ctx->cache = new_cache(NULL, cache_getter, cache_free_value);
+	for (int i = 0; i < NCACHE_KEYS; i++) {
+		// Look like atom names, which is what the cache is used for
+		if (asprintf(&ctx->keys[i], "_NET_WM_SOMETHING_%d", i) < 0) {
+			abort();
+		}
+		int err;
+		cache_get(ctx->cache, ctx->keys[i], &err);
+	}
+	return ctx;
+}
+
+static void cache_run(void *data, uint64_t iterations) {
+	struct cache_ctx *ctx = data;
+	for (uint64_t i = 0; i < iterations; i++) {
+		int err;
+		do_not_optimize(cache_get(ctx->cache, ctx->keys[i % NCACHE_KEYS], &err));
+	}
+}
+
+static void cache_teardown(void *data) {
+	struct cache_ctx *ctx = data;
+	cache_free(ctx->cache);
+	for (int i = 0; i < NCACHE_KEYS; i++) {
+		free(ctx->keys[i]);
+	}
+	free(ctx);
+}
+
+/// Integer keys, like visual IDs, all of them in the cache.
+static void *cache_int_setup(void) {
+	auto cache = new_cache(NULL, cache_getter, cache_free_value);
+	for (uint64_t i = 0; i < NCACHE_KEYS; i++) {
+		int err;
+		cache_get_int(cache, 0x20 + i, &err);
+	}
+	return cache;
+}
+
+static void cache_int_run(void *data, uint64_t iterations) {
+	struct cache *cache = data;
+	for (uint64_t i = 0; i < iterations; i++) {
+		int err;
+		do_not_optimize(cache_get_int(cache, 0x20 + i % NCACHE_KEYS, &err));
+	}
+}
+
+/// Integer keys, in a cache that only holds a quarter of them. Most lookups miss and
+/// evict the least recently used value.
+static void *cache_lru_setup(void) {
+	auto cache = cache_int_setup();
+	cache_set_capacity(cache, NCACHE_KEYS / 4);
+	return cache;
+}
+
+static void cache_lru_run(void *data, uint64_t iterations) {
+	struct cache *cache = data;
+	for (uint64_t i = 0; i < iterations; i++) {
+		int err;
+		auto key = 0x20 + rng_next() % NCACHE_KEYS;
+		do_not_optimize(cache_get_int(cache, key, &err));
+	}
+}
+
+static void cache_int_teardown(void *data) {
+	struct cache *cache = data;
+	auto stats = cache_get_stats(cache);
+	fprintf(stderr,
+	        "cache: %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " evictions\n",
+	        stats->hits, stats->misses, stats->evictions);
+	cache_free(cache);
+}
+
+// === find_win/find_toplevel ===
+
+#define NMANAGED_WINDOWS 10000
+
+/// An entry of the uthash table find_win used to look windows up in, to compare
+/// against.
+struct uthash_win {
+	UT_hash_handle hh;
+	xcb_window_t id;
+};
+
+struct find_win_ctx {
+	session_t *ps;
+	struct uthash_win *uthash_windows;
+	xcb_window_t ids[NMANAGED_WINDOWS];
+	xcb_window_t client_ids[NMANAGED_WINDOWS];
+};
+
+static void *find_win_setup(void) {
+	auto ctx = ccalloc(1, struct find_win_ctx);
+	ctx->ps = ccalloc(1, session_t);
+	for (int i = 0; i < NMANAGED_WINDOWS; i++) {
+		auto w = ccalloc(1, struct managed_win);
+		// Window IDs are handed out sequentially within a client's ID range
+		w->base.id = 0x400000 + (xcb_window_t)i * 8;
+		w->base.managed = true;
+		w->client_win = w->base.id + 1;
+		ctx->ids[i] = w->base.id;
+		ctx->client_ids[i] = w->client_win;
+
+		xid_map_set(&ctx->ps->windows, w->base.id, &w->base);
+
+		auto uw = ccalloc(1, struct uthash_win);
+		uw->id = w->base.id;
+		HASH_ADD_INT(ctx->uthash_windows, id, uw);
+	}
+	// Shuffle the lookup order, so we don't just walk the hash table
+	for (int i = NMANAGED_WINDOWS - 1; i > 0; i--) {
+		int j = rng_range(0, i);
+		auto tmp = ctx->ids[i];
+		ctx->ids[i] = ctx->ids[j];
+		ctx->ids[j] = tmp;
+		tmp = ctx->client_ids[i];
+		ctx->client_ids[i] = ctx->client_ids[j];
+		ctx->client_ids[j] = tmp;
+	}
+	return ctx;
+}
+
+static void find_win_run(void *data, uint64_t iterations) {
+	struct find_win_ctx *ctx = data;
+	for (uint64_t i = 0; i < iterations; i++) {
+		do_not_optimize(find_win(ctx->ps, ctx->ids[i % NMANAGED_WINDOWS]));
+	}
+}
+
+/// Events for windows picom doesn't know about, e.g. the children of frames, make
+/// lookups miss.
+static void find_win_miss_run(void *data, uint64_t iterations) {
+	struct find_win_ctx *ctx = data;
+	for (uint64_t i = 0; i < iterations; i++) {
+		do_not_optimize(find_win(ctx->ps, ctx->ids[i % NMANAGED_WINDOWS] + 4));
+	}
+}
+
+static void find_win_uthash_run(void *data, uint64_t iterations) {
+	struct find_win_ctx *ctx = data;
+	for (uint64_t i = 0; i < iterations; i++) {
+		struct uthash_win *w = NULL;
+		auto id = ctx->ids[i % NMANAGED_WINDOWS];
+		HASH_FIND_INT(ctx->uthash_windows, &id, w);
+		do_not_optimize(w);
+	}
+}
+
+static void find_win_uthash_miss_run(void *data, uint64_t iterations) {
+	struct find_win_ctx *ctx = data;
+	for (uint64_t i = 0; i < iterations; i++) {
+		struct uthash_win *w = NULL;
+		auto id = ctx->ids[i % NMANAGED_WINDOWS] + 4;
+		HASH_FIND_INT(ctx->uthash_windows, &id, w);
+		do_not_optimize(w);
+	}
+}
+
+static void find_toplevel_run(void *data, uint64_t iterations) {
+	struct find_win_ctx *ctx = data;
+	for (uint64_t i = 0; i < iterations; i++) {
+		do_not_optimize(find_toplevel(ctx->ps, ctx->client_ids[i % NMANAGED_WINDOWS]));
+	}
+}
+
+static void find_win_teardown(void *data) {
+	struct find_win_ctx *ctx = data;
+	xid_map_foreach(&ctx->ps->windows, struct win, w) {
+		free(w);
+	}
+	xid_map_destroy(&ctx->ps->windows);
+	HASH_ITER2(ctx->uthash_windows, w) {
+		HASH_DEL(ctx->uthash_windows, w);
+		free(w);
+	}
+	free(ctx->ps);
+	free(ctx);
+}
+
+// === Driver ===
+
+struct microbench {
+	const char *name;
+	void *(*setup)(void);
+	void (*run)(void *ctx, uint64_t iterations);
+	void (*teardown)(void *ctx);
+};
+
+static const struct microbench benchmarks[] = {
+    {"x_rect_to_coords", rect_to_coords_setup, rect_to_coords_run, free},
+    {"region_reg_ignore", region_setup, region_reg_ignore_run, region_teardown},
+    {"region_paint", region_setup, region_paint_run, region_teardown},
+    {"get_damage", get_damage_setup, get_damage_run, get_damage_teardown},
+    {"win_set_properties_stale", stale_props_setup, stale_props_run, stale_props_teardown},
+    {"win_set_properties_stale_cold", stale_props_setup, stale_props_cold_run,
+     stale_props_teardown},
+    {"cache_get", cache_setup, cache_run, cache_teardown},
+    {"cache_get_int", cache_int_setup, cache_int_run, cache_int_teardown},
+    {"cache_get_lru", cache_lru_setup, cache_lru_run, cache_int_teardown},
+    {"find_win", find_win_setup, find_win_run, find_win_teardown},
+    {"find_win_miss", find_win_setup, find_win_miss_run, find_win_teardown},
+    {"find_win_uthash", find_win_setup, find_win_uthash_run, find_win_teardown},
+    {"find_win_uthash_miss", find_win_setup, find_win_uthash_miss_run,
+     find_win_teardown},
+    {"find_toplevel", find_win_setup, find_toplevel_run, find_win_teardown},
+};
+
+/// Minimum time a measurement should take, for the result to be meaningful.
+#define MIN_BENCH_TIME_NS 200000000ULL
+
+static void run_benchmark(const struct microbench *b) {
+	rng_state = 1;
+	auto ctx = b->setup();
+
+	// Warm up, and find an iteration count that takes long enough
+	uint64_t iterations = 1;
+	while (true) {
+		auto start = get_time_ns();
+		b->run(ctx, iterations);
+		auto elapsed = get_time_ns() - start;
+		if (elapsed >= MIN_BENCH_TIME_NS / 10) {
+			// Scale up to the target time, with some margin
+			iterations = iterations * MIN_BENCH_TIME_NS / max2(elapsed, 1) + 1;
+			break;
+		}
+		iterations *= 10;
+	}
+
+	auto allocs_before = nallocs;
+	auto start = get_time_ns();
+	b->run(ctx, iterations);
+	auto elapsed = get_time_ns() - start;
+	auto allocs = nallocs - allocs_before;
+
+	if (HAS_ALLOC_COUNT) {
+		printf("%-32s %12.1f ns/op %10.2f allocs/op (%" PRIu64 " iterations)\n",
+		       b->name, (double)elapsed / (double)iterations,
+		       (double)allocs / (double)iterations, iterations);
+	} else {
+		printf("%-32s %12.1f ns/op %10s allocs/op (%" PRIu64 " iterations)\n",
+		       b->name, (double)elapsed / (double)iterations, "n/a", iterations);
+	}
+	b->teardown(ctx);
+}
+
+int main(int argc, char **argv) {
+	// Some of the code being benchmarked logs
+	log_init_tls();
+
+	int ret = 0;
+	if (argc <= 1) {
+		for (size_t i = 0; i < ARR_SIZE(benchmarks); i++) {
+			run_benchmark(&benchmarks[i]);
+		}
+	}
+	for (int i = 1; i < argc; i++) {
+		bool found = false;
+		for (size_t j = 0; j < ARR_SIZE(benchmarks); j++) {
+			if (strcmp(argv[i], benchmarks[j].name) == 0) {
+				run_benchmark(&benchmarks[j]);
+				found = true;
+			}
+		}
+		if (!found) {
+			fprintf(stderr, "Unknown benchmark %s\n", argv[i]);
+			ret = 1;
+		}
+	}
+
+	log_deinit_tls();
+	return ret;
+}
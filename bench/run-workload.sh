@@ -0,0 +1,38 @@
+#!/bin/sh
+# SPDX-License-Identifier: MPL-2.0
+#
+# Run a command against picom on a private Xvfb server.
+#
+# Usage: run-workload.sh PICOM COMMAND [ARGS...]
+#
+# Xvfb picks a free display number, picom is started on it with Mesa's software
+# rasterizer, and COMMAND is run once picom is up. Extra options can be passed to
+# picom with PICOM_ARGS.
+
+set -e
+
+picom=$1
+shift
+
+tmpdir=$(mktemp -d)
+xvfb_pid=
+picom_pid=
+cleanup() {
+	[ -n "$picom_pid" ] && kill "$picom_pid" 2>/dev/null
+	[ -n "$xvfb_pid" ] && kill "$xvfb_pid" 2>/dev/null
+	rm -rf "$tmpdir"
+}
+trap cleanup EXIT
+
+mkfifo "$tmpdir/displayfd"
+Xvfb -displayfd 3 -screen 0 1920x1080x24 +extension GLX +extension Composite \
+	-nolisten tcp 3>"$tmpdir/displayfd" &
+xvfb_pid=$!
+read -r display < "$tmpdir/displayfd"
+export DISPLAY=":$display"
+
+# shellcheck disable=SC2086
+LIBGL_ALWAYS_SOFTWARE=1 "$picom" $PICOM_ARGS &
+picom_pid=$!
+
+"$@"
@@ -0,0 +1,121 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xcb/composite.h>
+
+#include "compiler.h"
+#include "utils.h"
+#include "x_common.h"
+
+xcb_atom_t intern_atom(xcb_connection_t *c, const char *name) {
+	auto r = xcb_intern_atom_reply(
+	    c, xcb_intern_atom(c, 0, (uint16_t)strlen(name), name), NULL);
+	xcb_atom_t ret = r ? r->atom : XCB_NONE;
+	free(r);
+	return ret;
+}
+
+void round_trip(xcb_connection_t *c) {
+	free(xcb_get_input_focus_reply(c, xcb_get_input_focus(c), NULL));
+}
+
+xcb_visualid_t find_argb_visual(xcb_screen_t *screen) {
+	auto depth_it = xcb_screen_allowed_depths_iterator(screen);
+	for (; depth_it.rem; xcb_depth_next(&depth_it)) {
+		if (depth_it.data->depth != 32) {
+			continue;
+		}
+		auto visual_it = xcb_depth_visuals_iterator(depth_it.data);
+		for (; visual_it.rem; xcb_visualtype_next(&visual_it)) {
+			if (visual_it.data->_class == XCB_VISUAL_CLASS_TRUE_COLOR) {
+				return visual_it.data->visual_id;
+			}
+		}
+	}
+	return XCB_NONE;
+}
+
+bool wait_for_compositor(xcb_connection_t *c, int screen, double timeout) {
+	char *name;
+	if (asprintf(&name, "_NET_WM_CM_S%d", screen) < 0) {
+		return false;
+	}
+	auto atom = intern_atom(c, name);
+	free(name);
+	if (atom == XCB_NONE) {
+		return false;
+	}
+
+	auto deadline = get_time_ns() + (uint64_t)(timeout * 1e9);
+	while (get_time_ns() < deadline) {
+		auto r = xcb_get_selection_owner_reply(
+		    c, xcb_get_selection_owner(c, atom), NULL);
+		bool owned = r && r->owner != XCB_NONE;
+		free(r);
+		if (owned) {
+			return true;
+		}
+		poll(NULL, 0, 50);
+	}
+	return false;
+}
+
+bool watch_overlay(xcb_connection_t *c, xcb_screen_t *screen, struct present_watch *pw) {
+	auto ext = xcb_get_extension_data(c, &xcb_damage_id);
+	if (!ext || !ext->present) {
+		fprintf(stderr, "No damage extension\n");
+		return false;
+	}
+	pw->damage_event = ext->first_event;
+	free(xcb_damage_query_version_reply(
+	    c,
+	    xcb_damage_query_version(c, XCB_DAMAGE_MAJOR_VERSION,
+	                             XCB_DAMAGE_MINOR_VERSION),
+	    NULL));
+	free(xcb_composite_query_version_reply(
+	    c,
+	    xcb_composite_query_version(c, XCB_COMPOSITE_MAJOR_VERSION,
+	                                XCB_COMPOSITE_MINOR_VERSION),
+	    NULL));
+
+	auto r = xcb_composite_get_overlay_window_reply(
+	    c, xcb_composite_get_overlay_window(c, screen->root), NULL);
+	if (!r) {
+		fprintf(stderr, "Failed to get the composite overlay window\n");
+		return false;
+	}
+	pw->overlay = r->overlay_win;
+	free(r);
+
+	pw->damage = xcb_generate_id(c);
+	xcb_damage_create(c, pw->damage, pw->overlay, XCB_DAMAGE_REPORT_LEVEL_NON_EMPTY);
+	return true;
+}
+
+void unwatch_overlay(xcb_connection_t *c, xcb_screen_t *screen,
+                     struct present_watch *pw) {
+	xcb_damage_destroy(c, pw->damage);
+	xcb_composite_release_overlay_window(c, screen->root);
+}
+
+void handle_events(xcb_connection_t *c, const struct present_watch *pw,
+                   present_callback_t on_present, void *user_data) {
+	xcb_generic_event_t *ev;
+	while ((ev = xcb_poll_for_event(c))) {
+		auto type = ev->response_type & 0x7f;
+		if (type == 0) {
+			auto e = (xcb_generic_error_t *)ev;
+			fprintf(stderr, "X error: code %d, major %d, minor %d\n",
+			        e->error_code, e->major_code, e->minor_code);
+		} else if (type == pw->damage_event + XCB_DAMAGE_NOTIFY) {
+			on_present(user_data);
+			// Re-arm the damage object so we get notified of the next present
+			xcb_damage_subtract(c, pw->damage, XCB_NONE, XCB_NONE);
+		}
+		free(ev);
+	}
+}
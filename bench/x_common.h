@@ -0,0 +1,36 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+#pragma once
+
+/// Helpers shared by the benchmark X clients, xworkload and xreplay.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <xcb/damage.h>
+#include <xcb/xcb.h>
+
+/// Frames presented by the compositor. The compositor renders into the composite
+/// overlay window, so every present shows up as a damage event on it.
+struct present_watch {
+	xcb_window_t overlay;
+	xcb_damage_damage_t damage;
+	uint8_t damage_event;
+};
+
+/// Called for every present seen by handle_events.
+typedef void (*present_callback_t)(void *user_data);
+
+xcb_atom_t intern_atom(xcb_connection_t *c, const char *name);
+/// Wait until the X server has processed every request sent so far.
+void round_trip(xcb_connection_t *c);
+/// Find a 32-bit TrueColor visual, for windows with an alpha channel.
+xcb_visualid_t find_argb_visual(xcb_screen_t *screen);
+/// Wait until a compositor owns the _NET_WM_CM_S<screen> selection.
+bool wait_for_compositor(xcb_connection_t *c, int screen, double timeout);
+/// Start watching the overlay window of `screen` for presents.
+bool watch_overlay(xcb_connection_t *c, xcb_screen_t *screen, struct present_watch *pw);
+void unwatch_overlay(xcb_connection_t *c, xcb_screen_t *screen, struct present_watch *pw);
+/// Handle the queued events without blocking. X errors are printed, and `on_present`
+/// is called for every present.
+void handle_events(xcb_connection_t *c, const struct present_watch *pw,
+                   present_callback_t on_present, void *user_data);
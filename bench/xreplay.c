@@ -0,0 +1,435 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+
+/// Replay of X event recordings made with picom's --record-events.
+///
+/// Connects to an X server that has a compositor running, and re-creates the
+/// recorded window set with windows of its own, then turns the recorded events back
+/// into requests: structure events become map, unmap, configure and destroy requests,
+/// and damage notifications become fills of the damaged area. The compositor under
+/// test then sees roughly the same event stream it saw when the recording was made.
+///
+/// Events are played back with their original timing by default, or as fast as the X
+/// server accepts them with --fast. Presents are observed the same way as in
+/// xworkload, through a damage object on the composite overlay window.
+///
+/// Property changes are not replayed, atoms are not the same across X servers.
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uthash.h>
+#include <xcb/damage.h>
+#include <xcb/xcb.h>
+
+#include "compiler.h"
+#include "record.h"
+#include "utils.h"
+#include "x_common.h"
+
+struct options {
+	const char *path;
+	/// Ignore the recorded timing
+	bool fast;
+	/// Playback speed relative to the recording
+	double speed;
+};
+
+/// A window of the recording, and the window we created for it.
+struct replay_window {
+	xcb_window_t recorded;
+	xcb_window_t id;
+	xcb_gcontext_t gc;
+	UT_hash_handle hh;
+};
+
+struct replay_state {
+	xcb_connection_t *c;
+	xcb_screen_t *screen;
+	struct options o;
+	struct event_record_header header;
+
+	/// The whole recording
+	char *data;
+	size_t size;
+
+	struct replay_window *windows;
+	xcb_visualid_t argb_visual;
+	xcb_colormap_t argb_colormap;
+	uint32_t color;
+
+	struct present_watch presents;
+
+	uint64_t nrecords;
+	uint64_t nreplayed;
+	uint64_t npresents;
+};
+
+static void replay_present(void *ud) {
+	struct replay_state *st = ud;
+	st->npresents++;
+}
+
+static bool load_recording(struct replay_state *st) {
+	FILE *f = fopen(st->o.path, "rb");
+	if (!f) {
+		perror(st->o.path);
+		return false;
+	}
+	if (fread(&st->header, sizeof(st->header), 1, f) != 1 ||
+	    memcmp(st->header.magic, EVENT_RECORD_MAGIC, sizeof(st->header.magic)) != 0) {
+		fprintf(stderr, "%s is not an event recording\n", st->o.path);
+		fclose(f);
+		return false;
+	}
+	if (st->header.version != EVENT_RECORD_VERSION) {
+		fprintf(stderr, "Unsupported recording version %u\n", st->header.version);
+		fclose(f);
+		return false;
+	}
+
+	size_t capacity = 1024 * 1024;
+	st->data = crealloc(st->data, capacity);
+	size_t n;
+	while ((n = fread(st->data + st->size, 1, capacity - st->size, f)) > 0) {
+		st->size += n;
+		if (st->size == capacity) {
+			capacity *= 2;
+			st->data = crealloc(st->data, capacity);
+		}
+	}
+	bool ok = !ferror(f);
+	fclose(f);
+	return ok;
+}
+
+static struct replay_window *find_window(struct replay_state *st, xcb_window_t recorded) {
+	struct replay_window *w;
+	HASH_FIND_INT(st->windows, &recorded, w);
+	return w;
+}
+
+static void create_window(struct replay_state *st, const struct event_record_window *r) {
+	auto c = st->c;
+	auto screen = st->screen;
+	// Windows of other depths are created with the root depth, the depth only
+	// matters to the compositor as far as the alpha channel is concerned.
+	bool argb = r->depth == 32 && st->argb_visual != XCB_NONE;
+
+	auto w = ccalloc(1, struct replay_window);
+	w->recorded = r->id;
+	w->id = xcb_generate_id(c);
+	// There is no window manager on the replay server, so the override-redirect
+	// flag makes no difference, set it to make sure none gets in the way.
+	const uint32_t values[] = {st->color++, 0, 1,
+	                           argb ? st->argb_colormap : screen->default_colormap};
+	xcb_create_window(c, argb ? 32 : screen->root_depth, w->id, screen->root, r->x,
+	                  r->y, max2(r->width, 1), max2(r->height, 1), r->border_width,
+	                  XCB_WINDOW_CLASS_INPUT_OUTPUT,
+	                  argb ? st->argb_visual : screen->root_visual,
+	                  XCB_CW_BACK_PIXEL | XCB_CW_BORDER_PIXEL |
+	                      XCB_CW_OVERRIDE_REDIRECT | XCB_CW_COLORMAP,
+	                  values);
+	w->gc = xcb_generate_id(c);
+	xcb_create_gc(c, w->gc, w->id, 0, NULL);
+	HASH_ADD_INT(st->windows, recorded, w);
+}
+
+static void destroy_window(struct replay_state *st, struct replay_window *w) {
+	HASH_DEL(st->windows, w);
+	xcb_free_gc(st->c, w->gc);
+	xcb_destroy_window(st->c, w->id);
+	free(w);
+}
+
+/// Put `w` right above the recorded window `below`, or at the bottom of the stack if
+/// `below` is XCB_NONE. Unknown siblings are ignored, they are not composited.
+static void restack_window(struct replay_state *st, struct replay_window *w,
+                           xcb_window_t below) {
+	if (below == XCB_NONE) {
+		xcb_configure_window(st->c, w->id, XCB_CONFIG_WINDOW_STACK_MODE,
+		                     (const uint32_t[]){XCB_STACK_MODE_BELOW});
+		return;
+	}
+	auto sibling = find_window(st, below);
+	if (sibling) {
+		xcb_configure_window(st->c, w->id,
+		                     XCB_CONFIG_WINDOW_SIBLING | XCB_CONFIG_WINDOW_STACK_MODE,
+		                     (const uint32_t[]){sibling->id, XCB_STACK_MODE_ABOVE});
+	}
+}
+
+static void configure_window(struct replay_state *st, struct replay_window *w,
+                             int16_t x, int16_t y, uint16_t width, uint16_t height,
+                             uint16_t border_width) {
+	// Order of values must match the order of the bits in the mask
+	const uint32_t values[] = {(uint32_t)x, (uint32_t)y, max2(width, 1),
+	                           max2(height, 1), border_width};
+	xcb_configure_window(st->c, w->id,
+	                     XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y |
+	                         XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT |
+	                         XCB_CONFIG_WINDOW_BORDER_WIDTH,
+	                     values);
+}
+
+static void replay_window_record(struct replay_state *st,
+                                 const struct event_record_window *r) {
+	auto w = find_window(st, r->id);
+	if (!w) {
+		create_window(st, r);
+		w = find_window(st, r->id);
+	} else {
+		configure_window(st, w, r->x, r->y, r->width, r->height, r->border_width);
+	}
+	restack_window(st, w, r->below);
+	if (r->map_state == XCB_MAP_STATE_VIEWABLE) {
+		xcb_map_window(st->c, w->id);
+	}
+}
+
+static void replay_damage(struct replay_state *st, const xcb_damage_notify_event_t *ev) {
+	auto w = find_window(st, ev->drawable);
+	if (!w) {
+		return;
+	}
+	xcb_change_gc(st->c, w->gc, XCB_GC_FOREGROUND, (const uint32_t[]){st->color++});
+	xcb_poly_fill_rectangle(st->c, w->id, w->gc, 1, &ev->area);
+}
+
+/// Turn a recorded event back into requests. Returns whether anything was replayed.
+static bool replay_event(struct replay_state *st, const xcb_generic_event_t *ev) {
+	auto type = ev->response_type & 0x7f;
+	if (type == st->header.damage_event + XCB_DAMAGE_NOTIFY) {
+		replay_damage(st, (const xcb_damage_notify_event_t *)ev);
+		return true;
+	}
+
+	// The window set is described by the structure events reported on the root
+	// window, the events reported on the windows themselves are duplicates.
+	struct replay_window *w = NULL;
+	switch (type) {
+	case XCB_MAP_NOTIFY: {
+		auto e = (const xcb_map_notify_event_t *)ev;
+		if (e->event != st->header.root || !(w = find_window(st, e->window))) {
+			return false;
+		}
+		xcb_map_window(st->c, w->id);
+		return true;
+	}
+	case XCB_UNMAP_NOTIFY: {
+		auto e = (const xcb_unmap_notify_event_t *)ev;
+		if (e->event != st->header.root || !(w = find_window(st, e->window))) {
+			return false;
+		}
+		xcb_unmap_window(st->c, w->id);
+		return true;
+	}
+	case XCB_DESTROY_NOTIFY: {
+		auto e = (const xcb_destroy_notify_event_t *)ev;
+		if (e->event != st->header.root || !(w = find_window(st, e->window))) {
+			return false;
+		}
+		destroy_window(st, w);
+		return true;
+	}
+	case XCB_REPARENT_NOTIFY: {
+		// Windows reparented to the root are recorded when picom starts
+		// managing them, only windows leaving the root need handling here.
+		auto e = (const xcb_reparent_notify_event_t *)ev;
+		if (e->event != st->header.root || e->parent == st->header.root ||
+		    !(w = find_window(st, e->window))) {
+			return false;
+		}
+		destroy_window(st, w);
+		return true;
+	}
+	case XCB_CONFIGURE_NOTIFY: {
+		auto e = (const xcb_configure_notify_event_t *)ev;
+		if (e->event != st->header.root || !(w = find_window(st, e->window))) {
+			return false;
+		}
+		configure_window(st, w, e->x, e->y, e->width, e->height, e->border_width);
+		restack_window(st, w, e->above_sibling);
+		return true;
+	}
+	case XCB_CIRCULATE_NOTIFY: {
+		auto e = (const xcb_circulate_notify_event_t *)ev;
+		if (e->event != st->header.root || !(w = find_window(st, e->window))) {
+			return false;
+		}
+		xcb_configure_window(st->c, w->id, XCB_CONFIG_WINDOW_STACK_MODE,
+		                     (const uint32_t[]){e->place == XCB_PLACE_ON_TOP
+		                                            ? XCB_STACK_MODE_ABOVE
+		                                            : XCB_STACK_MODE_BELOW});
+		return true;
+	}
+	default: return false;
+	}
+}
+
+static bool replay(struct replay_state *st) {
+	auto fd = xcb_get_file_descriptor(st->c);
+	auto start = get_time_ns();
+	size_t offset = 0;
+	uint64_t last_time = 0;
+
+	while (offset + sizeof(struct event_record) <= st->size) {
+		struct event_record record;
+		memcpy(&record, st->data + offset, sizeof(record));
+		offset += sizeof(record);
+		if (record.length > st->size - offset) {
+			fprintf(stderr, "Truncated recording\n");
+			break;
+		}
+		// Copy the payload out, records in the file are not aligned. None of the
+		// events we replay are bigger than the buffer.
+		union {
+			xcb_generic_event_t event;
+			struct event_record_window window;
+			char bytes[4096];
+		} payload;
+		memcpy(&payload, st->data + offset, min2(record.length, sizeof(payload)));
+		offset += record.length;
+
+		if (!st->o.fast) {
+			auto due = start + (uint64_t)((double)record.time / st->o.speed);
+			xcb_flush(st->c);
+			for (auto now = get_time_ns(); now < due; now = get_time_ns()) {
+				handle_events(st->c, &st->presents, replay_present, st);
+				struct pollfd pfd = {.fd = fd, .events = POLLIN};
+				poll(&pfd, 1, (int)min2((due - now) / 1000000 + 1, 1000));
+			}
+		}
+
+		if (record.type == EVENT_RECORD_WINDOW &&
+		    record.length >= sizeof(payload.window)) {
+			replay_window_record(st, &payload.window);
+			st->nreplayed++;
+		} else if (record.type == EVENT_RECORD_X_EVENT &&
+		           record.length >= sizeof(payload.event)) {
+			st->nreplayed += replay_event(st, &payload.event);
+		}
+		st->nrecords++;
+		last_time = record.time;
+
+		if (st->o.fast && st->nrecords % 256 == 0) {
+			// Don't let the X server's queue grow without bound
+			round_trip(st->c);
+			handle_events(st->c, &st->presents, replay_present, st);
+		}
+	}
+
+	round_trip(st->c);
+	handle_events(st->c, &st->presents, replay_present, st);
+	auto elapsed = (double)(get_time_ns() - start) / 1e9;
+	printf("records: %" PRIu64 ", %" PRIu64 " replayed\n", st->nrecords,
+	       st->nreplayed);
+	printf("recorded duration: %.3f s, replay duration: %.3f s\n",
+	       (double)last_time / 1e9, elapsed);
+	printf("records per second: %.1f\n", (double)st->nrecords / elapsed);
+	printf("presents: %" PRIu64 " (%.1f/s)\n", st->npresents,
+	       (double)st->npresents / elapsed);
+	return !xcb_connection_has_error(st->c);
+}
+
+static void usage(const char *argv0, FILE *f) {
+	fprintf(f,
+	        "Usage: %s [OPTION]... RECORDING\n\n"
+	        "Replay an X event recording made with picom --record-events against the "
+	        "running compositor.\n\n"
+	        "    --fast       replay as fast as possible, ignoring the recorded "
+	        "timing\n"
+	        "    --speed=X    playback speed relative to the recording "
+	        "(default: 1)\n",
+	        argv0);
+}
+
+static bool parse_options(int argc, char **argv, struct options *o) {
+	static const struct option longopts[] = {
+	    {"fast", no_argument, NULL, 'f'},
+	    {"speed", required_argument, NULL, 's'},
+	    {"help", no_argument, NULL, 'h'},
+	    {NULL, 0, NULL, 0},
+	};
+	*o = (struct options){
+	    .fast = false,
+	    .speed = 1,
+	};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "h", longopts, NULL)) != -1) {
+		switch (opt) {
+		case 'f': o->fast = true; break;
+		case 's': o->speed = atof(optarg); break;
+		case 'h': usage(argv[0], stdout); exit(0);
+		default: usage(argv[0], stderr); return false;
+		}
+	}
+
+	if (optind != argc - 1 || o->speed <= 0) {
+		usage(argv[0], stderr);
+		return false;
+	}
+	o->path = argv[optind];
+	return true;
+}
+
+int main(int argc, char **argv) {
+	struct replay_state st = {0};
+	if (!parse_options(argc, argv, &st.o) || !load_recording(&st)) {
+		return 1;
+	}
+
+	int screen_num;
+	st.c = xcb_connect(NULL, &screen_num);
+	if (xcb_connection_has_error(st.c)) {
+		fprintf(stderr, "Can't open display\n");
+		free(st.data);
+		return 1;
+	}
+	auto it = xcb_setup_roots_iterator(xcb_get_setup(st.c));
+	for (int i = 0; i < screen_num; i++) {
+		xcb_screen_next(&it);
+	}
+	st.screen = it.data;
+	if (st.header.root_width != st.screen->width_in_pixels ||
+	    st.header.root_height != st.screen->height_in_pixels) {
+		fprintf(stderr, "Recorded on a %dx%d screen, replaying on %dx%d\n",
+		        st.header.root_width, st.header.root_height,
+		        st.screen->width_in_pixels, st.screen->height_in_pixels);
+	}
+
+	int ret = 1;
+	if (!wait_for_compositor(st.c, screen_num, 10)) {
+		fprintf(stderr, "No compositor is running\n");
+		goto out;
+	}
+	if (!watch_overlay(st.c, st.screen, &st.presents)) {
+		goto out;
+	}
+
+	st.argb_visual = find_argb_visual(st.screen);
+	if (st.argb_visual != XCB_NONE) {
+		st.argb_colormap = xcb_generate_id(st.c);
+		xcb_create_colormap(st.c, XCB_COLORMAP_ALLOC_NONE, st.argb_colormap,
+		                    st.screen->root, st.argb_visual);
+	}
+
+	ret = replay(&st) ? 0 : 1;
+
+	struct replay_window *w, *tmp;
+	HASH_ITER(hh, st.windows, w, tmp) {
+		destroy_window(&st, w);
+	}
+	if (st.argb_colormap != XCB_NONE) {
+		xcb_free_colormap(st.c, st.argb_colormap);
+	}
+	unwatch_overlay(st.c, st.screen, &st.presents);
+out:
+	free(st.data);
+	xcb_disconnect(st.c);
+	return ret;
+}
@@ -0,0 +1,451 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+
+/// Synthetic X workload generator.
+///
+/// Connects to an X server that has a compositor running, creates a number of
+/// override-redirect windows of mixed depths, then hammers them with one kind of
+/// request for a fixed amount of time. Frames presented by the compositor are
+/// observed through a damage object on the composite overlay window, which lets us
+/// measure both the compositor's throughput and the latency from a client request to
+/// the next present.
+///
+/// With --corner-radius, the windows get rounded bounding shapes, which the compositor
+/// sees as regions of many rectangles, like those of shaped and rounded windows.
+///
+/// The workload is fully determined by the command line, including the seed of the
+/// random number generator, so runs are comparable across commits.
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xcb/shape.h>
+#include <xcb/xcb.h>
+
+#include "compiler.h"
+#include "statistics.h"
+#include "utils.h"
+#include "x_common.h"
+
+enum workload {
+	WORKLOAD_DAMAGE,
+	WORKLOAD_CONFIGURE,
+	WORKLOAD_PROPERTY,
+	WORKLOAD_MAP,
+	WORKLOAD_MIXED,
+	NUM_WORKLOADS,
+};
+
+static const char *const WORKLOAD_STRS[NUM_WORKLOADS] = {
+    [WORKLOAD_DAMAGE] = "damage",       [WORKLOAD_CONFIGURE] = "configure",
+    [WORKLOAD_PROPERTY] = "property",   [WORKLOAD_MAP] = "map",
+    [WORKLOAD_MIXED] = "mixed",
+};
+
+struct options {
+	enum workload workload;
+	int nwindows;
+	/// Requests per second, 0 means as fast as the X server accepts them.
+	int rate;
+	/// Side length of the rectangles drawn by the damage workload.
+	int damage_size;
+	/// Radius of the rounded corners of the windows, 0 for rectangular windows.
+	int corner_radius;
+	double duration;
+	uint64_t seed;
+};
+
+struct test_window {
+	xcb_window_t id;
+	xcb_gcontext_t gc;
+	uint8_t depth;
+	bool mapped;
+	int width, height;
+};
+
+struct workload_state {
+	xcb_connection_t *c;
+	xcb_screen_t *screen;
+	struct options o;
+	struct test_window *windows;
+	uint64_t rng;
+
+	xcb_atom_t a_NET_WM_NAME;
+	xcb_atom_t aUTF8_STRING;
+
+	struct present_watch presents;
+
+	/// Time the oldest request not yet followed by a present was sent, 0 if there
+	/// is none.
+	uint64_t pending_since;
+	uint64_t nrequests;
+	uint64_t npresents;
+	struct sample_stats latency;
+};
+
+/// xorshift64*, good enough and reproducible everywhere.
+static uint64_t rng_next(struct workload_state *st) {
+	st->rng ^= st->rng >> 12;
+	st->rng ^= st->rng << 25;
+	st->rng ^= st->rng >> 27;
+	return st->rng * 0x2545F4914F6CDD1DULL;
+}
+
+static int rng_range(struct workload_state *st, int lo, int hi) {
+	return lo + (int)(rng_next(st) % (uint64_t)(hi - lo + 1));
+}
+
+/// Give the window a bounding shape with rounded corners. Each row of pixels within the
+/// corners is a rectangle of its own.
+static void shape_window(struct workload_state *st, struct test_window *w) {
+	auto radius = min2(st->o.corner_radius, min2(w->width, w->height) / 2);
+	auto rects = ccalloc(2 * radius + 1, xcb_rectangle_t);
+	int nrects = 0;
+	for (int y = 0; y < radius; y++) {
+		// Horizontal inset of the row, from the circle around the corner's center
+		auto dy = radius - y;
+		int inset = 0;
+		while (inset < radius && (radius - inset) * (radius - inset) + dy * dy >
+		                             radius * radius) {
+			inset++;
+		}
+		auto width = (uint16_t)(w->width - 2 * inset);
+		rects[nrects++] = (xcb_rectangle_t){(int16_t)inset, (int16_t)y, width, 1};
+		rects[nrects++] = (xcb_rectangle_t){
+		    (int16_t)inset, (int16_t)(w->height - 1 - y), width, 1};
+	}
+	rects[nrects++] = (xcb_rectangle_t){0, (int16_t)radius, (uint16_t)w->width,
+	                                    (uint16_t)(w->height - 2 * radius)};
+	xcb_shape_rectangles(st->c, XCB_SHAPE_SO_SET, XCB_SHAPE_SK_BOUNDING,
+	                     XCB_CLIP_ORDERING_UNSORTED, w->id, 0, 0, (uint32_t)nrects,
+	                     rects);
+	free(rects);
+}
+
+static bool create_windows(struct workload_state *st) {
+	auto c = st->c;
+	auto screen = st->screen;
+	auto argb_visual = find_argb_visual(screen);
+	xcb_colormap_t argb_colormap = XCB_NONE;
+	if (argb_visual != XCB_NONE) {
+		argb_colormap = xcb_generate_id(c);
+		xcb_create_colormap(c, XCB_COLORMAP_ALLOC_NONE, argb_colormap,
+		                    screen->root, argb_visual);
+	} else {
+		fprintf(stderr, "No 32-bit visual, all windows will have the root depth\n");
+	}
+
+	st->windows = ccalloc(st->o.nwindows, struct test_window);
+	for (int i = 0; i < st->o.nwindows; i++) {
+		auto w = &st->windows[i];
+		// Alternate between the root depth and 32-bit windows
+		bool argb = argb_visual != XCB_NONE && i % 2 == 1;
+		w->id = xcb_generate_id(c);
+		w->depth = argb ? 32 : screen->root_depth;
+		w->width = rng_range(st, 64, max2(64, screen->width_in_pixels / 3));
+		w->height = rng_range(st, 64, max2(64, screen->height_in_pixels / 3));
+		auto x = rng_range(st, 0, max2(0, screen->width_in_pixels - w->width));
+		auto y = rng_range(st, 0, max2(0, screen->height_in_pixels - w->height));
+
+		// Order of values must match the order of the bits in the mask
+		const uint32_t values[] = {
+		    (uint32_t)rng_next(st), 0, 1,
+		    argb ? argb_colormap : screen->default_colormap};
+		xcb_create_window(
+		    c, w->depth, w->id, screen->root, (int16_t)x, (int16_t)y,
+		    (uint16_t)w->width, (uint16_t)w->height, 0, XCB_WINDOW_CLASS_INPUT_OUTPUT,
+		    argb ? argb_visual : screen->root_visual,
+		    XCB_CW_BACK_PIXEL | XCB_CW_BORDER_PIXEL | XCB_CW_OVERRIDE_REDIRECT |
+		        XCB_CW_COLORMAP,
+		    values);
+
+		if (st->o.corner_radius > 0) {
+			shape_window(st, w);
+		}
+
+		w->gc = xcb_generate_id(c);
+		xcb_create_gc(c, w->gc, w->id, 0, NULL);
+		xcb_map_window(c, w->id);
+		w->mapped = true;
+	}
+
+	if (argb_colormap != XCB_NONE) {
+		xcb_free_colormap(c, argb_colormap);
+	}
+
+	round_trip(c);
+	if (xcb_connection_has_error(c)) {
+		fprintf(stderr, "Failed to create windows\n");
+		return false;
+	}
+	return true;
+}
+
+static void destroy_windows(struct workload_state *st) {
+	for (int i = 0; i < st->o.nwindows; i++) {
+		xcb_free_gc(st->c, st->windows[i].gc);
+		xcb_destroy_window(st->c, st->windows[i].id);
+	}
+	free(st->windows);
+	st->windows = NULL;
+}
+
+static void workload_present(void *ud) {
+	struct workload_state *st = ud;
+	auto now = get_time_ns();
+	st->npresents++;
+	if (st->pending_since) {
+		sample_stats_add(&st->latency, now - st->pending_since);
+		st->pending_since = 0;
+	}
+}
+
+static void op_damage(struct workload_state *st, struct test_window *w) {
+	auto size = min2(st->o.damage_size, min2(w->width, w->height));
+	xcb_rectangle_t rect = {
+	    .x = (int16_t)rng_range(st, 0, w->width - size),
+	    .y = (int16_t)rng_range(st, 0, w->height - size),
+	    .width = (uint16_t)size,
+	    .height = (uint16_t)size,
+	};
+	xcb_change_gc(st->c, w->gc, XCB_GC_FOREGROUND,
+	              (const uint32_t[]){(uint32_t)rng_next(st)});
+	xcb_poly_fill_rectangle(st->c, w->id, w->gc, 1, &rect);
+}
+
+static void op_configure(struct workload_state *st, struct test_window *w) {
+	if (rng_next(st) % 4 == 0) {
+		// Restack
+		xcb_configure_window(st->c, w->id, XCB_CONFIG_WINDOW_STACK_MODE,
+		                     (const uint32_t[]){XCB_STACK_MODE_ABOVE});
+		return;
+	}
+	auto screen = st->screen;
+	w->width = rng_range(st, 64, max2(64, screen->width_in_pixels / 3));
+	w->height = rng_range(st, 64, max2(64, screen->height_in_pixels / 3));
+	const uint32_t values[] = {
+	    (uint32_t)rng_range(st, 0, max2(0, screen->width_in_pixels - w->width)),
+	    (uint32_t)rng_range(st, 0, max2(0, screen->height_in_pixels - w->height)),
+	    (uint32_t)w->width, (uint32_t)w->height};
+	xcb_configure_window(st->c, w->id,
+	                     XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y |
+	                         XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT,
+	                     values);
+}
+
+static void op_property(struct workload_state *st, struct test_window *w) {
+	char name[64];
+	auto len = snprintf(name, sizeof(name), "xworkload %016" PRIx64, rng_next(st));
+	xcb_change_property(st->c, XCB_PROP_MODE_REPLACE, w->id, st->a_NET_WM_NAME,
+	                    st->aUTF8_STRING, 8, (uint32_t)len, name);
+	xcb_change_property(st->c, XCB_PROP_MODE_REPLACE, w->id, XCB_ATOM_WM_NAME,
+	                    XCB_ATOM_STRING, 8, (uint32_t)len, name);
+}
+
+static void op_map(struct workload_state *st, struct test_window *w) {
+	if (w->mapped) {
+		xcb_unmap_window(st->c, w->id);
+	} else {
+		xcb_map_window(st->c, w->id);
+	}
+	w->mapped = !w->mapped;
+}
+
+static void run_one(struct workload_state *st) {
+	auto w = &st->windows[rng_range(st, 0, st->o.nwindows - 1)];
+	auto workload = st->o.workload;
+	if (workload == WORKLOAD_MIXED) {
+		workload = (enum workload)rng_range(st, 0, WORKLOAD_MIXED - 1);
+	}
+	switch (workload) {
+	case WORKLOAD_DAMAGE: op_damage(st, w); break;
+	case WORKLOAD_CONFIGURE: op_configure(st, w); break;
+	case WORKLOAD_PROPERTY: op_property(st, w); break;
+	case WORKLOAD_MAP: op_map(st, w); break;
+	case WORKLOAD_MIXED:
+	case NUM_WORKLOADS: assert(false);
+	}
+	xcb_flush(st->c);
+
+	if (!st->pending_since) {
+		st->pending_since = get_time_ns();
+	}
+	st->nrequests++;
+}
+
+static void run_workload(struct workload_state *st) {
+	auto fd = xcb_get_file_descriptor(st->c);
+	auto start = get_time_ns();
+	auto end = start + (uint64_t)(st->o.duration * 1e9);
+	uint64_t interval = 0;
+	if (st->o.rate > 0) {
+		interval = (uint64_t)1000000000 / (uint64_t)st->o.rate;
+	}
+	auto next = start;
+
+	for (auto now = start; now < end; now = get_time_ns()) {
+		if (now >= next) {
+			run_one(st);
+			next += interval;
+			if (!interval && st->nrequests % 64 == 0) {
+				// Don't let the X server's queue grow without bound
+				round_trip(st->c);
+			}
+		}
+		handle_events(st->c, &st->presents, workload_present, st);
+
+		if (interval && next > now) {
+			auto timeout = (next - now) / 1000000;
+			struct pollfd pfd = {.fd = fd, .events = POLLIN};
+			poll(&pfd, 1, (int)min2(timeout, 1000));
+		}
+	}
+
+	// Give the compositor a chance to catch up with the last requests
+	round_trip(st->c);
+	auto drain_end = get_time_ns() + 100000000ULL;
+	for (auto now = get_time_ns(); now < drain_end; now = get_time_ns()) {
+		handle_events(st->c, &st->presents, workload_present, st);
+		struct pollfd pfd = {.fd = fd, .events = POLLIN};
+		poll(&pfd, 1, 10);
+	}
+	handle_events(st->c, &st->presents, workload_present, st);
+
+	auto elapsed = (double)(get_time_ns() - start) / 1e9;
+	printf("workload %s, %d windows, seed %" PRIu64 "\n", WORKLOAD_STRS[st->o.workload],
+	       st->o.nwindows, st->o.seed);
+	printf("requests: %" PRIu64 " (%.1f/s)\n", st->nrequests,
+	       (double)st->nrequests / elapsed);
+	printf("presents: %" PRIu64 " (%.1f/s)\n", st->npresents,
+	       (double)st->npresents / elapsed);
+	sample_stats_print(&st->latency, "request-to-present latency", stdout);
+}
+
+static void usage(const char *argv0, FILE *f) {
+	fprintf(f,
+	        "Usage: %s [OPTION]...\n\n"
+	        "Generate a reproducible X workload and measure how the running "
+	        "compositor copes.\n\n"
+	        "    --workload=NAME   damage, configure, property, map or mixed "
+	        "(default: damage)\n"
+	        "    --windows=N       number of windows to create (default: 16)\n"
+	        "    --rate=HZ         requests per second, 0 for unlimited "
+	        "(default: 0)\n"
+	        "    --damage-size=PX  size of the damaged rectangles (default: 64)\n"
+	        "    --corner-radius=PX  round the corners of the windows with the "
+	        "SHAPE extension (default: 0)\n"
+	        "    --duration=SEC    how long to run the workload (default: 5)\n"
+	        "    --seed=N          random seed (default: 1)\n",
+	        argv0);
+}
+
+static bool parse_options(int argc, char **argv, struct options *o) {
+	static const struct option longopts[] = {
+	    {"workload", required_argument, NULL, 'w'},
+	    {"windows", required_argument, NULL, 'n'},
+	    {"rate", required_argument, NULL, 'r'},
+	    {"damage-size", required_argument, NULL, 's'},
+	    {"corner-radius", required_argument, NULL, 'c'},
+	    {"duration", required_argument, NULL, 'd'},
+	    {"seed", required_argument, NULL, 'S'},
+	    {"help", no_argument, NULL, 'h'},
+	    {NULL, 0, NULL, 0},
+	};
+	*o = (struct options){
+	    .workload = WORKLOAD_DAMAGE,
+	    .nwindows = 16,
+	    .rate = 0,
+	    .damage_size = 64,
+	    .duration = 5,
+	    .seed = 1,
+	};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "h", longopts, NULL)) != -1) {
+		switch (opt) {
+		case 'w':
+			o->workload = NUM_WORKLOADS;
+			for (int i = 0; i < NUM_WORKLOADS; i++) {
+				if (strcmp(optarg, WORKLOAD_STRS[i]) == 0) {
+					o->workload = i;
+				}
+			}
+			if (o->workload == NUM_WORKLOADS) {
+				fprintf(stderr, "Unknown workload %s\n", optarg);
+				return false;
+			}
+			break;
+		case 'n': o->nwindows = atoi(optarg); break;
+		case 'r': o->rate = atoi(optarg); break;
+		case 's': o->damage_size = atoi(optarg); break;
+		case 'c': o->corner_radius = atoi(optarg); break;
+		case 'd': o->duration = atof(optarg); break;
+		case 'S': o->seed = strtoull(optarg, NULL, 0); break;
+		case 'h': usage(argv[0], stdout); exit(0);
+		default: usage(argv[0], stderr); return false;
+		}
+	}
+
+	if (o->nwindows <= 0 || o->rate < 0 || o->damage_size <= 0 ||
+	    o->corner_radius < 0 || o->duration <= 0) {
+		fprintf(stderr, "Invalid arguments\n");
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char **argv) {
+	struct workload_state st = {0};
+	if (!parse_options(argc, argv, &st.o)) {
+		return 1;
+	}
+	// xorshift doesn't work with a zero state
+	st.rng = st.o.seed ? st.o.seed : 1;
+	sample_stats_init(&st.latency);
+
+	int screen_num;
+	st.c = xcb_connect(NULL, &screen_num);
+	if (xcb_connection_has_error(st.c)) {
+		fprintf(stderr, "Can't open display\n");
+		return 1;
+	}
+	auto it = xcb_setup_roots_iterator(xcb_get_setup(st.c));
+	for (int i = 0; i < screen_num; i++) {
+		xcb_screen_next(&it);
+	}
+	st.screen = it.data;
+
+	int ret = 1;
+	if (!wait_for_compositor(st.c, screen_num, 10)) {
+		fprintf(stderr, "No compositor is running\n");
+		goto out;
+	}
+	if (!watch_overlay(st.c, st.screen, &st.presents)) {
+		goto out;
+	}
+	st.a_NET_WM_NAME = intern_atom(st.c, "_NET_WM_NAME");
+	st.aUTF8_STRING = intern_atom(st.c, "UTF8_STRING");
+
+	if (create_windows(&st)) {
+		// Let the compositor pick up the new windows before we start measuring
+		round_trip(st.c);
+		poll(NULL, 0, 500);
+		handle_events(st.c, &st.presents, workload_present, &st);
+		st.npresents = 0;
+		sample_stats_reset(&st.latency);
+
+		run_workload(&st);
+		// No presents means the compositor didn't react to anything we did
+		ret = st.npresents ? 0 : 1;
+	}
+	destroy_windows(&st);
+
+	unwatch_overlay(st.c, st.screen, &st.presents);
+out:
+	sample_stats_destroy(&st.latency);
+	xcb_disconnect(st.c);
+	return ret;
+}
@@ -5,11 +5,17 @@
 #include "common.h"
 #include "utils.h"
 #include "log.h"
+#include "x.h"
 
-static inline void *atom_getter(void *ud, const char *atom_name, int *err) {
+static inline void *
+atom_getter(void *ud, const void *key, size_t key_size attr_unused, int *err) {
 	xcb_connection_t *c = ud;
-	xcb_intern_atom_reply_t *reply = xcb_intern_atom_reply(
-	    c, xcb_intern_atom(c, 0, to_u16_checked(strlen(atom_name)), atom_name), NULL);
+	const char *atom_name = key;
+	xcb_intern_atom_reply_t *reply = X_ROUNDTRIP(
+	    "xcb_intern_atom",
+	    xcb_intern_atom_reply(
+	        c, xcb_intern_atom(c, 0, to_u16_checked(strlen(atom_name)), atom_name),
+	        NULL));
 
 	xcb_atom_t atom = XCB_NONE;
 	if (reply) {
@@ -8,7 +8,9 @@
 #include "compiler.h"
 #include "config.h"
 #include "log.h"
+#include "picom.h"
 #include "region.h"
+#include "trace.h"
 #include "types.h"
 #include "win.h"
 #include "x.h"
@@ -46,29 +48,146 @@ region_t get_damage(session_t *ps, bool all_damage) {
 	return region;
 }
 
-void handle_device_reset(session_t *ps) {
-	log_error("Device reset detected");
-	// Wait for reset to complete
-	// Although ideally the backend should return DEVICE_STATUS_NORMAL after a reset
-	// is completed, it's not always possible.
-	//
-	// According to ARB_robustness (emphasis mine):
-	//
-	//     "If a reset status other than NO_ERROR is returned and subsequent
-	//     calls return NO_ERROR, the context reset was encountered and
-	//     completed. If a reset status is repeatedly returned, the context **may**
-	//     be in the process of resetting."
-	//
-	//  Which means it may also not be in the process of resetting. For example on
-	//  AMDGPU devices, Mesa OpenGL always return CONTEXT_RESET after a reset has
-	//  started, completed or not.
-	//
-	//  So here we blindly wait 5 seconds and hope ourselves best of the luck.
-	sleep(5);
-
-	// Reset picom
-	log_info("Resetting picom after device reset");
-	ev_break(ps->loop, EVBREAK_ALL);
+/// Compose the root image, or black if there is none, clipped to `reg_clip`.
+static void compose_root(session_t *ps, const region_t *reg_clip,
+                         const region_t *reg_visible) {
+	if (ps->root_image) {
+		ps->backend_data->ops->compose(ps->backend_data, ps->root_image,
+		                               (coord_t){0}, reg_clip, reg_visible);
+	} else {
+		ps->backend_data->ops->fill(ps->backend_data, (struct color){0, 0, 0, 1},
+		                            reg_clip);
+	}
+	ps->frame_stats.pixels_composed += region_area(reg_clip);
+}
+
+/// Compose `w` clipped to its bounding shape and `reg_paint`, minus `reg_covered` if it
+/// isn't NULL.
+static void compose_window(session_t *ps, struct managed_win *w,
+                           const region_t *reg_paint, const region_t *reg_covered,
+                           const region_t *reg_visible) {
+	assert(!(w->flags & WIN_FLAGS_IMAGE_ERROR));
+	assert(!(w->flags & WIN_FLAGS_PIXMAP_STALE));
+	assert(!(w->flags & WIN_FLAGS_PIXMAP_NONE));
+
+	// The bounding shape of the window, in global/target coordinates
+	// reminder: bounding shape contains the WM frame
+	auto reg_bound = win_get_bounding_shape_global_by_val(w);
+
+	// The clip region for the current window, in global/target coordinates
+	// reg_paint_in_bound \in reg_paint
+	region_t reg_paint_in_bound;
+	pixman_region32_init(&reg_paint_in_bound);
+	pixman_region32_intersect(&reg_paint_in_bound, &reg_bound, (region_t *)reg_paint);
+	if (reg_covered) {
+		pixman_region32_subtract(&reg_paint_in_bound, &reg_paint_in_bound,
+		                         (region_t *)reg_covered);
+	}
+	pixman_region32_fini(&reg_bound);
+	if (!pixman_region32_not_empty(&reg_paint_in_bound)) {
+		// Outside of the damage, or completely covered by opaque windows above
+		pixman_region32_fini(&reg_paint_in_bound);
+		return;
+	}
+
+	/* TODO(yshui) since the backend might change the content of the window
+	 * (e.g. with shaders), we should consult the backend whether the window
+	 * is transparent or not. */
+	coord_t window_coord = {.x = w->g.x, .y = w->g.y};
+
+	trace_begin_window("render", "compose", w->base.id);
+	auto compose_start = get_time_ns();
+	ps->backend_data->ops->compose(ps->backend_data, w->win_image, window_coord,
+	                               &reg_paint_in_bound, reg_visible);
+	w->stats.ncompose++;
+	w->stats.compose_rects += (uint64_t)pixman_region32_n_rects(&reg_paint_in_bound);
+	w->stats.compose_ns += get_time_ns() - compose_start;
+	trace_end("render", "compose");
+	ps->frame_stats.pixels_composed += region_area(&reg_paint_in_bound);
+
+	pixman_region32_fini(&reg_paint_in_bound);
+}
+
+/// Compose the windows from bottom to top, clipping each of them to the part not
+/// covered by opaque windows above it.
+static void paint_region_culled(session_t *ps, struct managed_win *t,
+                                const region_t *reg_paint) {
+	// A hint to backend, the region that will be visible on screen
+	// backend can optimize based on this info
+	region_t reg_visible;
+	pixman_region32_init(&reg_visible);
+	pixman_region32_copy(&reg_visible, &ps->screen_reg);
+
+	// The root is only visible where no opaque window covers it, which is where
+	// neither the windows above the bottom window, nor the bottom window itself,
+	// are opaque.
+	region_t reg_root;
+	pixman_region32_init(&reg_root);
+	if (t) {
+		win_get_opaque_region_global(t, &reg_root);
+		pixman_region32_union(&reg_root, &reg_root, t->reg_ignore);
+	}
+	pixman_region32_subtract(&reg_root, (region_t *)reg_paint, &reg_root);
+	if (pixman_region32_not_empty(&reg_root)) {
+		compose_root(ps, &reg_root, &reg_visible);
+	}
+	pixman_region32_fini(&reg_root);
+
+	// Windows are sorted from bottom to top
+	// Each window has a reg_ignore, which is the region obscured by all the windows
+	// on top of that window. Nothing is painted there, so each pixel is composed
+	// once for the top most opaque window covering it, plus once for each
+	// transparent window above that.
+	for (auto w = t; w; w = w->prev_trans) {
+		pixman_region32_subtract(&reg_visible, &ps->screen_reg, w->reg_ignore);
+		compose_window(ps, w, reg_paint, w->reg_ignore, &reg_visible);
+	}
+	pixman_region32_fini(&reg_visible);
+}
+
+/// Compose the windows with the backend's depth buffer. Opaque windows are drawn front
+/// to back, so the GPU's early depth test rejects the pixels of everything behind
+/// them, then the root, then the translucent windows back to front. Windows are only
+/// clipped to their bounding shape, which saves the region subtractions of the region
+/// strategy, whose cost grows with the number of rectangles of shaped windows.
+///
+/// Returns false if the backend can't compose with a depth buffer.
+static bool paint_depth_sorted(session_t *ps, struct managed_win *t,
+                               const region_t *reg_paint) {
+	auto ops = ps->backend_data->ops;
+	int nwins = 0;
+	for (auto w = t; w; w = w->prev_trans) {
+		nwins++;
+	}
+	// The root is layer 0, the windows are stacked on top of it
+	if (!ops->begin_depth || !ops->begin_depth(ps->backend_data, nwins + 1)) {
+		return false;
+	}
+
+	auto wins = ccalloc(nwins, struct managed_win *);
+	int i = 0;
+	for (auto w = t; w; w = w->prev_trans) {
+		wins[i++] = w;
+	}
+
+	for (i = nwins - 1; i >= 0; i--) {
+		if (wins[i]->mode == WMODE_SOLID) {
+			ops->set_depth(ps->backend_data, DEPTH_MODE_OPAQUE, i + 1);
+			compose_window(ps, wins[i], reg_paint, NULL, &ps->screen_reg);
+		}
+	}
+	ops->set_depth(ps->backend_data, DEPTH_MODE_OPAQUE, 0);
+	compose_root(ps, reg_paint, &ps->screen_reg);
+	for (i = 0; i < nwins; i++) {
+		if (wins[i]->mode != WMODE_SOLID) {
+			ops->set_depth(ps->backend_data, DEPTH_MODE_TRANSLUCENT, i + 1);
+			compose_window(ps, wins[i], reg_paint, NULL, &ps->screen_reg);
+		}
+	}
+	ops->set_depth(ps->backend_data, DEPTH_MODE_NONE, 0);
+
+	free(wins);
+	return true;
 }
 
 /// paint all windows
@@ -77,15 +196,13 @@ void paint_all_new(session_t *ps, struct managed_win *t, bool ignore_damage) {
 	    ps->backend_data->ops->device_status(ps->backend_data) != DEVICE_STATUS_NORMAL) {
 		return handle_device_reset(ps);
 	}
-	if (ps->o.xrender_sync_fence) {
-		if (ps->xsync_exists && !x_fence_sync(ps->c, ps->sync_fence)) {
-			log_error("x_fence_sync failed, xrender-sync-fence will be "
-			          "disabled from now on.");
-			xcb_sync_destroy_fence(ps->c, ps->sync_fence);
-			ps->sync_fence = XCB_NONE;
-			ps->o.xrender_sync_fence = false;
-			ps->xsync_exists = false;
-		}
+	trace_begin("frame", "paint_all_new");
+	ps->frame_stats.pixels_composed = 0;
+	ps->frame_stats.pixels_presented = 0;
+	ps->frame_stats.state_calls_issued = 0;
+	ps->frame_stats.state_calls_elided = 0;
+	if (ps->o.xrender_sync_fence && ps->xsync_exists) {
+		x_fence_sync(ps);
 	}
 	// All painting will be limited to the damage, if _some_ of
 	// the paints bleed out of the damage region, it will destroy
@@ -100,6 +217,7 @@ void paint_all_new(session_t *ps, struct managed_win *t, bool ignore_damage) {
 
 	if (!pixman_region32_not_empty(&reg_damage)) {
 		pixman_region32_fini(&reg_damage);
+		trace_end("frame", "paint_all_new");
 		return;
 	}
 
@@ -117,53 +235,20 @@ void paint_all_new(session_t *ps, struct managed_win *t, bool ignore_damage) {
 	pixman_region32_init(&reg_paint);
 	pixman_region32_copy(&reg_paint, &reg_damage);
 
-	// A hint to backend, the region that will be visible on screen
-	// backend can optimize based on this info
-	region_t reg_visible;
-	pixman_region32_init(&reg_visible);
-	pixman_region32_copy(&reg_visible, &ps->screen_reg);
-
-	if (ps->root_image) {
-		ps->backend_data->ops->compose(ps->backend_data, ps->root_image,
-		                               (coord_t){0}, &reg_paint, &reg_visible);
-	} else {
-		ps->backend_data->ops->fill(ps->backend_data, (struct color){0, 0, 0, 1},
-		                            &reg_paint);
+	bool painted = false;
+	if (ps->o.compose_strategy == COMPOSE_STRATEGY_DEPTH) {
+		painted = paint_depth_sorted(ps, t, &reg_paint);
+		if (!painted) {
+			log_warn("The backend can't compose with a depth buffer, falling "
+			         "back to the region compose strategy.");
+			ps->o.compose_strategy = COMPOSE_STRATEGY_REGION;
+		}
 	}
-
-	// Windows are sorted from bottom to top
-	// Each window has a reg_ignore, which is the region obscured by all the windows
-	// on top of that window. This is used to reduce the number of pixels painted.
-	//
-	// Whether this is beneficial is to be determined XXX
-	for (auto w = t; w; w = w->prev_trans) {
-		pixman_region32_subtract(&reg_visible, &ps->screen_reg, w->reg_ignore);
-		assert(!(w->flags & WIN_FLAGS_IMAGE_ERROR));
-		assert(!(w->flags & WIN_FLAGS_PIXMAP_STALE));
-		assert(!(w->flags & WIN_FLAGS_PIXMAP_NONE));
-
-		// The bounding shape of the window, in global/target coordinates
-		// reminder: bounding shape contains the WM frame
-		auto reg_bound = win_get_bounding_shape_global_by_val(w);
-
-		// The clip region for the current window, in global/target coordinates
-		// reg_paint_in_bound \in reg_paint
-		region_t reg_paint_in_bound;
-		pixman_region32_init(&reg_paint_in_bound);
-		pixman_region32_intersect(&reg_paint_in_bound, &reg_bound, &reg_paint);
-
-		/* TODO(yshui) since the backend might change the content of the window
-		 * (e.g. with shaders), we should consult the backend whether the window
-		 * is transparent or not. */
-		coord_t window_coord = {.x = w->g.x, .y = w->g.y};
-
-		ps->backend_data->ops->compose(ps->backend_data, w->win_image, window_coord,
-		                               &reg_paint_in_bound, &reg_visible);
-
-		pixman_region32_fini(&reg_bound);
-		pixman_region32_fini(&reg_paint_in_bound);
+	if (!painted) {
+		paint_region_culled(ps, t, &reg_paint);
 	}
 	pixman_region32_fini(&reg_paint);
+	ps->frame_stats.pixels_presented = region_area(&reg_damage);
 
 	// Move the head of the damage ring
 	ps->damage = ps->damage - 1;
@@ -175,10 +260,18 @@ void paint_all_new(session_t *ps, struct managed_win *t, bool ignore_damage) {
 	if (ps->backend_data->ops->present) {
 		// Present the rendered scene
 		// Vsync is done here
+		trace_begin("frame", "present");
 		ps->backend_data->ops->present(ps->backend_data, &reg_damage);
+		trace_end("frame", "present");
+		damage_latency_frame_presented(ps);
+	}
+	if (ps->backend_data->ops->take_frame_stats) {
+		ps->backend_data->ops->take_frame_stats(ps->backend_data,
+		                                        &ps->frame_stats);
 	}
 
 	pixman_region32_fini(&reg_damage);
+	trace_end("frame", "paint_all_new");
 }
 
 // vim: set noet sw=8 ts=8 :
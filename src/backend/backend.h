@@ -13,6 +13,7 @@
 
 typedef struct session session_t;
 struct managed_win;
+struct frame_stats;
 
 struct ev_loop;
 struct backend_operations;
@@ -48,6 +49,18 @@ enum device_status {
 	DEVICE_STATUS_RESETTING,
 };
 
+/// How `compose` and `fill` use the depth buffer, see `set_depth`.
+enum depth_mode {
+	/// Don't use the depth buffer.
+	DEPTH_MODE_NONE,
+	/// Draw opaque content, and record its depth. Pixels behind the recorded depth
+	/// are skipped.
+	DEPTH_MODE_OPAQUE,
+	/// Blend translucent content. Pixels behind the recorded depth are skipped, and
+	/// the depth buffer is left alone.
+	DEPTH_MODE_TRANSLUCENT,
+};
+
 enum image_properties {
 	// The effective size of the image, the image will be tiled to fit.
 	// 2 int, default: the actual size of the image
@@ -114,6 +127,20 @@ struct backend_operations {
 	/// Fill rectangle of the rendering buffer, mostly for debug purposes, optional.
 	void (*fill)(backend_t *backend_data, struct color, const region_t *clip);
 
+	/// Clear the depth buffer for a frame composed with the depth strategy. `nlayers`
+	/// is the number of layers that will be passed to `set_depth`. Returns false if
+	/// the backend can't do depth testing.
+	///
+	/// Optional
+	bool (*begin_depth)(backend_t *backend_data, int nlayers);
+
+	/// Set how the following `compose` and `fill` calls use the depth buffer, and
+	/// the layer they draw at. Higher layers are in front of lower ones. Depth
+	/// testing stays on until this is called with `DEPTH_MODE_NONE`.
+	///
+	/// Required if begin_depth is present.
+	void (*set_depth)(backend_t *backend_data, enum depth_mode mode, int layer);
+
 	/// Update part of the back buffer with the rendering buffer, then present the
 	/// back buffer onto the target window (if not back buffered, update part of the
 	/// target window directly).
@@ -208,9 +235,27 @@ struct backend_operations {
 	enum driver (*detect_driver)(backend_t *backend_data);
 
 	enum device_status (*device_status)(backend_t *backend_data);
+
+	/// Add the backend's counters of the frame that was just presented to `stats`,
+	/// and reset them.
+	///
+	/// Optional
+	void (*take_frame_stats)(backend_t *backend_data, struct frame_stats *stats);
+
+	/// Tell the backend the content of the pixmap bound to `image_data` has
+	/// changed, for backends that keep copies of it.
+	///
+	/// Optional
+	void (*image_damaged)(backend_t *backend_data, void *image_data);
 };
 
 extern struct backend_operations *backend_list[];
 
+/// Get the region that needs to be repainted, based on the damage ring and the buffer
+/// age reported by the backend.
+///
+/// @param all_damage if true ignore damage and repaint the whole screen
+region_t get_damage(session_t *ps, bool all_damage);
+
 void paint_all_new(session_t *ps, struct managed_win *const t, bool ignore_damage)
     attr_nonnull(1);
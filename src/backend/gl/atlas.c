@@ -0,0 +1,220 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include <stdlib.h>
+
+#include "backend/gl/atlas.h"
+#include "backend/gl/gl_common.h"
+#include "log.h"
+#include "utils.h"
+
+struct gl_atlas_shelf {
+	int y, height;
+	/// Where the next image on the shelf goes
+	int x;
+	/// Number of entries on the shelf
+	int nlive;
+};
+
+struct gl_atlas {
+	GLuint texture, fbo;
+	int size;
+	/// Shelves, from the bottom of the atlas up
+	struct gl_atlas_shelf *shelves;
+	int nshelves, shelves_capacity;
+	/// Top of the top most shelf
+	int top;
+	/// All entries, including the ones without a place
+	struct list_node entries;
+	/// Number of entries released since the atlas was last packed
+	int nfreed;
+};
+
+struct gl_atlas *gl_atlas_new(struct gl_data *gd, int size) {
+	auto atlas = ccalloc(1, struct gl_atlas);
+	atlas->size = size;
+	list_init_head(&atlas->entries);
+
+	atlas->texture = gl_new_texture(gd);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size, size, 0, GL_BGRA,
+	             GL_UNSIGNED_BYTE, NULL);
+	glGenFramebuffers(1, &atlas->fbo);
+	gl_state_bind_framebuffer(gd, GL_DRAW_FRAMEBUFFER, atlas->fbo);
+	glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+	                       atlas->texture, 0);
+	gl_state_draw_buffer(gd, GL_COLOR_ATTACHMENT0);
+	if (!atlas->texture || !gl_check_fb_complete(GL_DRAW_FRAMEBUFFER)) {
+		log_error("Failed to create the texture atlas");
+		gl_atlas_destroy(gd, atlas);
+		return NULL;
+	}
+	gl_check_err();
+	return atlas;
+}
+
+void gl_atlas_destroy(struct gl_data *gd, struct gl_atlas *atlas) {
+	// Images can outlive the backend, e.g. the images of mapped windows when the
+	// screen is unredirected. Detach them, so releasing them later doesn't touch
+	// the atlas.
+	list_foreach_safe(struct gl_atlas_entry, e, &atlas->entries, siblings) {
+		e->owner->atlas = NULL;
+		list_remove(&e->siblings);
+		free(e);
+	}
+	if (gd->state.draw_fbo == atlas->fbo) {
+		gl_state_bind_framebuffer(gd, GL_DRAW_FRAMEBUFFER, 0);
+	}
+	glDeleteFramebuffers(1, &atlas->fbo);
+	gl_state_delete_texture(gd, atlas->texture);
+	free(atlas->shelves);
+	free(atlas);
+}
+
+/// Put `entry` on the shelf that wastes the least height, or on a new shelf.
+static bool gl_atlas_place(struct gl_atlas *atlas, struct gl_atlas_entry *entry) {
+	int best = -1;
+	for (int i = 0; i < atlas->nshelves; i++) {
+		auto s = &atlas->shelves[i];
+		if (s->height >= entry->height && s->x + entry->width <= atlas->size &&
+		    (best < 0 || s->height < atlas->shelves[best].height)) {
+			best = i;
+		}
+	}
+	bool room_above = atlas->top + entry->height <= atlas->size;
+	if (best >= 0 && atlas->shelves[best].height > entry->height * 2 && room_above) {
+		// Don't waste most of a tall shelf on a short image
+		best = -1;
+	}
+	if (best < 0) {
+		if (!room_above || entry->width > atlas->size) {
+			return false;
+		}
+		if (atlas->nshelves == atlas->shelves_capacity) {
+			atlas->shelves_capacity = max2(8, atlas->shelves_capacity * 2);
+			atlas->shelves =
+			    crealloc(atlas->shelves, atlas->shelves_capacity);
+		}
+		best = atlas->nshelves++;
+		atlas->shelves[best] = (struct gl_atlas_shelf){
+		    .y = atlas->top,
+		    .height = entry->height,
+		};
+		atlas->top += entry->height;
+	}
+
+	auto s = &atlas->shelves[best];
+	entry->x = s->x;
+	entry->y = s->y;
+	entry->shelf = best;
+	entry->dirty = true;
+	s->x += entry->width;
+	s->nlive++;
+	return true;
+}
+
+static int gl_atlas_entry_cmp(const void *a, const void *b) {
+	auto ea = *(struct gl_atlas_entry *const *)a;
+	auto eb = *(struct gl_atlas_entry *const *)b;
+	return eb->height - ea->height;
+}
+
+/// Pack all entries again, tallest first. Entries that don't fit anymore lose their
+/// place.
+static void gl_atlas_repack(struct gl_atlas *atlas) {
+	int nentries = 0;
+	list_foreach(struct gl_atlas_entry, e, &atlas->entries, siblings) {
+		nentries++;
+	}
+	auto sorted = ccalloc(nentries, struct gl_atlas_entry *);
+	int i = 0;
+	list_foreach(struct gl_atlas_entry, e, &atlas->entries, siblings) {
+		sorted[i++] = e;
+	}
+	qsort(sorted, (size_t)nentries, sizeof(*sorted), gl_atlas_entry_cmp);
+
+	log_debug("Packing %d images into the texture atlas again", nentries);
+	atlas->nshelves = 0;
+	atlas->top = 0;
+	atlas->nfreed = 0;
+	for (i = 0; i < nentries; i++) {
+		if (!gl_atlas_place(atlas, sorted[i])) {
+			sorted[i]->shelf = -1;
+		}
+	}
+	free(sorted);
+}
+
+struct gl_atlas_entry *gl_atlas_alloc(struct gl_atlas *atlas, struct gl_texture *owner) {
+	auto entry = ccalloc(1, struct gl_atlas_entry);
+	entry->owner = owner;
+	entry->width = owner->width;
+	entry->height = owner->height;
+	entry->shelf = -1;
+	list_insert_after(&atlas->entries, &entry->siblings);
+	if (!gl_atlas_place(atlas, entry) && atlas->nfreed > 0) {
+		gl_atlas_repack(atlas);
+	}
+	if (entry->shelf < 0) {
+		list_remove(&entry->siblings);
+		free(entry);
+		return NULL;
+	}
+	return entry;
+}
+
+void gl_atlas_free(struct gl_atlas *atlas, struct gl_atlas_entry *entry) {
+	if (entry->shelf >= 0) {
+		auto s = &atlas->shelves[entry->shelf];
+		s->nlive--;
+		if (s->nlive == 0) {
+			s->x = 0;
+		}
+		// Drop the empty shelves at the top, so their height can be reused for
+		// shelves of a different height
+		while (atlas->nshelves > 0 &&
+		       atlas->shelves[atlas->nshelves - 1].nlive == 0) {
+			atlas->nshelves--;
+			atlas->top = atlas->shelves[atlas->nshelves].y;
+		}
+		atlas->nfreed++;
+	}
+	list_remove(&entry->siblings);
+	free(entry);
+}
+
+bool gl_atlas_update(struct gl_data *gd, struct gl_atlas *atlas,
+                     struct gl_texture *inner) {
+	auto entry = inner->atlas;
+	if (entry->shelf < 0 && !gl_atlas_place(atlas, entry)) {
+		return false;
+	}
+	if (!entry->dirty) {
+		return true;
+	}
+
+	gl_state_bind_framebuffer(gd, GL_READ_FRAMEBUFFER, gd->blit_fbo);
+	glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+	                       inner->texture, 0);
+	bool ret =
+	    glCheckFramebufferStatus(GL_READ_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	if (ret) {
+		// The atlas keeps images with their bottom row first, flip the ones
+		// that are the other way around
+		GLint src_y0 = inner->y_inverted ? entry->height : 0;
+		GLint src_y1 = inner->y_inverted ? 0 : entry->height;
+		gl_state_bind_framebuffer(gd, GL_DRAW_FRAMEBUFFER, atlas->fbo);
+		glBlitFramebuffer(0, src_y0, entry->width, src_y1, entry->x, entry->y,
+		                  entry->x + entry->width, entry->y + entry->height,
+		                  GL_COLOR_BUFFER_BIT, GL_NEAREST);
+		entry->dirty = false;
+	}
+	glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+	                       0, 0);
+	gl_check_err();
+	return ret;
+}
+
+GLuint gl_atlas_texture(const struct gl_atlas *atlas) {
+	return atlas->texture;
+}
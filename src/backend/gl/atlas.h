@@ -0,0 +1,55 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+#pragma once
+
+/// A texture shared by the images of small windows.
+///
+/// Tooltips, menus and notifications are small, but each of them would otherwise need
+/// a texture binding of its own to be composed. Images smaller than a threshold get a
+/// place in the atlas instead, and their content is copied there when they are
+/// damaged, so they are all composed from the same texture.
+///
+/// Places are handed out on shelves: rows of the atlas, each as tall as the first
+/// image placed on it, filled from left to right. A shelf is reused once all of its
+/// images are released. When the atlas runs out of room after images have been
+/// released, all live images are packed again from scratch.
+
+#include <GL/gl.h>
+#include <stdbool.h>
+
+#include "list.h"
+
+struct gl_data;
+struct gl_texture;
+
+struct gl_atlas_entry {
+	struct list_node siblings;
+	/// The image the entry belongs to
+	struct gl_texture *owner;
+	/// Position in the atlas, in GL texture coordinates, with the bottom row of the
+	/// image at `y`. Only valid if `shelf` isn't -1.
+	int x, y;
+	int width, height;
+	/// Index of the shelf the entry is on, -1 if it lost its place when the atlas
+	/// was packed again.
+	int shelf;
+	/// Whether the content in the atlas is out of date
+	bool dirty;
+};
+
+struct gl_atlas;
+
+/// Create an atlas of `size` by `size` pixels. Returns NULL on failure.
+struct gl_atlas *gl_atlas_new(struct gl_data *gd, int size);
+void gl_atlas_destroy(struct gl_data *gd, struct gl_atlas *atlas);
+
+/// Find a place for `owner`. Returns NULL if there is no room.
+struct gl_atlas_entry *gl_atlas_alloc(struct gl_atlas *atlas, struct gl_texture *owner);
+void gl_atlas_free(struct gl_atlas *atlas, struct gl_atlas_entry *entry);
+
+/// Make sure the atlas holds the current content of `inner`, which must have an
+/// entry. Returns false if the entry has no place in the atlas.
+bool gl_atlas_update(struct gl_data *gd, struct gl_atlas *atlas,
+                     struct gl_texture *inner);
+
+GLuint gl_atlas_texture(const struct gl_atlas *atlas);
@@ -2,6 +2,7 @@
 // Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
 #include <GL/gl.h>
 #include <GL/glext.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
@@ -18,7 +19,9 @@
 #include "utils.h"
 
 #include "backend/backend_common.h"
+#include "backend/gl/atlas.h"
 #include "backend/gl/gl_common.h"
+#include "backend/gl/program_cache.h"
 
 GLuint gl_create_shader(GLenum shader_type, const char *shader_str) {
 	log_trace("===\n%s\n===", shader_str);
@@ -72,6 +75,8 @@ GLuint gl_create_program(const GLuint *const shaders, int nshaders) {
 	for (int i = 0; i < nshaders; ++i) {
 		glAttachShader(program, shaders[i]);
 	}
+	// Some drivers only keep what's needed for glGetProgramBinary if asked to
+	glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	glLinkProgram(program);
 
 	// Get program status
@@ -110,7 +115,16 @@ end:
  * @brief Create a program from NULL-terminated arrays of vertex and fragment shader
  * strings.
  */
-GLuint gl_create_program_from_strv(const char **vert_shaders, const char **frag_shaders) {
+GLuint gl_create_program_from_strv(struct gl_data *gd, const char **vert_shaders,
+                                   const char **frag_shaders) {
+	if (gd->program_cache) {
+		GLuint prog =
+		    gl_program_cache_load(gd->program_cache, vert_shaders, frag_shaders);
+		if (prog) {
+			return prog;
+		}
+	}
+
 	int vert_count, frag_count;
 	for (vert_count = 0; vert_shaders && vert_shaders[vert_count]; ++vert_count) {
 	}
@@ -134,6 +148,10 @@ GLuint gl_create_program_from_strv(const char **vert_shaders, const char **frag_
 	}
 
 	prog = gl_create_program(shaders, vert_count + frag_count);
+	if (prog && gd->program_cache) {
+		gl_program_cache_store(gd->program_cache, vert_shaders, frag_shaders,
+		                       prog);
+	}
 
 out:
 	for (int i = 0; i < vert_count + frag_count; ++i) {
@@ -150,20 +168,25 @@ out:
 /**
  * @brief Create a program from vertex and fragment shader strings.
  */
-GLuint gl_create_program_from_str(const char *vert_shader_str, const char *frag_shader_str) {
+GLuint gl_create_program_from_str(struct gl_data *gd, const char *vert_shader_str,
+                                  const char *frag_shader_str) {
 	const char *vert_shaders[2] = {vert_shader_str, NULL};
 	const char *frag_shaders[2] = {frag_shader_str, NULL};
 
-	return gl_create_program_from_strv(vert_shaders, frag_shaders);
+	return gl_create_program_from_strv(gd, vert_shaders, frag_shaders);
 }
 
-void gl_destroy_window_shader(backend_t *backend_data attr_unused, void *shader) {
+void gl_destroy_window_shader(backend_t *backend_data, void *shader) {
 	if (!shader) {
 		return;
 	}
 
+	auto gd = (struct gl_data *)backend_data;
 	auto pprogram = (gl_win_shader_t *)shader;
 	if (pprogram->prog) {
+		if (gd->state.program == pprogram->prog) {
+			gl_state_use_program(gd, 0);
+		}
 		glDeleteProgram(pprogram->prog);
 		pprogram->prog = 0;
 	}
@@ -175,40 +198,37 @@ void gl_destroy_window_shader(backend_t *backend_data attr_unused, void *shader)
 /**
  * Render a region with texture data.
  *
- * @param ptex the texture
+ * @param texture the texture
+ * @param shader the shader, NULL for the default shader
  * @param target the framebuffer to render into
  * @param dst_x,dst_y the top left corner of region where this texture
  *                    should go. In OpenGL coordinate system (important!).
  * @param reg_tgt     the clip region, in Xorg coordinate system
  * @param reg_visible ignored
  */
-static void _gl_compose(backend_t *base, struct backend_image *img, GLuint target,
-                        GLint *coord, GLuint *indices, int nrects) {
+static void _gl_compose(backend_t *base, GLuint texture, gl_win_shader_t *shader,
+                        GLuint target, GLint *coord, GLuint *indices, int nrects) {
 	// FIXME(yshui) breaks when `mask` and `img` doesn't have the same y_inverted
 	//              value. but we don't ever hit this problem because all of our
 	//              images and masks are y_inverted.
 	auto gd = (struct gl_data *)base;
-	auto inner = (struct gl_texture *)img->inner;
 
-	auto win_shader = inner->shader;
+	auto win_shader = shader;
 	if (!win_shader) {
 		win_shader = gd->default_shader;
 	}
 
 	// assert(win_shader);
 	// assert(win_shader->prog);
-	glUseProgram(win_shader->prog);
+	gl_state_use_program(gd, win_shader->prog);
+	glUniform1f(win_shader->uniform_depth, gd->depth);
 
 	// log_trace("Draw: %d, %d, %d, %d -> %d, %d (%d, %d) z %d\n",
 	//          x, y, width, height, dx, dy, ptex->width, ptex->height, z);
 
 	// Bind texture
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, inner->texture);
-
-	GLuint vao;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
+	gl_state_bind_texture(gd, 0, texture);
+	gl_state_bind_vertex_array(gd, gd->vao);
 
 	GLuint bo[2];
 	glGenBuffers(2, bo);
@@ -223,30 +243,15 @@ static void _gl_compose(backend_t *base, struct backend_image *img, GLuint targe
 	glVertexAttribPointer(vert_coord_loc, 2, GL_INT, GL_FALSE, sizeof(GLint) * 4, NULL);
 	glVertexAttribPointer(vert_in_texcoord_loc, 2, GL_INT, GL_FALSE,
 	                      sizeof(GLint) * 4, (void *)(sizeof(GLint) * 2));
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target);
+	gl_state_bind_framebuffer(gd, GL_DRAW_FRAMEBUFFER, target);
 	glDrawElements(GL_TRIANGLES, nrects * 6, GL_UNSIGNED_INT, NULL);
 
+	// The program, texture and framebuffer are left bound, the next draw likely
+	// uses the same ones. Deleting the buffers unbinds them.
 	glDisableVertexAttribArray(vert_coord_loc);
 	glDisableVertexAttribArray(vert_in_texcoord_loc);
-	glBindVertexArray(0);
-	glDeleteVertexArrays(1, &vao);
-
-	// Cleanup
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-	glDrawBuffer(GL_BACK);
-
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 	glDeleteBuffers(2, bo);
 
-	glUseProgram(0);
-
 	gl_check_err();
 
 	return;
@@ -315,6 +320,102 @@ void x_rect_to_coords(int nrects, const rect_t *rects, coord_t image_dst,
 	}
 }
 
+/// Copy the clipped rectangles of an opaque image into the back buffer with
+/// glBlitFramebuffer, skipping the fragment shader. Only possible when the default
+/// shader is used, since it just fetches texels, and when the texture maps onto the
+/// back buffer without flipping or tiling. Returns false if the image has to go
+/// through the shader instead.
+static bool gl_blit_opaque(struct gl_data *gd, struct gl_texture *inner,
+                           coord_t image_dst, const region_t *reg_tgt) {
+	// Blitting also ignores the depth test
+	if (inner->has_alpha || inner->y_inverted ||
+	    (inner->shader && inner->shader != gd->default_shader) ||
+	    gd->depth_mode != DEPTH_MODE_NONE) {
+		return false;
+	}
+	auto extents = pixman_region32_extents((region_t *)reg_tgt);
+	if (extents->x1 < image_dst.x || extents->y1 < image_dst.y ||
+	    extents->x2 > image_dst.x + inner->width ||
+	    extents->y2 > image_dst.y + inner->height) {
+		// The shader repeats the texture, e.g. for tiled wallpapers
+		return false;
+	}
+
+	gl_state_bind_framebuffer(gd, GL_READ_FRAMEBUFFER, gd->blit_fbo);
+	glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+	                       inner->texture, 0);
+	bool ret =
+	    glCheckFramebufferStatus(GL_READ_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	if (ret) {
+		int nrects;
+		const rect_t *rects =
+		    pixman_region32_rectangles((region_t *)reg_tgt, &nrects);
+		gl_state_bind_framebuffer(gd, GL_DRAW_FRAMEBUFFER, gd->back_fbo);
+		for (int i = 0; i < nrects; i++) {
+			// Both the texture and the back buffer have their origin at the
+			// bottom left
+			auto r = rects[i];
+			GLint src_x = r.x1 - image_dst.x,
+			      src_y = inner->height - (r.y2 - image_dst.y);
+			GLint width = r.x2 - r.x1, height = r.y2 - r.y1;
+			glBlitFramebuffer(src_x, src_y, src_x + width, src_y + height,
+			                  r.x1, gd->height - r.y2, r.x2,
+			                  gd->height - r.y1, GL_COLOR_BUFFER_BIT,
+			                  GL_NEAREST);
+		}
+	}
+	// Don't keep the texture attached, it might be released
+	glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+	                       0, 0);
+	gl_check_err();
+	return ret;
+}
+
+/// Compose an image from its place in the texture atlas. Images composed this way
+/// all use the same texture, so the texture binding doesn't change between them.
+/// Returns false if the image isn't eligible, or has no place in the atlas.
+static bool gl_compose_from_atlas(struct gl_data *gd, struct gl_texture *inner,
+                                  coord_t image_dst, const region_t *reg_tgt) {
+	if (!gd->atlas || (inner->shader && inner->shader != gd->default_shader) ||
+	    inner->width > gd->atlas_max_size || inner->height > gd->atlas_max_size) {
+		return false;
+	}
+	auto extents = pixman_region32_extents((region_t *)reg_tgt);
+	if (extents->x1 < image_dst.x || extents->y1 < image_dst.y ||
+	    extents->x2 > image_dst.x + inner->width ||
+	    extents->y2 > image_dst.y + inner->height) {
+		// Texels outside of the image belong to other images in the atlas
+		return false;
+	}
+	if (!inner->atlas) {
+		inner->atlas = gl_atlas_alloc(gd->atlas, inner);
+		if (!inner->atlas) {
+			return false;
+		}
+	}
+	if (!gl_atlas_update(gd, gd->atlas, inner)) {
+		return false;
+	}
+
+	int nrects;
+	const rect_t *rects = pixman_region32_rectangles((region_t *)reg_tgt, &nrects);
+	auto coord = ccalloc(nrects * 16, GLint);
+	auto indices = ccalloc(nrects * 6, GLuint);
+	// The atlas stores images the right way up
+	x_rect_to_coords(nrects, rects, image_dst, inner->height, inner->height,
+	                 gd->height, false, coord, indices);
+	for (int i = 0; i < nrects * 4; i++) {
+		coord[i * 4 + 2] += inner->atlas->x;
+		coord[i * 4 + 3] += inner->atlas->y;
+	}
+	_gl_compose(&gd->base, gl_atlas_texture(gd->atlas), NULL, gd->back_fbo, coord,
+	            indices, nrects);
+
+	free(indices);
+	free(coord);
+	return true;
+}
+
 // TODO(yshui) make use of reg_visible
 void gl_compose(backend_t *base, void *image_data, coord_t image_dst,
                 const region_t *reg_tgt, const region_t *reg_visible attr_unused) {
@@ -331,6 +432,11 @@ void gl_compose(backend_t *base, void *image_data, coord_t image_dst,
 		return;
 	}
 
+	if (gl_blit_opaque(gd, inner, image_dst, reg_tgt) ||
+	    gl_compose_from_atlas(gd, inner, image_dst, reg_tgt)) {
+		return;
+	}
+
 	// Until we start to use glClipControl, reg_tgt, dst_x and dst_y and
 	// in a different coordinate system than the one OpenGL uses.
 	// OpenGL window coordinate (or NDC) has the origin at the lower left of the
@@ -342,7 +448,8 @@ void gl_compose(backend_t *base, void *image_data, coord_t image_dst,
 	auto indices = ccalloc(nrects * 6, GLuint);
 	x_rect_to_coords(nrects, rects, image_dst, inner->height, inner->height,
 	                 gd->height, inner->y_inverted, coord, indices);
-	_gl_compose(base, img, gd->back_fbo, coord, indices, nrects);
+	_gl_compose(base, inner->texture, inner->shader, gd->back_fbo, coord, indices,
+	            nrects);
 
 	free(indices);
 	free(coord);
@@ -351,10 +458,10 @@ void gl_compose(backend_t *base, void *image_data, coord_t image_dst,
 /**
  * Load a GLSL main program from shader strings.
  */
-static bool gl_win_shader_from_stringv(const char **vshader_strv,
+static bool gl_win_shader_from_stringv(struct gl_data *gd, const char **vshader_strv,
                                        const char **fshader_strv, gl_win_shader_t *ret) {
 	// Build program
-	ret->prog = gl_create_program_from_strv(vshader_strv, fshader_strv);
+	ret->prog = gl_create_program_from_strv(gd, vshader_strv, fshader_strv);
 	if (!ret->prog) {
 		log_error("Failed to create GLSL program.");
 		gl_check_err();
@@ -363,6 +470,7 @@ static bool gl_win_shader_from_stringv(const char **vshader_strv,
 
 	// Get uniform addresses
 	bind_uniform(ret, tex);
+	bind_uniform(ret, depth);
 
 	gl_check_err();
 
@@ -382,13 +490,31 @@ void gl_resize(struct gl_data *gd, int width, int height) {
 	assert(viewport_dimensions[0] >= gd->width);
 	assert(viewport_dimensions[1] >= gd->height);
 
-	glBindTexture(GL_TEXTURE_2D, gd->back_texture);
+	gl_state_bind_texture(gd, 0, gd->back_texture);
 	glTexImage2D(GL_TEXTURE_2D, 0, gd->back_format, width, height, 0, GL_BGR,
 	             GL_UNSIGNED_BYTE, NULL);
+	if (gd->back_depth) {
+		glBindRenderbuffer(GL_RENDERBUFFER, gd->back_depth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width,
+		                      height);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	}
 
 	gl_check_err();
 }
 
+/// Adapt to a new root size without creating the backend again, so the window images
+/// stay bound. The projection matrices map the maximum viewport, not the root, so
+/// only the buffers sized after the root have to change. Their content is undefined
+/// afterwards, the caller has to repaint everything.
+void *gl_root_change(backend_t *base, session_t *ps) {
+	auto gd = (struct gl_data *)base;
+	log_debug("Resizing the back buffer from %dx%d to %dx%d", gd->width, gd->height,
+	          ps->root_width, ps->root_height);
+	gl_resize(gd, ps->root_width, ps->root_height);
+	return base;
+}
+
 /// Fill a given region in bound framebuffer.
 /// @param[in] y_inverted whether the y coordinates in `clip` should be inverted
 static void _gl_fill(backend_t *base, struct color c, const region_t *clip, GLuint target,
@@ -398,15 +524,14 @@ static void _gl_fill(backend_t *base, struct color c, const region_t *clip, GLui
 	const rect_t *rect = pixman_region32_rectangles((region_t *)clip, &nrects);
 	auto gd = (struct gl_data *)base;
 
-	GLuint vao;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
+	gl_state_bind_vertex_array(gd, gd->vao);
 
 	GLuint bo[2];
 	glGenBuffers(2, bo);
-	glUseProgram(gd->fill_shader.prog);
+	gl_state_use_program(gd, gd->fill_shader.prog);
 	glUniform4f(gd->fill_shader.color_loc, (GLfloat)c.red, (GLfloat)c.green,
 	            (GLfloat)c.blue, (GLfloat)c.alpha);
+	glUniform1f(gd->fill_shader.depth_loc, gd->depth);
 	glEnableVertexAttribArray(fill_vert_in_coord_loc);
 	glBindBuffer(GL_ARRAY_BUFFER, bo[0]);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bo[1]);
@@ -436,16 +561,10 @@ static void _gl_fill(backend_t *base, struct color c, const region_t *clip, GLui
 
 	glVertexAttribPointer(fill_vert_in_coord_loc, 2, GL_INT, GL_FALSE,
 	                      sizeof(*coord) * 2, (void *)0);
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target);
+	gl_state_bind_framebuffer(gd, GL_DRAW_FRAMEBUFFER, target);
 	glDrawElements(GL_TRIANGLES, nrects * 6, GL_UNSIGNED_INT, NULL);
 
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 	glDisableVertexAttribArray(fill_vert_in_coord_loc);
-	glBindVertexArray(0);
-	glDeleteVertexArrays(1, &vao);
-
 	glDeleteBuffers(2, bo);
 	free(indices);
 	free(coord);
@@ -458,6 +577,66 @@ void gl_fill(backend_t *base, struct color c, const region_t *clip) {
 	return _gl_fill(base, c, clip, gd->back_fbo, gd->height, true);
 }
 
+bool gl_begin_depth(backend_t *base, int nlayers) {
+	auto gd = (struct gl_data *)base;
+	gl_state_bind_framebuffer(gd, GL_DRAW_FRAMEBUFFER, gd->back_fbo);
+	if (!gd->back_depth) {
+		glGenRenderbuffers(1, &gd->back_depth);
+		glBindRenderbuffer(GL_RENDERBUFFER, gd->back_depth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, gd->width,
+		                      gd->height);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+		glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+		                          GL_RENDERBUFFER, gd->back_depth);
+		if (!gl_check_fb_complete(GL_DRAW_FRAMEBUFFER)) {
+			log_error("Failed to attach a depth buffer to the back buffer");
+			glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER,
+			                          GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, 0);
+			glDeleteRenderbuffers(1, &gd->back_depth);
+			gd->back_depth = 0;
+			return false;
+		}
+	}
+
+	// Everything drawn is clipped to the damage, so the depth outside of it doesn't
+	// matter, and clearing the whole buffer lets the driver use a fast clear.
+	gd->depth_layers = nlayers;
+	glDepthMask(GL_TRUE);
+	glClearDepth(1.0);
+	glClear(GL_DEPTH_BUFFER_BIT);
+	glDepthMask(GL_FALSE);
+	gl_check_err();
+	return true;
+}
+
+void gl_set_depth(backend_t *base, enum depth_mode mode, int layer) {
+	auto gd = (struct gl_data *)base;
+	gd->depth_mode = mode;
+	switch (mode) {
+	case DEPTH_MODE_NONE:
+		glDisable(GL_DEPTH_TEST);
+		glDepthMask(GL_FALSE);
+		gl_state_set_blend(gd, true);
+		gd->depth = 0;
+		return;
+	case DEPTH_MODE_OPAQUE:
+		// Opaque content replaces what's behind it, skip the blending
+		glEnable(GL_DEPTH_TEST);
+		glDepthMask(GL_TRUE);
+		gl_state_set_blend(gd, false);
+		break;
+	case DEPTH_MODE_TRANSLUCENT:
+		glEnable(GL_DEPTH_TEST);
+		glDepthMask(GL_FALSE);
+		gl_state_set_blend(gd, true);
+		break;
+	}
+	// Spread the layers over (-1, 1) in clip space, front most layer nearest. Layers
+	// stay clear of 1, which is what the depth buffer is cleared to, so even the
+	// bottom layer passes GL_LESS.
+	gd->depth = 1.0F - 2.0F * (GLfloat)(layer + 1) / (GLfloat)(gd->depth_layers + 2);
+}
+
 static void gl_release_image_inner(backend_t *base, struct gl_texture *inner) {
 	auto gd = (struct gl_data *)base;
 	if (inner->user_data) {
@@ -465,7 +644,10 @@ static void gl_release_image_inner(backend_t *base, struct gl_texture *inner) {
 	}
 	assert(inner->user_data == NULL);
 
-	glDeleteTextures(1, &inner->texture);
+	if (inner->atlas) {
+		gl_atlas_free(gd->atlas, inner->atlas);
+	}
+	gl_state_delete_texture(gd, inner->texture);
 	glDeleteTextures(2, inner->auxiliary_texture);
 	free(inner);
 	gl_check_err();
@@ -482,13 +664,22 @@ void gl_release_image(backend_t *base, void *image_data) {
 	free(wd);
 }
 
-void *gl_create_window_shader(backend_t *backend_data attr_unused, const char *source) {
+void gl_image_damaged(backend_t *base attr_unused, void *image_data) {
+	struct backend_image *wd = image_data;
+	auto inner = (struct gl_texture *)wd->inner;
+	if (inner->atlas) {
+		inner->atlas->dirty = true;
+	}
+}
+
+void *gl_create_window_shader(backend_t *backend_data, const char *source) {
+	auto gd = (struct gl_data *)backend_data;
 	auto win_shader = (gl_win_shader_t *)ccalloc(1, gl_win_shader_t);
 
 	const char *vert_shaders[2] = {vertex_shader, NULL};
 	const char *frag_shaders[4] = {win_shader_glsl, source, NULL};
 
-	if (!gl_win_shader_from_stringv(vert_shaders, frag_shaders, win_shader)) {
+	if (!gl_win_shader_from_stringv(gd, vert_shaders, frag_shaders, win_shader)) {
 		free(win_shader);
 		return NULL;
 	}
@@ -505,9 +696,8 @@ void *gl_create_window_shader(backend_t *backend_data attr_unused, const char *s
 	                                   {-1, -1, 0, 1}};
 
 	int pml = glGetUniformLocationChecked(win_shader->prog, "projection");
-	glUseProgram(win_shader->prog);
+	gl_state_use_program(gd, win_shader->prog);
 	glUniformMatrix4fv(pml, 1, false, projection_matrix[0]);
-	glUseProgram(0);
 
 	return win_shader;
 }
@@ -521,12 +711,137 @@ uint64_t gl_get_shader_attributes(backend_t *backend_data attr_unused, void *sha
 	return ret;
 }
 
+#define GL_DEBUG_QUEUE_SIZE 32
+
+/// Messages from the KHR_debug callback. Without GL_DEBUG_OUTPUT_SYNCHRONOUS the
+/// callback can be called from a driver thread, which has no logger of its own, so
+/// messages are kept here until the next `gl_debug_flush`.
+struct gl_debug_queue {
+	pthread_mutex_t lock;
+	struct {
+		enum log_level level;
+		char text[256];
+	} messages[GL_DEBUG_QUEUE_SIZE];
+	int nmessages;
+	/// Number of messages that didn't fit in the queue
+	unsigned ndropped;
+};
+
+static enum log_level gl_debug_log_level(GLenum type, GLenum severity) {
+	if (type == GL_DEBUG_TYPE_ERROR) {
+		return LOG_LEVEL_ERROR;
+	}
+	if (severity == GL_DEBUG_SEVERITY_HIGH || severity == GL_DEBUG_SEVERITY_MEDIUM) {
+		return LOG_LEVEL_WARN;
+	}
+	return LOG_LEVEL_DEBUG;
+}
+
+static void APIENTRY gl_debug_callback(GLenum source attr_unused, GLenum type,
+                                       GLuint id attr_unused, GLenum severity,
+                                       GLsizei length, const GLchar *message,
+                                       const void *user_param) {
+	auto level = gl_debug_log_level(type, severity);
+	struct gl_debug_queue *queue = (void *)user_param;
+	if (!queue) {
+		// Synchronous, we are on the thread that made the call
+		if (level >= log_get_level_tls()) {
+			log_printf(tls_logger, level, __func__, "%.*s", length, message);
+		}
+		return;
+	}
+
+	pthread_mutex_lock(&queue->lock);
+	if (queue->nmessages < GL_DEBUG_QUEUE_SIZE) {
+		auto m = &queue->messages[queue->nmessages++];
+		m->level = level;
+		snprintf(m->text, sizeof(m->text), "%.*s", length, message);
+	} else {
+		queue->ndropped++;
+	}
+	pthread_mutex_unlock(&queue->lock);
+}
+
+/// Log the messages queued by the KHR_debug callback.
+static void gl_debug_flush(struct gl_data *gd) {
+	auto queue = gd->debug_queue;
+	if (!queue) {
+		return;
+	}
+	pthread_mutex_lock(&queue->lock);
+	for (int i = 0; i < queue->nmessages; i++) {
+		auto m = &queue->messages[i];
+		if (m->level >= log_get_level_tls()) {
+			log_printf(tls_logger, m->level, "gl_debug_callback", "%s", m->text);
+		}
+	}
+	if (queue->ndropped) {
+		log_warn("%u GL debug messages were dropped", queue->ndropped);
+	}
+	queue->nmessages = 0;
+	queue->ndropped = 0;
+	pthread_mutex_unlock(&queue->lock);
+}
+
+/// Have the driver report errors and warnings through a KHR_debug callback, so
+/// they don't have to be polled with glGetError. The callback is synchronous in
+/// debug builds, so the messages come out next to the call that caused them, and
+/// asynchronous otherwise, which doesn't hold up the driver.
+static void gl_debug_init(struct gl_data *gd) {
+	GLint flags = 0;
+	glGetIntegerv(GL_CONTEXT_FLAGS, &flags);
+	if (flags & GL_CONTEXT_FLAG_NO_ERROR_BIT_KHR) {
+		log_info("Using a no error GL context, GL errors won't be reported");
+		return;
+	}
+	if (!gl_has_extension("GL_KHR_debug")) {
+		log_info("GL_KHR_debug is not supported, GL errors are only reported in "
+		         "debug builds");
+		return;
+	}
+
+#ifdef NDEBUG
+	gd->debug_queue = ccalloc(1, struct gl_debug_queue);
+	pthread_mutex_init(&gd->debug_queue->lock, NULL);
+	glDisable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+#else
+	glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+#endif
+	glDebugMessageCallback(gl_debug_callback, gd->debug_queue);
+	// Notifications are informational chatter, like where buffers are placed
+	glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION,
+	                      0, NULL, GL_FALSE);
+	glEnable(GL_DEBUG_OUTPUT);
+	gd->has_debug_output = true;
+}
+
+static void gl_debug_deinit(struct gl_data *gd) {
+	if (!gd->has_debug_output) {
+		return;
+	}
+	glDisable(GL_DEBUG_OUTPUT);
+	glDebugMessageCallback(NULL, NULL);
+	if (gd->debug_queue) {
+		gl_debug_flush(gd);
+		pthread_mutex_destroy(&gd->debug_queue->lock);
+		free(gd->debug_queue);
+		gd->debug_queue = NULL;
+	}
+	gd->has_debug_output = false;
+}
+
 bool gl_init(struct gl_data *gd, session_t *ps) {
+	// The state of a new context
+	gd->state = (struct gl_state){.draw_buffer = GL_BACK};
+	gl_debug_init(gd);
+	gd->program_cache = gl_program_cache_new();
+
 	// Initialize GLX data structure
 	glDisable(GL_DEPTH_TEST);
 	glDepthMask(GL_FALSE);
+	glDepthFunc(GL_LESS);
 
-	glEnable(GL_BLEND);
+	gl_state_set_blend(gd, true);
 	// X pixmap is in premultiplied alpha, so we might just as well use it too.
 	// Thanks to derhass for help.
 	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
@@ -549,21 +864,22 @@ bool gl_init(struct gl_data *gd, session_t *ps) {
 	glClear(GL_COLOR_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
 	glGenFramebuffers(1, &gd->back_fbo);
+	glGenFramebuffers(1, &gd->blit_fbo);
 	glGenTextures(1, &gd->back_texture);
-	if (!gd->back_fbo || !gd->back_texture) {
+	glGenVertexArrays(1, &gd->vao);
+	if (!gd->back_fbo || !gd->blit_fbo || !gd->back_texture || !gd->vao) {
 		log_error("Failed to generate a framebuffer object");
 		return false;
 	}
 
-	glBindTexture(GL_TEXTURE_2D, gd->back_texture);
+	gl_state_bind_texture(gd, 0, gd->back_texture);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glBindTexture(GL_TEXTURE_2D, 0);
 
 	// Initialize shaders
-	gd->default_shader = gl_create_window_shader(NULL, NULL);
+	gd->default_shader = gl_create_window_shader(&gd->base, NULL);
 	if (!gd->default_shader) {
 		log_error("Failed to create window shaders");
 		return false;
@@ -577,29 +893,28 @@ bool gl_init(struct gl_data *gd, session_t *ps) {
 	                                   {0, 0, 0, 0},
 	                                   {-1, -1, 0, 1}};
 
-	gd->fill_shader.prog = gl_create_program_from_str(fill_vert, fill_frag);
+	gd->fill_shader.prog = gl_create_program_from_str(gd, fill_vert, fill_frag);
 	gd->fill_shader.color_loc = glGetUniformLocation(gd->fill_shader.prog, "color");
+	gd->fill_shader.depth_loc = glGetUniformLocation(gd->fill_shader.prog, "depth");
 	int pml = glGetUniformLocationChecked(gd->fill_shader.prog, "projection");
-	glUseProgram(gd->fill_shader.prog);
+	gl_state_use_program(gd, gd->fill_shader.prog);
 	glUniformMatrix4fv(pml, 1, false, projection_matrix[0]);
-	glUseProgram(0);
 
 	gd->present_prog =
-	    gl_create_program_from_strv((const char *[]){present_vertex_shader, NULL},
+	    gl_create_program_from_strv(gd, (const char *[]){present_vertex_shader, NULL},
 	                                (const char *[]){dummy_frag, NULL});
 	if (!gd->present_prog) {
 		log_error("Failed to create the present shader");
 		return false;
 	}
 	pml = glGetUniformLocationChecked(gd->present_prog, "projection");
-	glUseProgram(gd->present_prog);
+	gl_state_use_program(gd, gd->present_prog);
 	glUniform1i(glGetUniformLocationChecked(gd->present_prog, "tex"), 0);
 	glUniformMatrix4fv(pml, 1, false, projection_matrix[0]);
-	glUseProgram(0);
 
 	// Set up the size and format of the back texture
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, gd->back_fbo);
-	glDrawBuffer(GL_COLOR_ATTACHMENT0);
+	gl_state_bind_framebuffer(gd, GL_DRAW_FRAMEBUFFER, gd->back_fbo);
+	gl_state_draw_buffer(gd, GL_COLOR_ATTACHMENT0);
 	const GLint *format = (const GLint[]){GL_RGB8, GL_RGBA8};
 	for (int i = 0; i < 2; i++) {
 		gd->back_format = format[i];
@@ -615,7 +930,6 @@ bool gl_init(struct gl_data *gd, session_t *ps) {
 	if (!gl_check_fb_complete(GL_DRAW_FRAMEBUFFER)) {
 		return false;
 	}
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
 
 	gd->logger = gl_string_marker_logger_new();
 	if (gd->logger) {
@@ -631,12 +945,24 @@ bool gl_init(struct gl_data *gd, session_t *ps) {
 		gd->is_nvidia = false;
 	}
 	gd->has_robustness = gl_has_extension("GL_ARB_robustness");
+
+	if (ps->o.atlas_max_size > 0) {
+		GLint max_texture_size;
+		glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+		gd->atlas = gl_atlas_new(gd, min2(2048, max_texture_size));
+		if (!gd->atlas) {
+			log_warn("Composing small windows from their own textures");
+		}
+		gd->atlas_max_size = ps->o.atlas_max_size;
+	}
 	gl_check_err();
 
 	return true;
 }
 
 void gl_deinit(struct gl_data *gd) {
+	gl_debug_deinit(gd);
+
 	if (gd->logger) {
 		log_remove_target_tls(gd->logger);
 		gd->logger = NULL;
@@ -647,10 +973,36 @@ void gl_deinit(struct gl_data *gd) {
 		gd->default_shader = NULL;
 	}
 
+	if (gd->program_cache) {
+		gl_program_cache_destroy(gd->program_cache);
+		gd->program_cache = NULL;
+	}
+
+	if (gd->back_depth) {
+		glDeleteRenderbuffers(1, &gd->back_depth);
+		gd->back_depth = 0;
+	}
+
+	if (gd->atlas) {
+		gl_atlas_destroy(gd, gd->atlas);
+		gd->atlas = NULL;
+	}
+
+	if (gd->blit_fbo) {
+		glDeleteFramebuffers(1, &gd->blit_fbo);
+		gd->blit_fbo = 0;
+	}
+
+	if (gd->vao) {
+		glDeleteVertexArrays(1, &gd->vao);
+		gd->vao = 0;
+	}
+
 	gl_check_err();
 }
 
-GLuint gl_new_texture(GLenum target) {
+/// Create a GL_TEXTURE_2D, and leave it bound to texture unit 0.
+GLuint gl_new_texture(struct gl_data *gd) {
 	GLuint texture;
 	glGenTextures(1, &texture);
 	if (!texture) {
@@ -658,12 +1010,11 @@ GLuint gl_new_texture(GLenum target) {
 		return 0;
 	}
 
-	glBindTexture(target, texture);
-	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glBindTexture(target, 0);
+	gl_state_bind_texture(gd, 0, texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 
 	return texture;
 }
@@ -691,12 +1042,11 @@ void gl_present(backend_t *base, const region_t *region) {
 		       sizeof(GLuint) * 6);
 	}
 
-	glUseProgram(gd->present_prog);
-	glBindTexture(GL_TEXTURE_2D, gd->back_texture);
-
-	GLuint vao;
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
+	gl_state_use_program(gd, gd->present_prog);
+	gl_state_bind_texture(gd, 0, gd->back_texture);
+	gl_state_bind_vertex_array(gd, gd->vao);
+	gl_state_bind_framebuffer(gd, GL_DRAW_FRAMEBUFFER, 0);
+	gl_state_draw_buffer(gd, GL_BACK);
 
 	GLuint bo[2];
 	glGenBuffers(2, bo);
@@ -710,14 +1060,20 @@ void gl_present(backend_t *base, const region_t *region) {
 	glVertexAttribPointer(vert_coord_loc, 2, GL_INT, GL_FALSE, sizeof(GLint) * 2, NULL);
 	glDrawElements(GL_TRIANGLES, nrects * 6, GL_UNSIGNED_INT, NULL);
 
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
+	glDisableVertexAttribArray(vert_coord_loc);
 	glDeleteBuffers(2, bo);
-	glDeleteVertexArrays(1, &vao);
 
 	free(coord);
 	free(indices);
+	gl_debug_flush(gd);
+}
+
+void gl_take_frame_stats(backend_t *base, struct frame_stats *stats) {
+	auto gd = (struct gl_data *)base;
+	stats->state_calls_issued += gd->state.issued;
+	stats->state_calls_elided += gd->state.elided;
+	gd->state.issued = 0;
+	gd->state.elided = 0;
 }
 
 bool gl_set_image_property(backend_t *base attr_unused, enum image_properties op,
@@ -3,6 +3,7 @@
 #pragma once
 #include <GL/gl.h>
 #include <GL/glext.h>
+#include <assert.h>
 #include <stdbool.h>
 #include <string.h>
 #include <uthash.h>
@@ -10,6 +11,7 @@
 #include "backend/backend.h"
 #include "log.h"
 #include "region.h"
+#include "statistics.h"
 
 #define CASESTRRET(s)                                                                    \
 	case s: return #s
@@ -33,13 +35,38 @@ typedef struct {
 	uint32_t id;
 	GLuint prog;
 	GLint uniform_tex;
+	GLint uniform_depth;
 } gl_win_shader_t;
 
 typedef struct {
 	GLuint prog;
 	GLint color_loc;
+	GLint depth_loc;
 } gl_fill_shader_t;
 
+/// Number of texture units tracked by `struct gl_state`
+#define GL_STATE_TEXTURE_UNITS 4
+
+/// The GL state that changes between draws. Changes go through the gl_state_*
+/// functions, which skip the calls that wouldn't change anything, so draws leave their
+/// state bound instead of resetting it.
+struct gl_state {
+	GLuint program;
+	/// The active texture unit, as an offset from GL_TEXTURE0
+	GLuint active_texture;
+	/// The GL_TEXTURE_2D bound to each texture unit
+	GLuint textures[GL_STATE_TEXTURE_UNITS];
+	GLuint draw_fbo, read_fbo;
+	/// The draw buffer of the default framebuffer
+	GLenum draw_buffer;
+	GLuint vao;
+	bool blend;
+
+	/// Number of calls made to the driver, and skipped, since the last
+	/// `gl_take_frame_stats`
+	uint64_t issued, elided;
+};
+
 /// @brief Wrapper of a binded GLX texture.
 struct gl_texture {
 	int refcount;
@@ -52,6 +79,8 @@ struct gl_texture {
 	GLuint auxiliary_texture[2];
 	gl_win_shader_t *shader;
 	void *user_data;
+	/// Place of the image in the texture atlas, NULL if it isn't composed from there
+	struct gl_atlas_entry *atlas;
 };
 
 struct gl_data {
@@ -60,6 +89,11 @@ struct gl_data {
 	bool is_nvidia;
 	// If ARB_robustness extension is present
 	bool has_robustness;
+	// If the KHR_debug callback is installed
+	bool has_debug_output;
+	// Messages from the KHR_debug callback waiting to be logged, NULL if the
+	// callback isn't installed or logs messages as they come.
+	struct gl_debug_queue *debug_queue;
 	// Height and width of the root window
 	int height, width;
 	// Hash-table of window shaders
@@ -67,7 +101,27 @@ struct gl_data {
 	gl_fill_shader_t fill_shader;
 	GLuint back_texture, back_fbo;
 	GLint back_format;
+	/// Depth buffer of back_fbo, only allocated once the depth compose strategy is
+	/// used.
+	GLuint back_depth;
+	/// Framebuffer to read window textures from when blitting them.
+	GLuint blit_fbo;
+	/// How compose and fill currently use the depth buffer.
+	enum depth_mode depth_mode;
+	/// Number of layers of the current frame, and the depth in clip space the
+	/// following draws are at. See `gl_set_depth`.
+	int depth_layers;
+	GLfloat depth;
 	GLuint present_prog;
+	/// Vertex array object used by all draws
+	GLuint vao;
+	struct gl_state state;
+	/// Cache of linked programs, NULL if unavailable
+	struct gl_program_cache *program_cache;
+	/// Texture atlas for small images, NULL if disabled
+	struct gl_atlas *atlas;
+	/// Images up to this size in both dimensions are composed from the atlas
+	int atlas_max_size;
 
 	/// Release the user data attached to a gl_texture
 	void (*release_user_data)(backend_t *base, struct gl_texture *);
@@ -86,8 +140,12 @@ void x_rect_to_coords(int nrects, const rect_t *rects, coord_t image_dst,
 
 GLuint gl_create_shader(GLenum shader_type, const char *shader_str);
 GLuint gl_create_program(const GLuint *const shaders, int nshaders);
-GLuint gl_create_program_from_str(const char *vert_shader_str, const char *frag_shader_str);
-GLuint gl_create_program_from_strv(const char **vert_shaders, const char **frag_shaders);
+GLuint gl_create_program_from_str(struct gl_data *gd, const char *vert_shader_str,
+                                  const char *frag_shader_str);
+/// Create a program from shader sources, or from the program binary cache if it
+/// has the program.
+GLuint gl_create_program_from_strv(struct gl_data *gd, const char **vert_shaders,
+                                   const char **frag_shaders);
 void *gl_create_window_shader(backend_t *backend_data, const char *source);
 void gl_destroy_window_shader(backend_t *backend_data, void *shader);
 uint64_t gl_get_shader_attributes(backend_t *backend_data, void *shader);
@@ -101,19 +159,133 @@ void gl_compose(backend_t *, void *image_data, coord_t image_dst, const region_t
                 const region_t *reg_visible);
 
 void gl_resize(struct gl_data *, int width, int height);
+void *gl_root_change(backend_t *base, session_t *ps);
 
 bool gl_init(struct gl_data *gd, session_t *);
 void gl_deinit(struct gl_data *gd);
 
-GLuint gl_new_texture(GLenum target);
+GLuint gl_new_texture(struct gl_data *gd);
 
 void gl_release_image(backend_t *base, void *image_data);
+void gl_image_damaged(backend_t *base, void *image_data);
 
 void gl_fill(backend_t *base, struct color, const region_t *clip);
 
+bool gl_begin_depth(backend_t *base, int nlayers);
+void gl_set_depth(backend_t *base, enum depth_mode mode, int layer);
+
 void gl_present(backend_t *base, const region_t *);
+void gl_take_frame_stats(backend_t *base, struct frame_stats *stats);
 enum device_status gl_device_status(backend_t *base);
 
+static inline void gl_state_use_program(struct gl_data *gd, GLuint program) {
+	if (gd->state.program == program) {
+		gd->state.elided++;
+		return;
+	}
+	glUseProgram(program);
+	gd->state.program = program;
+	gd->state.issued++;
+}
+
+/// Make `unit` the active texture unit, for the calls that act on the texture bound
+/// to it.
+static inline void gl_state_active_texture(struct gl_data *gd, GLuint unit) {
+	assert(unit < GL_STATE_TEXTURE_UNITS);
+	if (gd->state.active_texture == unit) {
+		gd->state.elided++;
+		return;
+	}
+	glActiveTexture(GL_TEXTURE0 + unit);
+	gd->state.active_texture = unit;
+	gd->state.issued++;
+}
+
+/// Bind `texture` to GL_TEXTURE_2D of texture unit `unit`, and make that unit active.
+static inline void
+gl_state_bind_texture(struct gl_data *gd, GLuint unit, GLuint texture) {
+	gl_state_active_texture(gd, unit);
+	if (gd->state.textures[unit] == texture) {
+		gd->state.elided++;
+		return;
+	}
+	glBindTexture(GL_TEXTURE_2D, texture);
+	gd->state.textures[unit] = texture;
+	gd->state.issued++;
+}
+
+/// @param target GL_DRAW_FRAMEBUFFER, GL_READ_FRAMEBUFFER or GL_FRAMEBUFFER for both
+static inline void
+gl_state_bind_framebuffer(struct gl_data *gd, GLenum target, GLuint fbo) {
+	bool draw = target != GL_READ_FRAMEBUFFER, read = target != GL_DRAW_FRAMEBUFFER;
+	if ((!draw || gd->state.draw_fbo == fbo) &&
+	    (!read || gd->state.read_fbo == fbo)) {
+		gd->state.elided++;
+		return;
+	}
+	glBindFramebuffer(target, fbo);
+	if (draw) {
+		gd->state.draw_fbo = fbo;
+	}
+	if (read) {
+		gd->state.read_fbo = fbo;
+	}
+	gd->state.issued++;
+}
+
+/// Set the draw buffer of the bound draw framebuffer. Only tracked for the default
+/// framebuffer, the draw buffers of framebuffer objects are set once when they are
+/// created.
+static inline void gl_state_draw_buffer(struct gl_data *gd, GLenum buffer) {
+	if (gd->state.draw_fbo == 0 && gd->state.draw_buffer == buffer) {
+		gd->state.elided++;
+		return;
+	}
+	glDrawBuffer(buffer);
+	if (gd->state.draw_fbo == 0) {
+		gd->state.draw_buffer = buffer;
+	}
+	gd->state.issued++;
+}
+
+static inline void gl_state_bind_vertex_array(struct gl_data *gd, GLuint vao) {
+	if (gd->state.vao == vao) {
+		gd->state.elided++;
+		return;
+	}
+	glBindVertexArray(vao);
+	gd->state.vao = vao;
+	gd->state.issued++;
+}
+
+static inline void gl_state_set_blend(struct gl_data *gd, bool enable) {
+	if (gd->state.blend == enable) {
+		gd->state.elided++;
+		return;
+	}
+	if (enable) {
+		glEnable(GL_BLEND);
+	} else {
+		glDisable(GL_BLEND);
+	}
+	gd->state.blend = enable;
+	gd->state.issued++;
+}
+
+/// Delete a texture. Deleting a texture unbinds it, so the tracked bindings have to be
+/// updated, or a new texture that reuses the name would be taken as bound.
+static inline void gl_state_delete_texture(struct gl_data *gd, GLuint texture) {
+	if (!texture) {
+		return;
+	}
+	for (int i = 0; i < GL_STATE_TEXTURE_UNITS; i++) {
+		if (gd->state.textures[i] == texture) {
+			gd->state.textures[i] = 0;
+		}
+	}
+	glDeleteTextures(1, &texture);
+}
+
 /**
  * Get a textual representation of an OpenGL error.
  */
@@ -164,7 +336,13 @@ static inline void gl_clear_err(void) {
 		;
 }
 
+#ifdef NDEBUG
+// Polling glGetError can stall the driver. Release builds rely on the KHR_debug
+// callback instead, see `gl_debug_init`.
+#define gl_check_err() ((void)0)
+#else
 #define gl_check_err() gl_check_err_(__func__, __LINE__)
+#endif
 
 /**
  * Check for GL framebuffer completeness.
@@ -30,6 +30,7 @@
 #include "log.h"
 #include "picom.h"
 #include "region.h"
+#include "trace.h"
 #include "utils.h"
 #include "win.h"
 #include "x.h"
@@ -166,9 +167,8 @@ static void glx_release_image(backend_t *base, struct gl_texture *tex) {
 	struct _glx_pixmap *p = tex->user_data;
 	// Release binding
 	if (p->glpixmap && tex->texture) {
-		glBindTexture(GL_TEXTURE_2D, tex->texture);
+		gl_state_bind_texture(&gd->gl, 0, tex->texture);
 		glXReleaseTexImageEXT(gd->display, p->glpixmap, GLX_FRONT_LEFT_EXT);
-		glBindTexture(GL_TEXTURE_2D, 0);
 	}
 
 	// Free GLX Pixmap
@@ -282,6 +282,13 @@ static backend_t *glx_init(session_t *ps) {
 		goto end;
 	}
 
+	bool no_error = ps->o.glx_no_error;
+	if (no_error && !glxext.has_GLX_ARB_create_context_no_error) {
+		log_warn("GLX_ARB_create_context_no_error is not supported by your "
+		         "driver, creating a normal GLX context.");
+		no_error = false;
+	}
+
 	// Find a fbconfig with visualid matching the one from the target win, so we can
 	// be sure that the fbconfig is compatible with our target window.
 	int ncfgs;
@@ -294,21 +301,40 @@ static backend_t *glx_init(session_t *ps) {
 			continue;
 		}
 
-		int *attributes = (int[]){GLX_CONTEXT_MAJOR_VERSION_ARB,
-		                          3,
-		                          GLX_CONTEXT_MINOR_VERSION_ARB,
-		                          3,
-		                          GLX_CONTEXT_PROFILE_MASK_ARB,
-		                          GLX_CONTEXT_CORE_PROFILE_BIT_ARB,
-		                          0,
-		                          0,
-		                          0};
+		int attributes[13] = {GLX_CONTEXT_MAJOR_VERSION_ARB,
+		                      3,
+		                      GLX_CONTEXT_MINOR_VERSION_ARB,
+		                      3,
+		                      GLX_CONTEXT_PROFILE_MASK_ARB,
+		                      GLX_CONTEXT_CORE_PROFILE_BIT_ARB};
+		int nattributes = 6;
 		if (glxext.has_GLX_ARB_create_context_robustness) {
-			attributes[6] = GLX_CONTEXT_RESET_NOTIFICATION_STRATEGY_ARB;
-			attributes[7] = GLX_LOSE_CONTEXT_ON_RESET_ARB;
+			attributes[nattributes++] =
+			    GLX_CONTEXT_RESET_NOTIFICATION_STRATEGY_ARB;
+			attributes[nattributes++] = GLX_LOSE_CONTEXT_ON_RESET_ARB;
+		}
+		// A no error context can't be a debug context
+		int no_error_attribute = -1;
+		if (no_error) {
+			no_error_attribute = nattributes;
+			attributes[nattributes++] = GLX_CONTEXT_OPENGL_NO_ERROR_ARB;
+			attributes[nattributes++] = true;
 		}
+#ifndef NDEBUG
+		else {
+			attributes[nattributes++] = GLX_CONTEXT_FLAGS_ARB;
+			attributes[nattributes++] = GLX_CONTEXT_DEBUG_BIT_ARB;
+		}
+#endif
 
 		gd->ctx = glXCreateContextAttribsARB(ps->dpy, cfg[i], 0, true, attributes);
+		if (!gd->ctx && no_error_attribute >= 0) {
+			log_warn("Failed to create a no error GLX context, creating a "
+			         "normal one.");
+			attributes[no_error_attribute] = 0;
+			gd->ctx = glXCreateContextAttribsARB(ps->dpy, cfg[i], 0, true,
+			                                     attributes);
+		}
 		free(cfg);
 
 		if (!gd->ctx) {
@@ -373,7 +399,9 @@ glx_bind_pixmap(backend_t *base, xcb_pixmap_t pixmap, struct xvisual_info fmt, b
 		return false;
 	}
 
-	auto r = xcb_get_geometry_reply(base->c, xcb_get_geometry(base->c, pixmap), NULL);
+	auto r = X_ROUNDTRIP(
+	    "xcb_get_geometry",
+	    xcb_get_geometry_reply(base->c, xcb_get_geometry(base->c, pixmap), NULL));
 	if (!r) {
 		log_error("Invalid pixmap %#010x", pixmap);
 		return NULL;
@@ -387,7 +415,15 @@ glx_bind_pixmap(backend_t *base, xcb_pixmap_t pixmap, struct xvisual_info fmt, b
 	wd->inner = (struct backend_image_inner_base *)inner;
 	free(r);
 
-	auto fbcfg = glx_find_fbconfig(gd->display, gd->screen, fmt);
+	// The FBConfig of a visual is looked up once, and kept in the visual table
+	auto visual = x_get_visual_entry(base->c, fmt.visual);
+	struct glx_fbconfig_info *fbcfg = visual ? visual->fbconfig : NULL;
+	if (!fbcfg) {
+		fbcfg = glx_find_fbconfig(gd->display, gd->screen, fmt);
+		if (visual) {
+			visual->fbconfig = fbcfg;
+		}
+	}
 	if (!fbcfg) {
 		log_error("Couldn't find FBConfig with requested visual %x", fmt.visual);
 		goto err;
@@ -418,7 +454,9 @@ glx_bind_pixmap(backend_t *base, xcb_pixmap_t pixmap, struct xvisual_info fmt, b
 	glxpixmap->pixmap = pixmap;
 	glxpixmap->glpixmap = glXCreatePixmap(gd->display, fbcfg->cfg, pixmap, attrs);
 	glxpixmap->owned = owned;
-	free(fbcfg);
+	if (!visual) {
+		free(fbcfg);
+	}
 
 	if (!glxpixmap->glpixmap) {
 		log_error("Failed to create glpixmap for pixmap %#010x", pixmap);
@@ -429,12 +467,11 @@ glx_bind_pixmap(backend_t *base, xcb_pixmap_t pixmap, struct xvisual_info fmt, b
 
 	// Create texture
 	inner->user_data = glxpixmap;
-	inner->texture = gl_new_texture(GL_TEXTURE_2D);
+	inner->texture = gl_new_texture(&gd->gl);
 	inner->has_alpha = fmt.alpha_size != 0;
 	wd->inner->refcount = 1;
-	glBindTexture(GL_TEXTURE_2D, inner->texture);
+	// gl_new_texture leaves the texture bound
 	glXBindTexImageEXT(gd->display, glxpixmap->glpixmap, GLX_FRONT_LEFT_EXT, NULL);
-	glBindTexture(GL_TEXTURE_2D, 0);
 
 	gl_check_err();
 	return wd;
@@ -454,9 +491,14 @@ err:
 static void glx_present(backend_t *base, const region_t *region attr_unused) {
 	struct _glx_data *gd = (void *)base;
 	gl_present(base, region);
+	trace_begin("gpu", "glXSwapBuffers");
 	glXSwapBuffers(gd->display, gd->target_win);
+	trace_end("gpu", "glXSwapBuffers");
 	if (!gd->gl.is_nvidia) {
+		// Waits for the GPU to finish the frame
+		trace_begin("gpu", "glFinish");
 		glFinish();
+		trace_end("gpu", "glFinish");
 	}
 }
 
@@ -474,6 +516,7 @@ static int glx_buffer_age(backend_t *base) {
 struct backend_operations glx_ops = {
     .init = glx_init,
     .deinit = glx_deinit,
+    .root_change = gl_root_change,
     .bind_pixmap = glx_bind_pixmap,
     .release_image = gl_release_image,
     .compose = gl_compose,
@@ -483,7 +526,11 @@ struct backend_operations glx_ops = {
     .present = glx_present,
     .buffer_age = glx_buffer_age,
     .fill = gl_fill,
+    .begin_depth = gl_begin_depth,
+    .set_depth = gl_set_depth,
     .device_status = gl_device_status,
+    .take_frame_stats = gl_take_frame_stats,
+    .image_damaged = gl_image_damaged,
     .create_shader = gl_create_window_shader,
     .destroy_shader = gl_destroy_window_shader,
     .get_shader_attributes = gl_get_shader_attributes,
@@ -555,6 +602,7 @@ void glxext_init(Display *dpy, int screen) {
 	check_ext(GLX_ARB_create_context);
 	check_ext(GLX_EXT_buffer_age);
 	check_ext(GLX_ARB_create_context_robustness);
+	check_ext(GLX_ARB_create_context_no_error);
 #ifdef GLX_MESA_query_renderer
 	check_ext(GLX_MESA_query_renderer);
 #endif
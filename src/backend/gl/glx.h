@@ -56,6 +56,7 @@ struct glxext_info {
 	bool has_GLX_EXT_buffer_age;
 	bool has_GLX_MESA_query_renderer;
 	bool has_GLX_ARB_create_context_robustness;
+	bool has_GLX_ARB_create_context_no_error;
 };
 
 extern struct glxext_info glxext;
@@ -0,0 +1,256 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "backend/gl/gl_common.h"
+#include "backend/gl/program_cache.h"
+#include "log.h"
+#include "utils.h"
+
+#define PROGRAM_CACHE_MAGIC "picomPB1"
+
+struct gl_program_cache {
+	/// Directory the binaries are stored in
+	char *dir;
+	/// GL vendor, renderer and version, part of the key of every program
+	char *driver;
+};
+
+struct gl_program_cache_header {
+	char magic[8];
+	uint32_t key_length;
+	uint32_t binary_format;
+	uint32_t binary_length;
+};
+
+/// Create `path` and its parents, like `mkdir -p`.
+static bool mkdir_parents(char *path) {
+	for (char *p = path + 1;; p++) {
+		if (*p != '/' && *p != '\0') {
+			continue;
+		}
+		char c = *p;
+		*p = '\0';
+		int ret = mkdir(path, 0700);
+		*p = c;
+		if (ret != 0 && errno != EEXIST) {
+			log_info("Failed to create directory %s: %s", path,
+			         strerror(errno));
+			return false;
+		}
+		if (c == '\0') {
+			return true;
+		}
+	}
+}
+
+struct gl_program_cache *gl_program_cache_new(void) {
+	GLint nformats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &nformats);
+	if (nformats <= 0) {
+		log_info("The GL driver can't save program binaries, shaders will be "
+		         "compiled every time.");
+		return NULL;
+	}
+
+	char *dir = NULL;
+	const char *cache_home = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	if (cache_home && cache_home[0] == '/') {
+		if (asprintf(&dir, "%s/picom/programs", cache_home) < 0) {
+			dir = NULL;
+		}
+	} else if (home && home[0] == '/') {
+		if (asprintf(&dir, "%s/.cache/picom/programs", home) < 0) {
+			dir = NULL;
+		}
+	}
+	if (!dir || !mkdir_parents(dir)) {
+		log_info("No place to save program binaries, shaders will be compiled "
+		         "every time.");
+		free(dir);
+		return NULL;
+	}
+
+	auto cache = ccalloc(1, struct gl_program_cache);
+	cache->dir = dir;
+	if (asprintf(&cache->driver, "%s\n%s\n%s\n",
+	             (const char *)glGetString(GL_VENDOR),
+	             (const char *)glGetString(GL_RENDERER),
+	             (const char *)glGetString(GL_VERSION)) < 0) {
+		free(cache->dir);
+		free(cache);
+		return NULL;
+	}
+	log_debug("Caching program binaries in %s", cache->dir);
+	return cache;
+}
+
+void gl_program_cache_destroy(struct gl_program_cache *cache) {
+	free(cache->dir);
+	free(cache->driver);
+	free(cache);
+}
+
+/// Build the key of a program, and the path of its file. The key is every string it
+/// depends on, each shader source is tagged with its stage, and terminated with a NUL.
+static bool gl_program_cache_key(const struct gl_program_cache *cache,
+                                 const char **vert_shaders, const char **frag_shaders,
+                                 char **key, size_t *key_length, char **path) {
+	FILE *f = open_memstream(key, key_length);
+	if (!f) {
+		return false;
+	}
+	fputs(cache->driver, f);
+	for (int i = 0; vert_shaders && vert_shaders[i]; i++) {
+		fputc('v', f);
+		fputs(vert_shaders[i], f);
+		fputc('\0', f);
+	}
+	for (int i = 0; frag_shaders && frag_shaders[i]; i++) {
+		fputc('f', f);
+		fputs(frag_shaders[i], f);
+		fputc('\0', f);
+	}
+	fclose(f);
+
+	// FNV-1a
+	uint64_t hash = 0xcbf29ce484222325;
+	for (size_t i = 0; i < *key_length; i++) {
+		hash ^= (unsigned char)(*key)[i];
+		hash *= 0x100000001b3;
+	}
+	if (asprintf(path, "%s/%016" PRIx64 ".bin", cache->dir, hash) < 0) {
+		free(*key);
+		return false;
+	}
+	return true;
+}
+
+GLuint gl_program_cache_load(struct gl_program_cache *cache, const char **vert_shaders,
+                             const char **frag_shaders) {
+	char *key, *path;
+	size_t key_length;
+	if (!gl_program_cache_key(cache, vert_shaders, frag_shaders, &key, &key_length,
+	                          &path)) {
+		return 0;
+	}
+
+	GLuint program = 0;
+	char *stored_key = NULL;
+	void *binary = NULL;
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		goto out;
+	}
+
+	struct gl_program_cache_header header;
+	if (fread(&header, sizeof(header), 1, f) != 1 ||
+	    memcmp(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+	    header.key_length != key_length || header.binary_length == 0) {
+		goto stale;
+	}
+	stored_key = malloc(key_length);
+	binary = malloc(header.binary_length);
+	if (!stored_key || !binary || fread(stored_key, 1, key_length, f) != key_length ||
+	    memcmp(stored_key, key, key_length) != 0 ||
+	    fread(binary, 1, header.binary_length, f) != header.binary_length) {
+		goto stale;
+	}
+
+	program = glCreateProgram();
+	glProgramBinary(program, header.binary_format, binary,
+	                (GLsizei)header.binary_length);
+	GLint status = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (status == GL_TRUE) {
+		log_trace("Loaded program binary from %s", path);
+		goto out;
+	}
+	glDeleteProgram(program);
+	program = 0;
+
+stale:
+	log_debug("Program binary %s is stale, removing it", path);
+	unlink(path);
+
+out:
+	if (f) {
+		fclose(f);
+	}
+	free(binary);
+	free(stored_key);
+	free(path);
+	free(key);
+	gl_check_err();
+	return program;
+}
+
+void gl_program_cache_store(struct gl_program_cache *cache, const char **vert_shaders,
+                            const char **frag_shaders, GLuint program) {
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0) {
+		return;
+	}
+
+	char *key, *path;
+	size_t key_length;
+	if (!gl_program_cache_key(cache, vert_shaders, frag_shaders, &key, &key_length,
+	                          &path)) {
+		return;
+	}
+
+	struct gl_program_cache_header header = {
+	    .key_length = (uint32_t)key_length,
+	};
+	memcpy(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic));
+	char *tmp_path = NULL;
+	void *binary = malloc((size_t)length);
+	if (!binary) {
+		log_debug("Failed to allocate %d bytes for the program binary", length);
+		goto out;
+	}
+	GLenum format;
+	glGetProgramBinary(program, length, &length, &format, binary);
+	header.binary_format = format;
+	header.binary_length = (uint32_t)length;
+
+	// Write to a temporary file and rename it, so a concurrent load never sees a
+	// partially written file.
+	if (asprintf(&tmp_path, "%s.%d", path, getpid()) < 0) {
+		tmp_path = NULL;
+		goto out;
+	}
+	FILE *f = fopen(tmp_path, "wb");
+	if (!f) {
+		log_debug("Failed to open %s: %s", tmp_path, strerror(errno));
+		goto out;
+	}
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+	          fwrite(key, 1, key_length, f) == key_length &&
+	          fwrite(binary, 1, (size_t)length, f) == (size_t)length;
+	ok = fclose(f) == 0 && ok;
+	if (!ok || rename(tmp_path, path) != 0) {
+		log_debug("Failed to save program binary to %s", path);
+		unlink(tmp_path);
+	} else {
+		log_trace("Saved program binary to %s", path);
+	}
+
+out:
+	free(tmp_path);
+	free(binary);
+	free(path);
+	free(key);
+	gl_check_err();
+}
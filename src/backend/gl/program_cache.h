@@ -0,0 +1,34 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+#pragma once
+
+/// On-disk cache of linked GLSL programs.
+///
+/// Compiling and linking the shaders takes a noticeable amount of time on some
+/// drivers, and is done again every time picom starts or resets. Linked programs are
+/// saved with glGetProgramBinary under $XDG_CACHE_HOME/picom/programs, one file per
+/// program, and loaded back with glProgramBinary.
+///
+/// A program is identified by its shader sources and the GL vendor, renderer and
+/// version strings, since a binary is only good for the driver that produced it. The
+/// file name is a hash of these, and the file keeps a copy of them, which is compared
+/// on load. The driver can still reject a binary, e.g. after an update that didn't
+/// change its version string, in which case the program is compiled from source and
+/// the file is replaced.
+
+#include <GL/gl.h>
+
+struct gl_program_cache;
+
+/// Open the cache for the current GL context. Returns NULL if the driver can't save
+/// program binaries, or there is nowhere to store them.
+struct gl_program_cache *gl_program_cache_new(void);
+void gl_program_cache_destroy(struct gl_program_cache *cache);
+
+/// Create a program from the cached binary of the given shaders. Returns 0 if there is
+/// no usable binary.
+GLuint gl_program_cache_load(struct gl_program_cache *cache, const char **vert_shaders,
+                             const char **frag_shaders);
+/// Save the binary of `program`, which was linked from the given shaders.
+void gl_program_cache_store(struct gl_program_cache *cache, const char **vert_shaders,
+                            const char **frag_shaders, GLuint program);
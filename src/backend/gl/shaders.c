@@ -19,8 +19,10 @@ const char fill_frag[] = GLSL(330,
 const char fill_vert[] = GLSL(330,
 	layout(location = 0) in vec2 in_coord;
 	uniform mat4 projection;
+	uniform float depth;
 	void main() {
 		gl_Position = projection * vec4(in_coord, 0, 1);
+		gl_Position.z = depth;
 	}
 );
 
@@ -47,11 +49,13 @@ const char vertex_shader[] = GLSL(330,
 	uniform mat4 projection;
 	uniform float scale = 1.0;
 	uniform vec2 texorig;
+	uniform float depth;
 	layout(location = 0) in vec2 coord;
 	layout(location = 1) in vec2 in_texcoord;
 	out vec2 texcoord;
 	void main() {
 		gl_Position = projection * vec4(coord, 0, scale);
+		gl_Position.z = depth * gl_Position.w;
 		texcoord = in_texcoord + texorig;
 	}
 );
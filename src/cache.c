@@ -1,13 +1,16 @@
 #include <uthash.h>
 
 #include "compiler.h"
+#include "list.h"
 #include "utils.h"
 #include "cache.h"
 
 struct cache_entry {
-	char *key;
 	void *value;
 	UT_hash_handle hh;
+	/// Position in the cache's list of entries, most recently used first
+	struct list_node lru;
+	char key[];
 };
 
 struct cache {
@@ -15,25 +18,62 @@ struct cache {
 	cache_free_t free;
 	void *user_data;
 	struct cache_entry *entries;
+	/// All entries, most recently used first
+	struct list_node lru;
+	/// Maximum number of entries, 0 for no limit
+	size_t capacity;
+	struct cache_stats stats;
 };
 
-void cache_set(struct cache *c, const char *key, void *data) {
-	struct cache_entry *e = NULL;
-	HASH_FIND_STR(c->entries, key, e);
-	CHECK(!e);
+static inline struct cache_entry *
+cache_find(struct cache *c, const void *key, size_t key_size) {
+	struct cache_entry *e;
+	HASH_FIND(hh, c->entries, key, (unsigned)key_size, e);
+	return e;
+}
 
-	e = ccalloc(1, struct cache_entry);
-	e->key = strdup(key);
-	e->value = data;
-	HASH_ADD_STR(c->entries, key, e);
+static inline void _cache_invalidate(struct cache *c, struct cache_entry *e) {
+	if (c->free) {
+		c->free(c->user_data, e->value);
+	}
+	HASH_DEL(c->entries, e);
+	list_remove(&e->lru);
+	free(e);
 }
 
-void *cache_get(struct cache *c, const char *key, int *err) {
-	struct cache_entry *e;
-	HASH_FIND_STR(c->entries, key, e);
+/// Drop the least recently used entries until there are fewer than `n` of them.
+static void cache_evict(struct cache *c, size_t n) {
+	while (HASH_COUNT(c->entries) >= n && !list_is_empty(&c->lru)) {
+		_cache_invalidate(c, list_entry(c->lru.prev, struct cache_entry, lru));
+		c->stats.evictions++;
+	}
+}
+
+static void cache_insert(struct cache *c, const void *key, size_t key_size, void *value) {
+	if (c->capacity) {
+		cache_evict(c, c->capacity);
+	}
+
+	struct cache_entry *e = allocchk(malloc(sizeof(*e) + key_size));
+	e->value = value;
+	memcpy(e->key, key, key_size);
+	HASH_ADD_KEYPTR(hh, c->entries, e->key, (unsigned)key_size, e);
+	list_insert_after(&c->lru, &e->lru);
+}
+
+void cache_set_blob(struct cache *c, const void *key, size_t key_size, void *data) {
+	CHECK(!cache_find(c, key, key_size));
+	cache_insert(c, key, key_size, data);
+}
+
+void *cache_get_blob(struct cache *c, const void *key, size_t key_size, int *err) {
+	auto e = cache_find(c, key, key_size);
 	if (e) {
+		c->stats.hits++;
+		list_move_after(&e->lru, &c->lru);
 		return e->value;
 	}
+	c->stats.misses++;
 
 	int tmperr;
 	if (!err) {
@@ -41,32 +81,17 @@ void *cache_get(struct cache *c, const char *key, int *err) {
 	}
 
 	*err = 0;
-	e = ccalloc(1, struct cache_entry);
-	e->key = strdup(key);
-	e->value = c->getter(c->user_data, key, err);
+	void *value = c->getter(c->user_data, key, key_size, err);
 	if (*err) {
-		free(e->key);
-		free(e);
 		return NULL;
 	}
 
-	HASH_ADD_STR(c->entries, key, e);
-	return e->value;
-}
-
-static inline void _cache_invalidate(struct cache *c, struct cache_entry *e) {
-	if (c->free) {
-		c->free(c->user_data, e->value);
-	}
-	free(e->key);
-	HASH_DEL(c->entries, e);
-	free(e);
+	cache_insert(c, key, key_size, value);
+	return value;
 }
 
-void cache_invalidate(struct cache *c, const char *key) {
-	struct cache_entry *e;
-	HASH_FIND_STR(c->entries, key, e);
-
+void cache_invalidate_blob(struct cache *c, const void *key, size_t key_size) {
+	auto e = cache_find(c, key, key_size);
 	if (e) {
 		_cache_invalidate(c, e);
 	}
@@ -79,6 +104,17 @@ void cache_invalidate_all(struct cache *c) {
 	}
 }
 
+void cache_set_capacity(struct cache *c, size_t capacity) {
+	c->capacity = capacity;
+	if (capacity) {
+		cache_evict(c, capacity + 1);
+	}
+}
+
+const struct cache_stats *cache_get_stats(const struct cache *c) {
+	return &c->stats;
+}
+
 void *cache_free(struct cache *c) {
 	void *ret = c->user_data;
 	cache_invalidate_all(c);
@@ -91,5 +127,6 @@ struct cache *new_cache(void *ud, cache_getter_t getter, cache_free_t f) {
 	c->user_data = ud;
 	c->getter = getter;
 	c->free = f;
+	list_init_head(&c->lru);
 	return c;
 }
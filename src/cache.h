@@ -1,22 +1,42 @@
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
 struct cache;
 
-typedef void *(*cache_getter_t)(void *user_data, const char *key, int *err);
+/// Produce the value of `key`, which is `key_size` bytes long. String keys are passed
+/// with their terminating NUL.
+typedef void *(*cache_getter_t)(void *user_data, const void *key, size_t key_size,
+                                int *err);
 typedef void (*cache_free_t)(void *user_data, void *data);
 
+struct cache_stats {
+	/// Number of cache_get calls that found their value in the cache
+	uint64_t hits;
+	/// Number of cache_get calls that had to call the getter
+	uint64_t misses;
+	/// Number of values dropped to stay within the capacity
+	uint64_t evictions;
+};
+
 /// Create a cache with `getter`, and a free function `f` which is used to free the cache
-/// value when they are invalidated.
+/// value when they are invalidated or evicted.
 ///
 /// `user_data` will be passed to `getter` and `f` when they are called.
 struct cache *new_cache(void *user_data, cache_getter_t getter, cache_free_t f);
 
+/// Limit the number of values in the cache to `capacity`, 0 means no limit. When the
+/// limit is reached, the least recently used value is evicted.
+void cache_set_capacity(struct cache *, size_t capacity);
+
 /// Fetch a value from the cache. If the value doesn't present in the cache yet, the
 /// getter will be called, and the returned value will be stored into the cache.
-void *cache_get(struct cache *, const char *key, int *err);
+void *cache_get_blob(struct cache *, const void *key, size_t key_size, int *err);
 
 /// Invalidate a value in the cache.
-void cache_invalidate(struct cache *, const char *key);
+void cache_invalidate_blob(struct cache *, const void *key, size_t key_size);
 
 /// Invalidate all values in the cache.
 void cache_invalidate_all(struct cache *);
@@ -29,4 +49,26 @@ void *cache_free(struct cache *);
 /// ownership of `data`
 ///
 /// If `key` already exists in the cache, this function will abort the program.
-void cache_set(struct cache *c, const char *key, void *data);
+void cache_set_blob(struct cache *c, const void *key, size_t key_size, void *data);
+
+const struct cache_stats *cache_get_stats(const struct cache *);
+
+static inline void *cache_get(struct cache *c, const char *key, int *err) {
+	return cache_get_blob(c, key, strlen(key) + 1, err);
+}
+
+static inline void *cache_get_int(struct cache *c, uint64_t key, int *err) {
+	return cache_get_blob(c, &key, sizeof(key), err);
+}
+
+static inline void cache_invalidate(struct cache *c, const char *key) {
+	cache_invalidate_blob(c, key, strlen(key) + 1);
+}
+
+static inline void cache_invalidate_int(struct cache *c, uint64_t key) {
+	cache_invalidate_blob(c, &key, sizeof(key));
+}
+
+static inline void cache_set(struct cache *c, const char *key, void *data) {
+	cache_set_blob(c, key, strlen(key) + 1, data);
+}
@@ -48,10 +48,12 @@
 #include "list.h"
 #include "region.h"
 #include "render.h"
+#include "statistics.h"
 #include "types.h"
 #include "utils.h"
 #include "win_defs.h"
 #include "x.h"
+#include "xid_map.h"
 
 // === Constants ===0
 
@@ -65,6 +67,13 @@
 /// @brief Maximum OpenGL buffer age.
 #define CGLX_MAX_BUFFER_AGE 5
 
+/// @brief Maximum number of presented frames waiting for their Present
+/// CompleteNotify.
+#define MAX_FRAMES_IN_FLIGHT 8
+
+/// @brief Number of X Sync fences x_fence_sync rotates through.
+#define SYNC_FENCE_COUNT 3
+
 // Window flags
 
 // === Types ===
@@ -77,6 +86,8 @@ enum pending_reply_action {
 	PENDING_REPLY_ACTION_IGNORE,
 	PENDING_REPLY_ACTION_ABORT,
 	PENDING_REPLY_ACTION_DEBUG_ABORT,
+	/// The request used the X Sync fences, stop using them
+	PENDING_REPLY_ACTION_DISABLE_SYNC_FENCE,
 };
 
 typedef struct pending_reply {
@@ -121,6 +132,9 @@ typedef struct session {
 	ev_io xiow;
 	/// Timer for checking DPMS power level
 	ev_timer dpms_check_timer;
+	/// Timer for retrying to create the backend after a device reset. Active while
+	/// recovering, nothing is drawn then.
+	ev_timer device_reset_timer;
 	/// Use an ev_idle callback for drawing
 	/// So we only start drawing when events are processed
 	ev_idle draw_idle;
@@ -130,6 +144,10 @@ typedef struct session {
 	ev_prepare event_check;
 	/// Signal handler for SIGUSR1
 	ev_signal usr1_signal;
+	/// Signal handler for SIGUSR2
+	ev_signal usr2_signal;
+	/// Control socket, NULL if not enabled
+	struct control *control;
 	/// Signal handler for SIGINT
 	ev_signal int_signal;
 
@@ -191,12 +209,18 @@ typedef struct session {
 	// XXX should be in struct glx_session
 	glx_prog_main_t glx_prog_win;
 	struct glx_fbconfig_info *argb_fbconfig;
-	/// Sync fence to sync draw operations
-	xcb_sync_fence_t sync_fence;
+	/// Sync fences to sync draw operations, used in turn by x_fence_sync
+	xcb_sync_fence_t sync_fences[SYNC_FENCE_COUNT];
+	/// Index of the fence x_fence_sync uses next
+	int sync_fence_index;
+	/// Bit mask of the fences that are triggered and haven't been reset
+	unsigned int sync_fences_triggered;
 	/// Whether we are rendering the first frame after screen is redirected
 	bool first_frame;
 	/// Whether screen has been turned off
 	bool screen_is_off;
+	/// Whether the screen is kept unredirected, on request of the control socket
+	bool unredirect_forced;
 
 	// === Operation related ===
 	/// Flags related to the root window
@@ -239,8 +263,8 @@ typedef struct session {
 	int n_expose;
 
 	// === Window related ===
-	/// A hash table of all windows.
-	struct win *windows;
+	/// All windows, by ID.
+	struct xid_map windows;
 	/// Windows in their stacking order
 	struct list_node window_stack;
 	/// Pointer to <code>win</code> of current active window. Used by
@@ -257,6 +281,50 @@ typedef struct session {
 	/// Nanosecond offset of the first painting.
 	long paint_tm_offset;
 
+	// === Statistics ===
+	/// Time taken by each frame, from the start of painting to the return of
+	/// present. Only collected in benchmark mode.
+	struct sample_stats frame_times;
+	/// Time spent waiting for X round trips in each frame. Only collected in
+	/// benchmark mode.
+	struct sample_stats frame_roundtrip_times;
+	/// Measurements of the last rendered frame
+	struct frame_stats frame_stats;
+	/// When the session was started
+	uint64_t start_time;
+	/// Number of X events received
+	uint64_t nevents;
+	/// Number of frames rendered
+	uint64_t nframes;
+	/// Total time spent rendering frames
+	uint64_t frames_ns;
+	/// Total number of pixels composed and presented, their ratio is the overdraw
+	uint64_t pixels_composed;
+	uint64_t pixels_presented;
+	/// Total number of state changing graphics API calls made and skipped by the
+	/// backend
+	uint64_t state_calls_issued;
+	uint64_t state_calls_elided;
+	/// Arrival time of the earliest damage that hasn't been painted yet, 0 if
+	/// there is none.
+	uint64_t damage_time;
+	/// Arrival time of the earliest damage of each frame that has been presented,
+	/// but hasn't been completed by the X server yet, oldest first. 0 for frames
+	/// that weren't caused by damage. A ring buffer.
+	uint64_t frames_in_flight[MAX_FRAMES_IN_FLIGHT];
+	/// Index of the oldest frame in frames_in_flight
+	int frames_in_flight_head;
+	/// Number of frames in frames_in_flight
+	int nframes_in_flight;
+	/// Number of failed attempts to recover from the current device reset
+	int device_reset_attempts;
+	/// Whether we have received a Present CompleteNotify for our frames. Until
+	/// then, the latency is measured up to the return of present.
+	bool present_complete_seen;
+	/// Time from the arrival of a damage to the completion of the presentation of
+	/// the frame that contains it. Only collected in benchmark mode.
+	struct sample_stats damage_latencies;
+
 	// === X extension related ===
 	/// Event base number for X Fixes extension.
 	int xfixes_event;
@@ -292,6 +360,10 @@ typedef struct session {
 	int randr_error;
 	/// Whether X Present extension exists.
 	bool present_exists;
+	/// Major opcode for X Present extension.
+	int present_opcode;
+	/// Event ID of our selection of Present events on the target window.
+	uint32_t present_eid;
 	/// Whether X GLX extension exists.
 	bool glx_exists;
 	/// Event base number for X GLX extension.
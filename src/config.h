@@ -31,6 +31,16 @@ enum backend {
 	NUM_BKEND,
 };
 
+/// @brief How windows are composed into the back buffer
+enum compose_strategy {
+	/// Clip each window to the part not covered by opaque windows above it.
+	COMPOSE_STRATEGY_REGION,
+	/// Draw opaque windows front to back with depth writes, then translucent ones
+	/// back to front with depth testing, so the GPU rejects covered pixels.
+	COMPOSE_STRATEGY_DEPTH,
+	NUM_COMPOSE_STRATEGIES,
+};
+
 typedef struct win_option_mask {
 	bool focus : 1;
 	bool redir_ignore : 1;
@@ -54,8 +64,12 @@ typedef struct options {
 	bool glx_no_stencil;
 	/// Whether to avoid rebinding pixmap on window damage.
 	bool glx_no_rebind_pixmap;
+	/// Create the GL context without error checking
+	bool glx_no_error;
 	/// Path to log file.
 	char *logpath;
+	/// Whether to format and write log messages on a background thread.
+	bool log_async;
 	/// Whether to show all X errors.
 	bool show_all_xerrors;
 	/// Window type option override.
@@ -66,9 +80,32 @@ typedef struct options {
 	// GLX_EXT_buffer_age is not supported
 	/// Whether use damage information to help limit the area to paint
 	bool use_damage;
+	/// How windows are composed into the back buffer.
+	enum compose_strategy compose_strategy;
+	/// Windows up to this size in both dimensions are composed from a shared texture
+	/// atlas. 0 disables the atlas.
+	int atlas_max_size;
+
+	// === Debugging ===
+	/// Number of frames to render before exiting in benchmark mode. 0 disables
+	/// benchmark mode.
+	int benchmark;
+	/// Window to damage in benchmark mode. XCB_NONE to repaint the whole screen
+	/// every frame.
+	xcb_window_t benchmark_wid;
+	/// Path to write a Chrome trace event file to. NULL to disable tracing.
+	char *trace_path;
+	/// Time in microseconds a single call site may spend waiting for X round trips
+	/// in one frame before a warning is logged. 0 to disable the warning.
+	int x_roundtrip_budget;
+	/// Whether to listen on a control socket under $XDG_RUNTIME_DIR.
+	bool control_socket;
+	/// Path to record the handled X events to. NULL to disable recording.
+	char *record_path;
 } options_t;
 
 extern const char *const BACKEND_STRS[NUM_BKEND + 1];
+extern const char *const COMPOSE_STRATEGY_STRS[NUM_COMPOSE_STRATEGIES + 1];
 
 bool must_use parse_long(const char *, long *);
 bool must_use parse_int(const char *, int *);
@@ -88,4 +125,17 @@ static inline attr_pure enum backend parse_backend(const char *str) {
 	return NUM_BKEND;
 }
 
+/**
+ * Parse a compose strategy option argument.
+ */
+static inline attr_pure enum compose_strategy parse_compose_strategy(const char *str) {
+	for (enum compose_strategy i = 0; COMPOSE_STRATEGY_STRS[i]; ++i) {
+		if (!strcasecmp(str, COMPOSE_STRATEGY_STRS[i])) {
+			return i;
+		}
+	}
+	log_error("Invalid compose strategy argument: %s", str);
+	return NUM_COMPOSE_STRATEGIES;
+}
+
 // vim: set noet sw=8 ts=8 :
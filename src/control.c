@@ -0,0 +1,448 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <X11/Xlib.h>
+#include <ev.h>
+
+#include "common.h"
+#include "control.h"
+#include "list.h"
+#include "log.h"
+#include "picom.h"
+#include "utils.h"
+#include "win.h"
+#include "x.h"
+
+/// Longest request we accept. Clients sending longer lines are disconnected.
+#define CONTROL_MAX_LINE 256
+
+struct control_client {
+	ev_io w;
+	struct control *ctl;
+	/// Unprocessed input, without a complete line
+	char in[CONTROL_MAX_LINE];
+	size_t in_len;
+	/// Output not yet written to the socket
+	char *out;
+	size_t out_len, out_written;
+	struct control_client *next;
+};
+
+struct control {
+	ev_io w;
+	session_t *ps;
+	char *path;
+	struct control_client *clients;
+};
+
+static void control_client_destroy(struct control_client *c) {
+	auto ctl = c->ctl;
+	for (auto i = &ctl->clients; *i; i = &(*i)->next) {
+		if (*i == c) {
+			*i = c->next;
+			break;
+		}
+	}
+	ev_io_stop(ctl->ps->loop, &c->w);
+	close(c->w.fd);
+	free(c->out);
+	free(c);
+}
+
+/// Write as much of the pending output as possible. Returns false if the client is
+/// gone.
+static bool control_client_flush(struct control_client *c) {
+	while (c->out_written < c->out_len) {
+		auto ret = send(c->w.fd, c->out + c->out_written,
+		                c->out_len - c->out_written, MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		c->out_written += (size_t)ret;
+	}
+
+	int events = EV_READ;
+	if (c->out_written == c->out_len) {
+		free(c->out);
+		c->out = NULL;
+		c->out_len = c->out_written = 0;
+	} else {
+		events |= EV_WRITE;
+	}
+	if (c->w.events != events) {
+		ev_io_stop(c->ctl->ps->loop, &c->w);
+		ev_io_set(&c->w, c->w.fd, events);
+		ev_io_start(c->ctl->ps->loop, &c->w);
+	}
+	return true;
+}
+
+static bool parse_bool(const char *value, bool *out) {
+	if (strcmp(value, "1") == 0 || strcmp(value, "true") == 0 ||
+	    strcmp(value, "on") == 0) {
+		*out = true;
+		return true;
+	}
+	if (strcmp(value, "0") == 0 || strcmp(value, "false") == 0 ||
+	    strcmp(value, "off") == 0) {
+		*out = false;
+		return true;
+	}
+	return false;
+}
+
+static bool parse_nonnegative_int(const char *value, int *out) {
+	char *end;
+	errno = 0;
+	long tmp = strtol(value, &end, 0);
+	if (errno || end == value || *end || tmp < 0 || tmp > INT_MAX) {
+		return false;
+	}
+	*out = (int)tmp;
+	return true;
+}
+
+static const char *set_use_damage(session_t *ps, const char *value) {
+	if (!parse_bool(value, &ps->o.use_damage)) {
+		return "expected a boolean";
+	}
+	// The damage ring is stale if we weren't using damage
+	if (ps->redirected) {
+		force_repaint(ps);
+	}
+	return NULL;
+}
+
+static const char *set_unredirect(session_t *ps, const char *value) {
+	if (!parse_bool(value, &ps->unredirect_forced)) {
+		return "expected a boolean";
+	}
+	// paint_preprocess takes care of (un)redirecting the screen
+	queue_redraw(ps);
+	return NULL;
+}
+
+static const char *set_x_roundtrip_budget(session_t *ps, const char *value) {
+	if (!parse_nonnegative_int(value, &ps->o.x_roundtrip_budget)) {
+		return "expected a non-negative integer";
+	}
+	return NULL;
+}
+
+static const char *set_compose_strategy(session_t *ps, const char *value) {
+	auto strategy = parse_compose_strategy(value);
+	if (strategy >= NUM_COMPOSE_STRATEGIES) {
+		return "expected region or depth";
+	}
+	ps->o.compose_strategy = strategy;
+	queue_redraw(ps);
+	return NULL;
+}
+
+static const char *set_log_level(session_t *ps attr_unused, const char *value) {
+	auto level = string_to_log_level(value);
+	if (level == LOG_LEVEL_INVALID) {
+		return "unknown log level";
+	}
+	log_set_level_tls(level);
+	return NULL;
+}
+
+/// Settings that can be changed with the "set" request
+static const struct {
+	const char *name;
+	const char *help;
+	const char *(*set)(session_t *ps, const char *value);
+} control_settings[] = {
+    {"use_damage", "BOOL, whether to only repaint the damaged parts of the screen",
+     set_use_damage},
+    {"unredirect", "BOOL, keep the screen unredirected", set_unredirect},
+    {"x_roundtrip_budget", "MICROSECONDS, see --x-roundtrip-budget",
+     set_x_roundtrip_budget},
+    {"compose_strategy", "region or depth, see --compose-strategy", set_compose_strategy},
+    {"log_level", "trace, debug, info, warn or error", set_log_level},
+};
+
+static void control_metrics(session_t *ps, FILE *f) {
+	size_t nwins = 0, nmapped = 0;
+	uint64_t texture_bytes = 0;
+	win_stack_foreach_managed(w, &ps->window_stack) {
+		nwins++;
+		if (w->state == WSTATE_MAPPED) {
+			nmapped++;
+		}
+		texture_bytes += win_texture_bytes(w);
+	}
+	if (ps->redirected) {
+		// The back buffers
+		texture_bytes += (uint64_t)ps->root_width * (uint64_t)ps->root_height *
+		                 4 * (uint64_t)ps->ndamage;
+	}
+	auto roundtrips = x_roundtrip_get_totals();
+
+	fprintf(f, "uptime_seconds %.3f\n",
+	        (double)(get_time_ns() - ps->start_time) / 1e9);
+	fprintf(f, "redirected %d\n", ps->redirected);
+	fprintf(f, "use_damage %d\n", ps->o.use_damage);
+	fprintf(f, "unredirect %d\n", ps->unredirect_forced);
+	fprintf(f, "screen_is_off %d\n", ps->screen_is_off);
+	fprintf(f, "windows %zu\n", nwins);
+	fprintf(f, "windows_mapped %zu\n", nmapped);
+	fprintf(f, "events_total %" PRIu64 "\n", ps->nevents);
+	fprintf(f, "frames_total %" PRIu64 "\n", ps->nframes);
+	fprintf(f, "frame_time_seconds_total %.6f\n", (double)ps->frames_ns / 1e9);
+	fprintf(f, "frame_time_seconds_last %.6f\n",
+	        (double)ps->frame_stats.render_ns / 1e9);
+	fprintf(f, "x_roundtrips_total %" PRIu64 "\n", roundtrips.count);
+	fprintf(f, "x_roundtrip_seconds_total %.6f\n", (double)roundtrips.ns / 1e9);
+	fprintf(f, "x_roundtrips_last_frame %" PRIu64 "\n", ps->frame_stats.x_roundtrips);
+	fprintf(f, "pixels_composed_total %" PRIu64 "\n", ps->pixels_composed);
+	fprintf(f, "pixels_presented_total %" PRIu64 "\n", ps->pixels_presented);
+	fprintf(f, "overdraw %.3f\n",
+	        ps->pixels_presented
+	            ? (double)ps->pixels_composed / (double)ps->pixels_presented
+	            : 0);
+	fprintf(f, "state_calls_issued_total %" PRIu64 "\n", ps->state_calls_issued);
+	fprintf(f, "state_calls_elided_total %" PRIu64 "\n", ps->state_calls_elided);
+	fprintf(f, "gpu_memory_bytes_estimate %" PRIu64 "\n", texture_bytes);
+}
+
+static void control_handle_request(struct control_client *c, char *line) {
+	auto ps = c->ctl->ps;
+	char *out = NULL;
+	size_t out_len = 0;
+	FILE *f = open_memstream(&out, &out_len);
+	if (!f) {
+		log_error_errno("Failed to allocate the response");
+		return;
+	}
+
+	char *saveptr = NULL;
+	auto cmd = strtok_r(line, " \t", &saveptr);
+	if (!cmd) {
+		fputs("error empty request\n", f);
+	} else if (strcmp(cmd, "metrics") == 0) {
+		control_metrics(ps, f);
+	} else if (strcmp(cmd, "windows") == 0) {
+		win_stats_print(ps, f);
+	} else if (strcmp(cmd, "roundtrips") == 0) {
+		x_roundtrip_print_summary(f);
+	} else if (strcmp(cmd, "set") == 0) {
+		auto name = strtok_r(NULL, " \t", &saveptr);
+		auto value = strtok_r(NULL, " \t", &saveptr);
+		const char *err = "unknown setting";
+		if (!name || !value) {
+			err = "usage: set NAME VALUE";
+		} else {
+			for (size_t i = 0; i < ARR_SIZE(control_settings); i++) {
+				if (strcmp(name, control_settings[i].name) == 0) {
+					err = control_settings[i].set(ps, value);
+					break;
+				}
+			}
+		}
+		if (err) {
+			fprintf(f, "error %s\n", err);
+		} else {
+			log_info("Control socket: set %s to %s", name, value);
+			fputs("ok\n", f);
+		}
+	} else if (strcmp(cmd, "help") == 0) {
+		fputs("metrics\nwindows\nroundtrips\n", f);
+		for (size_t i = 0; i < ARR_SIZE(control_settings); i++) {
+			fprintf(f, "set %s %s\n", control_settings[i].name,
+			        control_settings[i].help);
+		}
+	} else {
+		fprintf(f, "error unknown request %s\n", cmd);
+	}
+	fputc('\n', f);
+	fclose(f);
+
+	if (c->out) {
+		c->out = crealloc(c->out, c->out_len + out_len);
+		memcpy(c->out + c->out_len, out, out_len);
+		c->out_len += out_len;
+		free(out);
+	} else {
+		c->out = out;
+		c->out_len = out_len;
+		c->out_written = 0;
+	}
+}
+
+/// Read and handle the requests sent by a client. Returns false if the client is gone
+/// or misbehaving.
+static bool control_client_read(struct control_client *c) {
+	auto ret = read(c->w.fd, c->in + c->in_len, sizeof(c->in) - c->in_len);
+	if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+		return true;
+	}
+	if (ret <= 0) {
+		return false;
+	}
+	c->in_len += (size_t)ret;
+
+	char *start = c->in, *end = c->in + c->in_len, *newline;
+	while ((newline = memchr(start, '\n', (size_t)(end - start)))) {
+		*newline = '\0';
+		if (newline > start && newline[-1] == '\r') {
+			newline[-1] = '\0';
+		}
+		control_handle_request(c, start);
+		start = newline + 1;
+	}
+	c->in_len -= (size_t)(start - c->in);
+	memmove(c->in, start, c->in_len);
+	if (c->in_len == sizeof(c->in)) {
+		log_warn("Control socket request too long, disconnecting the client");
+		return false;
+	}
+	return true;
+}
+
+static void control_client_callback(EV_P attr_unused, ev_io *w, int revents) {
+	auto c = container_of(w, struct control_client, w);
+	if ((revents & EV_READ) && !control_client_read(c)) {
+		control_client_destroy(c);
+		return;
+	}
+	if (!control_client_flush(c)) {
+		control_client_destroy(c);
+	}
+}
+
+static void control_accept_callback(EV_P attr_unused, ev_io *w, int revents attr_unused) {
+	auto ctl = container_of(w, struct control, w);
+	int fd = accept4(w->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+			log_error_errno("Failed to accept a control socket connection");
+		}
+		return;
+	}
+
+	auto c = ccalloc(1, struct control_client);
+	c->ctl = ctl;
+	c->next = ctl->clients;
+	ctl->clients = c;
+	ev_io_init(&c->w, control_client_callback, fd, EV_READ);
+	ev_io_start(ctl->ps->loop, &c->w);
+}
+
+/// Check whether the socket at `addr` can be replaced. Returns true if there is nothing
+/// at the path, or a socket no one is listening on, which is then removed.
+static bool control_remove_stale_socket(const struct sockaddr_un *addr) {
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		log_error_errno("Failed to create a socket");
+		return false;
+	}
+	int ret = connect(fd, (const struct sockaddr *)addr, sizeof(*addr));
+	int err = errno;
+	close(fd);
+	if (ret == 0) {
+		log_error("Another instance of picom is listening on control socket %s",
+		          addr->sun_path);
+		return false;
+	}
+	if (err == ENOENT) {
+		return true;
+	}
+	if (err != ECONNREFUSED) {
+		log_error("Failed to check control socket %s: %s", addr->sun_path,
+		          strerror(err));
+		return false;
+	}
+	// Left behind by an instance that didn't exit cleanly
+	log_debug("Removing stale control socket %s", addr->sun_path);
+	if (unlink(addr->sun_path) != 0 && errno != ENOENT) {
+		log_error_errno("Failed to remove stale control socket %s",
+		                addr->sun_path);
+		return false;
+	}
+	return true;
+}
+
+struct control *control_new(session_t *ps) {
+	auto runtime_dir = getenv("XDG_RUNTIME_DIR");
+	if (!runtime_dir) {
+		log_error("XDG_RUNTIME_DIR is not set, can't create the control socket");
+		return NULL;
+	}
+
+	// Include the display in the name, so multiple instances of picom don't clash
+	char *display = strdup(DisplayString(ps->dpy));
+	for (char *i = display; *i; i++) {
+		if (*i == '/') {
+			*i = '_';
+		}
+	}
+	char *path = NULL;
+	if (asprintf(&path, "%s/picom-%s.sock", runtime_dir, display) < 0) {
+		free(display);
+		return NULL;
+	}
+	free(display);
+
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		log_error("Control socket path %s is too long", path);
+		free(path);
+		return NULL;
+	}
+	strcpy(addr.sun_path, path);
+
+	if (!control_remove_stale_socket(&addr)) {
+		free(path);
+		return NULL;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		log_error_errno("Failed to create the control socket");
+		free(path);
+		return NULL;
+	}
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 4) < 0) {
+		log_error_errno("Failed to listen on control socket %s", path);
+		close(fd);
+		free(path);
+		return NULL;
+	}
+
+	auto ctl = ccalloc(1, struct control);
+	ctl->ps = ps;
+	ctl->path = path;
+	ev_io_init(&ctl->w, control_accept_callback, fd, EV_READ);
+	ev_io_start(ps->loop, &ctl->w);
+	log_info("Listening on control socket %s", path);
+	return ctl;
+}
+
+void control_destroy(struct control *ctl) {
+	while (ctl->clients) {
+		control_client_destroy(ctl->clients);
+	}
+	ev_io_stop(ctl->ps->loop, &ctl->w);
+	close(ctl->w.fd);
+	unlink(ctl->path);
+	free(ctl->path);
+	free(ctl);
+}
@@ -0,0 +1,23 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+#pragma once
+
+/// A Unix domain socket to inspect and tweak a running picom.
+///
+/// The protocol is line based. Every request is a single line, and every response
+/// is a number of lines followed by an empty line. A response starting with "error "
+/// means the request failed. Requests:
+///
+///   metrics           Counters and gauges, one "name value" pair per line
+///   windows           Statistics of the managed windows, most expensive first
+///   roundtrips        X round trips by call site, most expensive first
+///   set NAME VALUE    Change a setting at runtime, see `control_settings`
+///   help              List the requests
+
+typedef struct session session_t;
+struct control;
+
+/// Create the control socket of `ps`, at $XDG_RUNTIME_DIR/picom-<display>.sock.
+/// Returns NULL on failure.
+struct control *control_new(session_t *ps);
+void control_destroy(struct control *ctl);
@@ -6,6 +6,7 @@
 #include <X11/Xlibint.h>
 #include <X11/extensions/sync.h>
 #include <xcb/damage.h>
+#include <xcb/present.h>
 #include <xcb/randr.h>
 
 #include "atom.h"
@@ -15,6 +16,7 @@
 #include "event.h"
 #include "log.h"
 #include "picom.h"
+#include "record.h"
 #include "region.h"
 #include "utils.h"
 #include "win.h"
@@ -106,36 +108,8 @@ static void configure_win(session_t *ps, xcb_configure_notify_event_t *ce) {
 	auto mw = (struct managed_win *)w;
 
 	restack_above(ps, w, ce->above_sibling);
-
-	// We check against pending_g here, because there might have been multiple
-	// configure notifies in this cycle, or the window could receive multiple updates
-	// while it's unmapped.
-	bool position_changed = mw->pending_g.x != ce->x || mw->pending_g.y != ce->y;
-	bool size_changed =
-	    mw->pending_g.width != ce->width || mw->pending_g.height != ce->height;
-	if (position_changed || size_changed) {
-		// Queue pending updates
-		win_set_flags(mw, WIN_FLAGS_FACTOR_CHANGED);
-		// TODO(yshui) don't set pending_updates if the window is not
-		// visible/mapped
-		ps->pending_updates = true;
-
-		// At least one of the following if's is true
-		if (position_changed) {
-			mw->pending_g.x = ce->x;
-			mw->pending_g.y = ce->y;
-			win_set_flags(mw, WIN_FLAGS_POSITION_STALE);
-		}
-
-		if (size_changed) {
-			mw->pending_g.width = ce->width;
-			mw->pending_g.height = ce->height;
-			win_set_flags(mw, WIN_FLAGS_SIZE_STALE);
-		}
-
-		// Recalculate which monitor this window is on
-		win_update_monitor(ps->randr_nmonitors, ps->randr_monitor_regs, mw);
-	}
+	win_set_pending_geometry(ps, mw, ce->x, ce->y, ce->width, ce->height,
+	                         ce->border_width);
 
 	// override_redirect flag cannot be changed after window creation, as far
 	// as I know, so there's no point to re-match windows here.
@@ -180,7 +154,9 @@ static inline void ev_map_notify(session_t *ps, xcb_map_notify_event_t *ev) {
 	if (ps->overlay && ev->window == ps->overlay && !ps->redirected) {
 		log_debug("Overlay is mapped while we are not redirected");
 		auto e =
-		    xcb_request_check(ps->c, xcb_unmap_window_checked(ps->c, ps->overlay));
+		    X_ROUNDTRIP("xcb_unmap_window",
+		                xcb_request_check(ps->c, xcb_unmap_window_checked(
+		                                             ps->c, ps->overlay)));
 		if (e) {
 			log_error("Failed to unmap the overlay window");
 			free(e);
@@ -335,7 +311,9 @@ static inline void ev_property_notify(session_t *ps, xcb_property_notify_event_t
 	if (unlikely(log_get_level_tls() <= LOG_LEVEL_TRACE)) {
 		// Print out changed atom
 		xcb_get_atom_name_reply_t *reply =
-		    xcb_get_atom_name_reply(ps->c, xcb_get_atom_name(ps->c, ev->atom), NULL);
+		    X_ROUNDTRIP("xcb_get_atom_name",
+		                xcb_get_atom_name_reply(
+		                    ps->c, xcb_get_atom_name(ps->c, ev->atom), NULL));
 		const char *name = "?";
 		int name_len = 1;
 		if (reply) {
@@ -463,6 +441,11 @@ static inline void repair_win(session_t *ps, struct managed_win *w) {
 	log_trace("Mark window %#010x (%s) as having received damage", w->base.id, w->name);
 	w->ever_damaged = true;
 	w->pixmap_damaged = true;
+	w->stats.ndamage++;
+	w->stats.damaged_area += region_area(&parts);
+	if (ps->backend_data && w->win_image && ps->backend_data->ops->image_damaged) {
+		ps->backend_data->ops->image_damaged(ps->backend_data, w->win_image);
+	}
 
 	// Why care about damage when screen is unredirected?
 	// We will force full-screen repaint on redirection.
@@ -476,6 +459,11 @@ static inline void repair_win(session_t *ps, struct managed_win *w) {
 		pixman_region32_subtract(&parts, &parts, w->reg_ignore);
 	}
 
+	// Remember when the earliest damage of the next frame arrived, to measure the
+	// damage to present latency
+	if (!ps->damage_time && pixman_region32_not_empty(&parts)) {
+		ps->damage_time = get_time_ns();
+	}
 	add_damage(ps, &parts);
 	pixman_region32_fini(&parts);
 }
@@ -496,6 +484,15 @@ static inline void ev_damage_notify(session_t *ps, xcb_damage_notify_event_t *de
 	repair_win(ps, w);
 }
 
+static inline void ev_present_complete_notify(session_t *ps,
+                                              xcb_present_complete_notify_event_t *ev) {
+	if (ev->kind != XCB_PRESENT_COMPLETE_KIND_PIXMAP) {
+		return;
+	}
+	// ust is in microseconds, on the same clock as ours if the X server is local
+	damage_latency_frame_completed(ps, ev->ust ? ev->ust * 1000 : get_time_ns());
+}
+
 static inline void ev_shape_notify(session_t *ps, xcb_shape_notify_event_t *ev) {
 	auto w = find_managed_win(ps, ev->affected_window);
 	if (!w || w->a.map_state == XCB_MAP_STATE_UNMAPPED) {
@@ -524,6 +521,8 @@ ev_selection_clear(session_t *ps, xcb_selection_clear_event_t attr_unused *ev) {
 }
 
 void ev_handle(session_t *ps, xcb_generic_event_t *ev) {
+	ps->nevents++;
+	event_record_event(ev);
 	if ((ev->response_type & 0x7f) != KeymapNotify) {
 		discard_pending(ps, ev->full_sequence);
 	}
@@ -555,6 +554,19 @@ void ev_handle(session_t *ps, xcb_generic_event_t *ev) {
 		ev->sequence = seq;
 	}
 
+	// The Present events we selected are only used to measure latency, and don't
+	// need a redraw. Other generic events are handled as usual.
+	if (ps->present_exists && ev->response_type == XCB_GE_GENERIC) {
+		auto gev = (xcb_ge_generic_event_t *)ev;
+		auto pev = (xcb_present_complete_notify_event_t *)ev;
+		if (gev->extension == ps->present_opcode &&
+		    gev->event_type == XCB_PRESENT_COMPLETE_NOTIFY &&
+		    pev->event == ps->present_eid) {
+			ev_present_complete_notify(ps, pev);
+			return;
+		}
+	}
+
 	// XXX redraw needs to be more fine grained
 	queue_redraw(ps);
 
@@ -1,6 +1,11 @@
 #include <assert.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdalign.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -20,10 +25,98 @@ thread_local struct log *tls_logger;
 
 struct log_target;
 
+/// Number of records in the ring of an asynchronous log, must be a power of 2.
+#define LOG_ASYNC_RING_SIZE 2048
+/// Maximum number of arguments of a message logged asynchronously, including the ones
+/// consumed by `*` widths and precisions.
+#define LOG_ASYNC_MAX_ARGS 8
+/// Space in a record for copies of string arguments. Longer strings are truncated.
+#define LOG_ASYNC_STRING_SPACE 384
+/// Number of call sites whose format strings are cached
+#define LOG_ASYNC_CALL_SITES 256
+/// How long the background thread waits for more messages before writing out what it
+/// has, in nanoseconds.
+#define LOG_ASYNC_BATCH_DELAY 10000000
+
+union log_arg {
+	long long i;
+	double d;
+	const void *p;
+	/// Offset of a copied string in `log_record::strings`
+	size_t str;
+};
+
+/// The arguments a call site's format string takes.
+struct log_call_site {
+	const char *fmt;
+	/// Whether the arguments can be captured, if not the message is formatted right
+	/// away.
+	bool supported;
+	int nargs;
+	/// `enum log_arg_type` of each argument
+	uint8_t types[LOG_ASYNC_MAX_ARGS];
+	/// Precision of each string argument, -1 if there is none, -2 if it's given by
+	/// the previous argument.
+	int precisions[LOG_ASYNC_MAX_ARGS];
+};
+
+/// A message logged asynchronously, before formatting.
+struct log_record {
+	struct timespec ts;
+	int level;
+	/// The format string and the function name, together they identify the call
+	/// site. Both are string literals, so the pointers stay valid. If `fmt` is NULL,
+	/// the message couldn't be captured and was formatted into `strings` instead.
+	const char *fmt;
+	const char *func;
+	union log_arg args[LOG_ASYNC_MAX_ARGS];
+	/// The last byte is always 0, it's used for strings that didn't fit.
+	char strings[LOG_ASYNC_STRING_SPACE + 1];
+};
+
+enum log_async_state {
+	LOG_ASYNC_AWAKE,
+	/// The background thread is waiting a bit for more messages, it only needs to be
+	/// woken up if the ring is filling up.
+	LOG_ASYNC_BATCHING,
+	/// The background thread is waiting for the next message.
+	LOG_ASYNC_ASLEEP,
+};
+
+/// State of an asynchronous log. The thread owning the log is the only producer, and
+/// the background thread is the only consumer, so the ring needs no locks.
+struct log_async {
+	pthread_t thread;
+	/// Posted to wake up the background thread when it's sleeping.
+	sem_t wake;
+	/// A `enum log_async_state`
+	atomic_int state;
+	atomic_bool stop;
+	/// Messages dropped because the ring was full.
+	atomic_uint dropped;
+	/// Parsed format strings, indexed by a hash of the format string's address.
+	/// Only used by the producer.
+	struct log_call_site call_sites[LOG_ASYNC_CALL_SITES];
+
+	// The indices are on their own cache lines, so the producer and the consumer
+	// don't keep stealing them from each other.
+
+	/// Index of the next record to write, only written by the producer.
+	alignas(64) atomic_size_t head;
+	/// The last value of `tail` seen by the producer. The ring has at least this
+	/// much space, so the producer only needs to look at `tail` when it's full.
+	size_t cached_tail;
+	/// Index of the next record to format, only written by the consumer.
+	alignas(64) atomic_size_t tail;
+	alignas(64) struct log_record ring[LOG_ASYNC_RING_SIZE];
+};
+
 struct log {
 	struct log_target *head;
 
 	int log_level;
+	/// Non-NULL if messages are formatted and written by a background thread.
+	struct log_async *async;
 };
 
 struct log_target {
@@ -39,6 +132,11 @@ struct log_ops {
 	/// Additional strings to print around the log_level string
 	const char *(*colorize_begin)(enum log_level);
 	const char *(*colorize_end)(enum log_level);
+
+	/// Whether the target can only be written to from the thread that created it,
+	/// e.g. because it needs that thread's GL context. Such targets are always
+	/// written synchronously.
+	bool thread_bound;
 };
 
 /// Fallback writev for targets don't implement it
@@ -93,11 +191,16 @@ struct log *log_new(void) {
 	auto ret = cmalloc(struct log);
 	ret->log_level = LOG_LEVEL_WARN;
 	ret->head = NULL;
+	ret->async = NULL;
 	return ret;
 }
 
+static void log_async_flush(struct log *l);
+
 void log_add_target(struct log *l, struct log_target *tgt) {
 	assert(tgt->ops->writev);
+	// The background thread walks the target list, wait for it to go idle
+	log_async_flush(l);
 	tgt->next = l->head;
 	l->head = tgt;
 }
@@ -105,6 +208,7 @@ void log_add_target(struct log *l, struct log_target *tgt) {
 /// Remove a previously added log target for a log struct, and destroy it. If the log
 /// target was never added, nothing happens.
 void log_remove_target(struct log *l, struct log_target *tgt) {
+	log_async_flush(l);
 	struct log_target *now = l->head, **prev = &l->head;
 	while (now) {
 		if (now == tgt) {
@@ -119,6 +223,7 @@ void log_remove_target(struct log *l, struct log_target *tgt) {
 
 /// Destroy a log struct and every log target added to it
 void log_destroy(struct log *l) {
+	log_set_async(l, false);
 	// free all tgt
 	struct log_target *head = l->head;
 	while (head) {
@@ -138,45 +243,37 @@ enum log_level log_get_level(const struct log *l) {
 	return l->log_level;
 }
 
-attr_printf(4, 5) void log_printf(struct log *l, int level, const char *func,
-                                  const char *fmt, ...) {
-	assert(level <= LOG_LEVEL_FATAL && level >= 0);
-	if (level < l->log_level)
-		return;
-
-	char *buf = NULL;
-	va_list args;
-
-	va_start(args, fmt);
-	int blen = vasprintf(&buf, fmt, args);
-	va_end(args);
-
-	if (blen < 0 || !buf) {
-		free(buf);
-		return;
-	}
-
-	struct timespec ts;
-	timespec_get(&ts, TIME_UTC);
-	struct tm now;
-	localtime_r(&ts.tv_sec, &now);
-	char time_buf[100];
-	strftime(time_buf, sizeof time_buf, "%x %T", &now);
+/// Which targets of a log a message is written to
+enum log_targets {
+	LOG_TARGETS_ALL,
+	/// Targets that must be written to from the thread owning the log
+	LOG_TARGETS_THREAD_BOUND,
+	/// Targets the background thread of an asynchronous log writes to
+	LOG_TARGETS_ASYNC,
+};
 
-	char *time = NULL;
-	int tlen = asprintf(&time, "%s.%03ld", time_buf, ts.tv_nsec / 1000000);
-	if (tlen < 0 || !time) {
-		free(buf);
-		free(time);
-		return;
+static bool log_target_selected(const struct log_target *tgt, enum log_targets targets) {
+	switch (targets) {
+	case LOG_TARGETS_ALL: return true;
+	case LOG_TARGETS_THREAD_BOUND: return tgt->ops->thread_bound;
+	case LOG_TARGETS_ASYNC: return !tgt->ops->thread_bound;
 	}
+	return false;
+}
 
+/// Write a formatted message to the `targets` of a log.
+static void log_write(struct log *l, enum log_targets targets, int level,
+                      const char *time, size_t tlen, const char *func, const char *buf,
+                      size_t blen) {
 	const char *log_level_str = log_level_to_string(level);
 	size_t llen = strlen(log_level_str);
 	size_t flen = strlen(func);
 
-	struct log_target *head = l->head;
-	while (head) {
+	for (struct log_target *head = l->head; head; head = head->next) {
+		if (!log_target_selected(head, targets)) {
+			continue;
+		}
+
 		const char *p = "", *s = "";
 		size_t plen = 0, slen = 0;
 
@@ -192,7 +289,7 @@ attr_printf(4, 5) void log_printf(struct log *l, int level, const char *func,
 		head->ops->writev(
 		    head,
 		    (struct iovec[]){{.iov_base = "[ ", .iov_len = 2},
-		                     {.iov_base = time, .iov_len = (size_t)tlen},
+		                     {.iov_base = (void *)time, .iov_len = tlen},
 		                     {.iov_base = " ", .iov_len = 1},
 		                     {.iov_base = (void *)func, .iov_len = flen},
 		                     {.iov_base = " ", .iov_len = 1},
@@ -200,15 +297,517 @@ attr_printf(4, 5) void log_printf(struct log *l, int level, const char *func,
 		                     {.iov_base = (void *)log_level_str, .iov_len = llen},
 		                     {.iov_base = (void *)s, .iov_len = slen},
 		                     {.iov_base = " ] ", .iov_len = 3},
-		                     {.iov_base = buf, .iov_len = (size_t)blen},
+		                     {.iov_base = (void *)buf, .iov_len = blen},
 		                     {.iov_base = "\n", .iov_len = 1}},
 		    11);
-		head = head->next;
 	}
-	free(time);
+}
+
+/// Format the time of a log message into `buf`, returns the length of the result.
+static size_t log_format_time(const struct timespec *ts, char *buf, size_t size) {
+	struct tm now;
+	localtime_r(&ts->tv_sec, &now);
+	size_t len = strftime(buf, size, "%x %T", &now);
+	int ret = snprintf(buf + len, size - len, ".%03ld", ts->tv_nsec / 1000000);
+	return min2(len + (size_t)max2(ret, 0), size - 1);
+}
+
+/// Format and write a message to the `targets` of a log on the calling thread.
+static void log_write_sync(struct log *l, enum log_targets targets, int level,
+                           const char *func, const char *fmt, va_list args) {
+	bool any = false;
+	for (struct log_target *head = l->head; head && !any; head = head->next) {
+		any = log_target_selected(head, targets);
+	}
+	if (!any) {
+		return;
+	}
+
+	char *buf = NULL;
+	int blen = vasprintf(&buf, fmt, args);
+	if (blen < 0 || !buf) {
+		free(buf);
+		return;
+	}
+
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	char time[100];
+	auto tlen = log_format_time(&ts, time, sizeof(time));
+
+	log_write(l, targets, level, time, tlen, func, buf, (size_t)blen);
 	free(buf);
 }
 
+enum log_arg_type {
+	/// A conversion that takes no argument, i.e. `%%`
+	LOG_ARG_NONE,
+	LOG_ARG_INT,
+	LOG_ARG_LONG,
+	LOG_ARG_LLONG,
+	LOG_ARG_INTMAX,
+	LOG_ARG_SIZE,
+	LOG_ARG_PTRDIFF,
+	LOG_ARG_DOUBLE,
+	LOG_ARG_POINTER,
+	LOG_ARG_STRING,
+	/// Conversions we can't capture, like `%n` or `%Lf`
+	LOG_ARG_UNSUPPORTED,
+	/// A `*` width or precision
+	LOG_ARG_STAR,
+};
+
+/// A conversion specification in a printf format string.
+struct log_conversion {
+	/// Points to the `%` of the specification
+	const char *start;
+	size_t len;
+	enum log_arg_type type;
+	/// Number of `*` widths and precisions, each takes an extra int argument.
+	int nstars;
+	/// The precision, -1 if there is none or it's given by an argument.
+	int precision;
+	/// Whether the precision is given by an argument, it's the last `*` then.
+	bool precision_star;
+};
+
+/// Find the next conversion specification in `fmt`. Returns false if there is none.
+static bool log_next_conversion(const char *fmt, struct log_conversion *c) {
+	const char *p = strchr(fmt, '%');
+	if (!p) {
+		return false;
+	}
+	c->start = p++;
+	c->nstars = 0;
+	c->precision = -1;
+	c->precision_star = false;
+
+	p += strspn(p, "-+ #0'");
+	if (*p == '*') {
+		c->nstars++;
+		p++;
+	} else {
+		p += strspn(p, "0123456789");
+	}
+	if (*p == '.') {
+		p++;
+		if (*p == '*') {
+			c->nstars++;
+			c->precision_star = true;
+			p++;
+		} else {
+			c->precision = atoi(p);
+			p += strspn(p, "0123456789");
+		}
+	}
+
+	int nlongs = 0;
+	char modifier = 0;
+	for (; *p && strchr("hlLjzt", *p); p++) {
+		nlongs += *p == 'l';
+		modifier = *p;
+	}
+
+	switch (*p) {
+	case 'd':
+	case 'i':
+	case 'u':
+	case 'x':
+	case 'X':
+	case 'o':
+	case 'c':
+		switch (modifier) {
+		case 0:
+		case 'h': c->type = LOG_ARG_INT; break;
+		case 'l': c->type = nlongs == 1 ? LOG_ARG_LONG : LOG_ARG_LLONG; break;
+		case 'j': c->type = LOG_ARG_INTMAX; break;
+		case 'z': c->type = LOG_ARG_SIZE; break;
+		case 't': c->type = LOG_ARG_PTRDIFF; break;
+		default: c->type = LOG_ARG_UNSUPPORTED; break;
+		}
+		if (*p == 'c' && modifier) {
+			// Wide characters
+			c->type = LOG_ARG_UNSUPPORTED;
+		}
+		break;
+	case 'f':
+	case 'F':
+	case 'e':
+	case 'E':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+		c->type = modifier == 0 || modifier == 'l' ? LOG_ARG_DOUBLE
+		                                           : LOG_ARG_UNSUPPORTED;
+		break;
+	case 'p': c->type = LOG_ARG_POINTER; break;
+	case 's': c->type = modifier ? LOG_ARG_UNSUPPORTED : LOG_ARG_STRING; break;
+	case '%': c->type = LOG_ARG_NONE; break;
+	default: c->type = LOG_ARG_UNSUPPORTED; break;
+	}
+	if (*p) {
+		p++;
+	}
+	c->len = (size_t)(p - c->start);
+	return true;
+}
+
+/// Parse the format string of a call site, to find out the types of its arguments.
+static void log_call_site_init(struct log_call_site *site, const char *fmt) {
+	site->fmt = fmt;
+	site->supported = true;
+	site->nargs = 0;
+
+	struct log_conversion c;
+	for (const char *p = fmt; log_next_conversion(p, &c); p = c.start + c.len) {
+		if (c.type == LOG_ARG_NONE) {
+			continue;
+		}
+		if (c.type == LOG_ARG_UNSUPPORTED ||
+		    site->nargs + c.nstars >= LOG_ASYNC_MAX_ARGS) {
+			site->supported = false;
+			return;
+		}
+		for (int i = 0; i < c.nstars; i++) {
+			site->types[site->nargs++] = LOG_ARG_STAR;
+		}
+		site->precisions[site->nargs] = c.precision_star ? -2 : c.precision;
+		site->types[site->nargs++] = (uint8_t)c.type;
+	}
+}
+
+/// Copy the arguments of a message into `r`, without formatting it. Returns false if
+/// the message has arguments we can't capture.
+static bool log_capture_args(struct log_record *r, const struct log_call_site *site,
+                             va_list args) {
+	if (!site->supported) {
+		return false;
+	}
+
+	size_t used = 0;
+	for (int i = 0; i < site->nargs; i++) {
+		auto arg = &r->args[i];
+		switch ((enum log_arg_type)site->types[i]) {
+		case LOG_ARG_STAR:
+		case LOG_ARG_INT: arg->i = va_arg(args, int); break;
+		case LOG_ARG_LONG: arg->i = va_arg(args, long); break;
+		case LOG_ARG_LLONG: arg->i = va_arg(args, long long); break;
+		case LOG_ARG_INTMAX: arg->i = va_arg(args, intmax_t); break;
+		case LOG_ARG_SIZE: arg->i = (long long)va_arg(args, size_t); break;
+		case LOG_ARG_PTRDIFF: arg->i = va_arg(args, ptrdiff_t); break;
+		case LOG_ARG_DOUBLE: arg->d = va_arg(args, double); break;
+		case LOG_ARG_POINTER: arg->p = va_arg(args, void *); break;
+		case LOG_ARG_STRING: {
+			const char *s = va_arg(args, const char *);
+			if (!s) {
+				s = "(null)";
+			}
+			if (used == LOG_ASYNC_STRING_SPACE) {
+				// Out of space, point to the terminating 0
+				arg->str = LOG_ASYNC_STRING_SPACE;
+				break;
+			}
+			// Don't read past the precision, the string doesn't have to be
+			// terminated then
+			size_t max_len = LOG_ASYNC_STRING_SPACE - used - 1;
+			int precision = site->precisions[i];
+			if (precision == -2) {
+				precision = (int)r->args[i - 1].i;
+			}
+			if (precision >= 0) {
+				max_len = min2(max_len, (size_t)precision);
+			}
+			size_t len = strnlen(s, max_len);
+			memcpy(r->strings + used, s, len);
+			r->strings[used + len] = '\0';
+			arg->str = used;
+			used += len + 1;
+			break;
+		}
+		case LOG_ARG_NONE:
+		case LOG_ARG_UNSUPPORTED: unreachable;
+		}
+	}
+	return true;
+}
+
+// The format strings are checked by the compiler when the messages are logged
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+
+/// Format one conversion specification of a captured message. `spec` is the
+/// specification, `stars` the values of its `*` widths and precisions. Returns the
+/// would-be length of the output, like snprintf.
+static int log_format_arg(char *buf, size_t size, const char *spec, const int *stars,
+                          int nstars, enum log_arg_type type, const union log_arg *arg,
+                          const char *strings) {
+#define FORMAT(value)                                                                    \
+	(nstars == 0   ? snprintf(buf, size, spec, value)                                \
+	 : nstars == 1 ? snprintf(buf, size, spec, stars[0], value)                      \
+	               : snprintf(buf, size, spec, stars[0], stars[1], value))
+	switch (type) {
+	case LOG_ARG_INT: return FORMAT((int)arg->i);
+	case LOG_ARG_LONG: return FORMAT((long)arg->i);
+	case LOG_ARG_LLONG: return FORMAT(arg->i);
+	case LOG_ARG_INTMAX: return FORMAT((intmax_t)arg->i);
+	case LOG_ARG_SIZE: return FORMAT((size_t)arg->i);
+	case LOG_ARG_PTRDIFF: return FORMAT((ptrdiff_t)arg->i);
+	case LOG_ARG_DOUBLE: return FORMAT(arg->d);
+	case LOG_ARG_POINTER: return FORMAT(arg->p);
+	case LOG_ARG_STRING: return FORMAT(strings + arg->str);
+	case LOG_ARG_NONE: return snprintf(buf, size, "%%");
+	case LOG_ARG_UNSUPPORTED:
+	case LOG_ARG_STAR: break;
+	}
+	return 0;
+#undef FORMAT
+}
+
+#pragma GCC diagnostic pop
+
+/// Format a captured message into `buf`, returns the length of the result.
+static size_t log_format_record(const struct log_record *r, char *buf, size_t size) {
+	if (!r->fmt) {
+		return strlen(strcpy(buf, r->strings));
+	}
+
+	size_t len = 0;
+	int nargs = 0;
+	const char *p = r->fmt;
+	struct log_conversion c;
+	while (len < size - 1) {
+		bool found = log_next_conversion(p, &c);
+		// Copy the text before the conversion
+		size_t text_len = found ? (size_t)(c.start - p) : strlen(p);
+		text_len = min2(text_len, size - 1 - len);
+		memcpy(buf + len, p, text_len);
+		len += text_len;
+		if (!found) {
+			break;
+		}
+
+		char spec[32];
+		if (c.len >= sizeof(spec)) {
+			// We can't be bothered with 20 digit widths
+			break;
+		}
+		memcpy(spec, c.start, c.len);
+		spec[c.len] = '\0';
+
+		int stars[2];
+		for (int i = 0; i < c.nstars; i++) {
+			stars[i] = (int)r->args[nargs++].i;
+		}
+		const union log_arg *arg = NULL;
+		if (c.type != LOG_ARG_NONE) {
+			arg = &r->args[nargs++];
+		}
+		int ret = log_format_arg(buf + len, size - len, spec, stars, c.nstars,
+		                         c.type, arg, r->strings);
+		len = min2(len + (size_t)max2(ret, 0), size - 1);
+		p = c.start + c.len;
+	}
+	buf[len] = '\0';
+	return len;
+}
+
+static void *log_async_thread(void *data) {
+	struct log *l = data;
+	auto a = l->async;
+	char buf[4096];
+	char time[100];
+	size_t tlen = 0;
+	time_t time_sec = -1;
+	bool idle = false;
+
+	while (true) {
+		size_t tail = atomic_load_explicit(&a->tail, memory_order_relaxed);
+		if (tail == atomic_load_explicit(&a->head, memory_order_acquire)) {
+			if (atomic_load(&a->stop)) {
+				break;
+			}
+			// Wait a bit for more messages, so a burst of messages doesn't
+			// wake us up once for each of them. Only if nothing came, sleep
+			// until the next message. Check the ring again after setting the
+			// state, for messages pushed before the producer could see it.
+			auto state = idle ? LOG_ASYNC_ASLEEP : LOG_ASYNC_BATCHING;
+			atomic_store(&a->state, state);
+			if (tail == atomic_load(&a->head) && !atomic_load(&a->stop)) {
+				if (state == LOG_ASYNC_BATCHING) {
+					struct timespec deadline;
+					clock_gettime(CLOCK_REALTIME, &deadline);
+					deadline.tv_nsec += LOG_ASYNC_BATCH_DELAY;
+					deadline.tv_sec += deadline.tv_nsec / 1000000000;
+					deadline.tv_nsec %= 1000000000;
+					sem_timedwait(&a->wake, &deadline);
+				} else {
+					sem_wait(&a->wake);
+				}
+			}
+			atomic_store(&a->state, LOG_ASYNC_AWAKE);
+			idle = tail == atomic_load(&a->head);
+			continue;
+		}
+
+		auto r = &a->ring[tail % LOG_ASYNC_RING_SIZE];
+		if (r->ts.tv_sec != time_sec) {
+			tlen = log_format_time(&r->ts, time, sizeof(time));
+			time_sec = r->ts.tv_sec;
+		} else {
+			// Only the milliseconds changed
+			auto ms = r->ts.tv_nsec / 1000000;
+			time[tlen - 3] = (char)('0' + ms / 100);
+			time[tlen - 2] = (char)('0' + ms / 10 % 10);
+			time[tlen - 1] = (char)('0' + ms % 10);
+		}
+
+		auto dropped = atomic_exchange(&a->dropped, 0);
+		if (dropped) {
+			auto len = snprintf(buf, sizeof(buf),
+			                    "%u log messages dropped, the ring was full",
+			                    dropped);
+			log_write(l, LOG_TARGETS_ASYNC, LOG_LEVEL_WARN, time, tlen,
+			          __func__, buf, min2((size_t)len, sizeof(buf) - 1));
+		}
+
+		auto len = log_format_record(r, buf, sizeof(buf));
+		log_write(l, LOG_TARGETS_ASYNC, r->level, time, tlen, r->func, buf, len);
+
+		atomic_store_explicit(&a->tail, tail + 1, memory_order_release);
+	}
+	return NULL;
+}
+
+/// Wake up the background thread if it's sleeping. If `urgent` is false, it's only
+/// woken up from batching if the ring is half full.
+static void log_async_wake(struct log_async *a, bool urgent) {
+	auto state = atomic_load(&a->state);
+	if (state == LOG_ASYNC_AWAKE) {
+		return;
+	}
+	if (state == LOG_ASYNC_BATCHING && !urgent &&
+	    atomic_load_explicit(&a->head, memory_order_relaxed) -
+	            atomic_load_explicit(&a->tail, memory_order_relaxed) <
+	        LOG_ASYNC_RING_SIZE / 2) {
+		return;
+	}
+	if (atomic_exchange(&a->state, LOG_ASYNC_AWAKE) != LOG_ASYNC_AWAKE) {
+		sem_post(&a->wake);
+	}
+}
+
+/// Wait until the background thread has written every queued message.
+static void log_async_flush(struct log *l) {
+	if (!l->async) {
+		return;
+	}
+	auto a = l->async;
+	auto head = atomic_load_explicit(&a->head, memory_order_relaxed);
+	while (atomic_load_explicit(&a->tail, memory_order_acquire) != head) {
+		log_async_wake(a, true);
+		nanosleep(&(struct timespec){.tv_nsec = 100000}, NULL);
+	}
+}
+
+bool log_set_async(struct log *l, bool async) {
+	if (async == (l->async != NULL)) {
+		return true;
+	}
+
+	if (!async) {
+		auto a = l->async;
+		atomic_store(&a->stop, true);
+		sem_post(&a->wake);
+		// The thread writes out everything queued before it stops
+		pthread_join(a->thread, NULL);
+		sem_destroy(&a->wake);
+		free(a);
+		l->async = NULL;
+		return true;
+	}
+
+	struct log_async *a = aligned_alloc(alignof(struct log_async), sizeof(*a));
+	if (!a) {
+		return false;
+	}
+	memset(a, 0, sizeof(*a));
+	sem_init(&a->wake, 0, 0);
+	atomic_init(&a->state, LOG_ASYNC_AWAKE);
+	atomic_init(&a->stop, false);
+	atomic_init(&a->head, 0);
+	atomic_init(&a->tail, 0);
+	atomic_init(&a->dropped, 0);
+	l->async = a;
+	if (pthread_create(&a->thread, NULL, log_async_thread, l) != 0) {
+		l->async = NULL;
+		sem_destroy(&a->wake);
+		free(a);
+		return false;
+	}
+	return true;
+}
+
+/// Queue a message for the background thread.
+static void log_printf_async(struct log *l, int level, const char *func,
+                             const char *fmt, va_list args) {
+	auto a = l->async;
+	auto head = atomic_load_explicit(&a->head, memory_order_relaxed);
+	if (head - a->cached_tail >= LOG_ASYNC_RING_SIZE) {
+		a->cached_tail = atomic_load_explicit(&a->tail, memory_order_acquire);
+		if (head - a->cached_tail >= LOG_ASYNC_RING_SIZE) {
+			atomic_fetch_add_explicit(&a->dropped, 1, memory_order_relaxed);
+			return;
+		}
+	}
+
+	auto r = &a->ring[head % LOG_ASYNC_RING_SIZE];
+	clock_gettime(CLOCK_REALTIME, &r->ts);
+	r->level = level;
+	r->func = func;
+	r->fmt = fmt;
+	r->strings[LOG_ASYNC_STRING_SPACE] = '\0';
+
+	va_list args_copy;
+	va_copy(args_copy, args);
+	auto site = &a->call_sites[((uintptr_t)fmt >> 3) % LOG_ASYNC_CALL_SITES];
+	if (site->fmt != fmt) {
+		log_call_site_init(site, fmt);
+	}
+	if (!log_capture_args(r, site, args_copy)) {
+		// Fall back to formatting the message here
+		r->fmt = NULL;
+		vsnprintf(r->strings, sizeof(r->strings), fmt, args);
+	}
+	va_end(args_copy);
+
+	atomic_store(&a->head, head + 1);
+	log_async_wake(a, false);
+}
+
+attr_printf(4, 5) void log_printf(struct log *l, int level, const char *func,
+                                  const char *fmt, ...) {
+	assert(level <= LOG_LEVEL_FATAL && level >= 0);
+	if (level < l->log_level)
+		return;
+
+	va_list args;
+	va_start(args, fmt);
+	if (l->async && level < LOG_LEVEL_ERROR) {
+		va_list args_copy;
+		va_copy(args_copy, args);
+		log_printf_async(l, level, func, fmt, args_copy);
+		va_end(args_copy);
+		log_write_sync(l, LOG_TARGETS_THREAD_BOUND, level, func, fmt, args);
+	} else {
+		// Errors are written right away, after everything queued before them,
+		// we might be about to exit or crash.
+		log_async_flush(l);
+		log_write_sync(l, LOG_TARGETS_ALL, level, func, fmt, args);
+	}
+	va_end(args);
+}
+
 /// A trivial deinitializer that simply frees the memory
 static attr_unused void logger_trivial_destroy(struct log_target *tgt) {
 	free(tgt);
@@ -347,6 +946,8 @@ static const struct log_ops gl_string_marker_logger_ops = {
     .write = gl_string_marker_logger_write,
     .writev = log_default_writev,
     .destroy = logger_trivial_destroy,
+    // The marker goes into the GL command stream of the current context
+    .thread_bound = true,
 };
 
 struct log_target *gl_string_marker_logger_new(void) {
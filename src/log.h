@@ -3,6 +3,7 @@
 
 #pragma once
 #include <assert.h>
+#include <stdbool.h>
 #include <stdio.h>
 
 #include "compiler.h"
@@ -55,6 +56,10 @@ attr_pure enum log_level string_to_log_level(const char *);
 /// Remove a previously added log target for a log struct, and destroy it. If the log
 /// target was never added, nothing happens.
 void log_remove_target(struct log *l, struct log_target *tgt);
+/// Switch a log struct to or from asynchronous mode. In asynchronous mode, messages
+/// below the error level are captured unformatted into a ring buffer, and formatted
+/// and written by a background thread. Returns false if the thread can't be started.
+attr_nonnull_all bool log_set_async(struct log *l, bool async);
 
 extern thread_local struct log *tls_logger;
 
@@ -77,6 +82,11 @@ static inline attr_nonnull_all void log_remove_target_tls(struct log_target *tgt
 	log_remove_target(tls_logger, tgt);
 }
 
+static inline bool log_set_async_tls(bool async) {
+	assert(tls_logger);
+	return log_set_async(tls_logger, async);
+}
+
 static inline attr_pure enum log_level log_get_level_tls(void) {
 	assert(tls_logger);
 	return log_get_level(tls_logger);
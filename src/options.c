@@ -35,13 +35,35 @@ static const struct picom_option picom_options[] = {
     {"daemon"                      , no_argument      , 'b', NULL          , "Daemonize process."},
     {"backend"                     , required_argument, 290, NULL          , "Backend. Only possible value is `glx`"},
     {"glx-no-stencil"              , no_argument      , 291, NULL          , NULL},
+    {"glx-no-error"                , no_argument      , 326, NULL          , "Ask the driver for an OpenGL context that skips error checking. GL "
+                                                                             "errors are undefined behavior then, only use with a setup known to work."},
+    {"benchmark"                   , required_argument, 293, "CYCLES"      , "Benchmark mode. Repeatedly paint until reaching the specified cycles, "
+                                                                             "print the frame time distribution, then exit."},
+    {"benchmark-wid"               , required_argument, 294, "WINDOW_ID"   , "Specify window ID to repaint in benchmark mode. If omitted or is 0, "
+                                                                             "the whole screen is repainted."},
+    {"trace-file"                  , required_argument, 295, "PATH"        , "Write a trace of the compositor's activity in the Chrome trace event "
+                                                                             "format to PATH. Can be viewed with https://ui.perfetto.dev."},
+    {"x-roundtrip-budget"          , required_argument, 296, "MICROSECONDS", "Warn about call sites that spend more than this time waiting for "
+                                                                             "the X server in one frame. 0 disables the warning. Defaults to "
+                                                                             "4000."},
+    {"control-socket"              , no_argument      , 297, NULL          , "Listen on a control socket under $XDG_RUNTIME_DIR, which serves "
+                                                                             "live metrics and accepts runtime settings."},
     {"glx-no-rebind-pixmap"        , no_argument      , 298, NULL          , NULL},
+    {"record-events"               , required_argument, 299, "PATH"        , "Record the X events handled by the compositor to PATH, to be played "
+                                                                             "back with xreplay."},
+    {"compose-strategy"            , required_argument, 324, "STRATEGY"    , "How windows are composed, `region` (default) clips windows to their "
+                                                                             "visible parts, `depth` lets the GPU reject covered pixels with a "
+                                                                             "depth buffer."},
+    {"atlas-max-size"              , required_argument, 325, "PIXELS"      , "Compose windows up to this size from a shared texture atlas, so they "
+                                                                             "don't each need a texture binding. 0 disables the atlas. Default 256."},
     {"xrender-sync-fence"          , no_argument      , 313, NULL          , "Additionally use X Sync fence to sync clients' draw calls. Needed on "
                                                                              "nvidia-drivers with GLX backend for some users."},
     {"show-all-xerrors"            , no_argument      , 314, NULL          , NULL},
     {"version"                     , no_argument      , 318, NULL          , "Print version number and exit."},
     {"log-level"                   , required_argument, 321, NULL          , "Log level, possible values are: trace, debug, info, warn, error"},
     {"log-file"                    , required_argument, 322, NULL          , "Path to the log file."},
+    {"log-async"                   , no_argument      , 323, NULL          , "Format and write log messages on a background thread, so logging "
+                                                                             "doesn't slow down rendering. Errors are still written right away."},
 };
 // clang-format on
 
@@ -262,6 +284,7 @@ bool get_cfg(options_t *opt, int argc, char *const *argv, win_option_mask_t *win
 			free(opt->logpath);
 			opt->logpath = strdup(optarg);
 			break;
+		P_CASEBOOL(323, log_async);
 		case 290:
 			// --backend
 			opt->backend = parse_backend(optarg);
@@ -269,8 +292,33 @@ bool get_cfg(options_t *opt, int argc, char *const *argv, win_option_mask_t *win
 				exit(1);
 			break;
 		P_CASEBOOL(291, glx_no_stencil);
+		P_CASEINT(293, benchmark);
+		case 294:
+			// --benchmark-wid
+			opt->benchmark_wid = (xcb_window_t)strtol(optarg, NULL, 0);
+			break;
+		case 295:
+			// --trace-file
+			free(opt->trace_path);
+			opt->trace_path = strdup(optarg);
+			break;
+		P_CASEINT(296, x_roundtrip_budget);
+		P_CASEBOOL(297, control_socket);
 		P_CASEBOOL(298, glx_no_rebind_pixmap);
+		P_CASEBOOL(326, glx_no_error);
+		case 299:
+			// --record-events
+			free(opt->record_path);
+			opt->record_path = strdup(optarg);
+			break;
 		P_CASEBOOL(313, xrender_sync_fence);
+		case 324:
+			// --compose-strategy
+			opt->compose_strategy = parse_compose_strategy(optarg);
+			if (opt->compose_strategy >= NUM_COMPOSE_STRATEGIES)
+				exit(1);
+			break;
+		P_CASEINT(325, atlas_max_size);
 		case 321: {
 			enum log_level tmp_level = string_to_log_level(optarg);
 			if (tmp_level == LOG_LEVEL_INVALID) {
@@ -34,6 +34,7 @@
 #include "backend/backend.h"
 #include "common.h"
 #include "compiler.h"
+#include "control.h"
 #include "err.h"
 #include "event.h"
 #include "list.h"
@@ -41,8 +42,10 @@
 #include "opengl.h"
 #include "options.h"
 #include "picom.h"
+#include "record.h"
 #include "region.h"
 #include "render.h"
+#include "trace.h"
 #include "types.h"
 #include "uthash_extra.h"
 #include "utils.h"
@@ -72,6 +75,10 @@ const char *const WINTYPES[NUM_WINTYPES] = {
 // clang-format off
 /// Names of backends.
 const char *const BACKEND_STRS[] = {[BKEND_GLX] = "glx", NULL};
+
+/// Names of compose strategies.
+const char *const COMPOSE_STRATEGY_STRS[] = {
+    [COMPOSE_STRATEGY_REGION] = "region", [COMPOSE_STRATEGY_DEPTH] = "depth", NULL};
 // clang-format on
 
 // === Global variables ===
@@ -108,7 +115,8 @@ static inline bool dpms_screen_is_off(xcb_dpms_info_reply_t *info) {
 
 void check_dpms_status(EV_P attr_unused, ev_timer *w, int revents attr_unused) {
 	auto ps = session_ptr(w, dpms_check_timer);
-	auto r = xcb_dpms_info_reply(ps->c, xcb_dpms_info(ps->c), NULL);
+	auto r = X_ROUNDTRIP("xcb_dpms_info",
+	                     xcb_dpms_info_reply(ps->c, xcb_dpms_info(ps->c), NULL));
 	if (!r) {
 		log_fatal("Failed to query DPMS status.");
 		abort();
@@ -185,6 +193,17 @@ void discard_pending(session_t *ps, uint32_t sequence) {
 	}
 }
 
+static void destroy_sync_fences(session_t *ps) {
+	for (int i = 0; i < SYNC_FENCE_COUNT; i++) {
+		if (ps->sync_fences[i] != XCB_NONE) {
+			xcb_sync_destroy_fence(ps->c, ps->sync_fences[i]);
+			ps->sync_fences[i] = XCB_NONE;
+		}
+	}
+	ps->sync_fences_triggered = 0;
+	ps->sync_fence_index = 0;
+}
+
 static void handle_error(session_t *ps, xcb_generic_error_t *ev) {
 	if (ps == NULL) {
 		// Do not ignore errors until the session has been initialized
@@ -202,6 +221,17 @@ static void handle_error(session_t *ps, xcb_generic_error_t *ev) {
 			abort();
 		case PENDING_REPLY_ACTION_DEBUG_ABORT: assert(false); break;
 		case PENDING_REPLY_ACTION_IGNORE: break;
+		case PENDING_REPLY_ACTION_DISABLE_SYNC_FENCE:
+			// Requests already sent for the other fences can fail too
+			if (ps->xsync_exists) {
+				log_error("X Sync fence request failed, "
+				          "xrender-sync-fence will be disabled from now "
+				          "on.");
+				destroy_sync_fences(ps);
+				ps->o.xrender_sync_fence = false;
+				ps->xsync_exists = false;
+			}
+			break;
 		}
 		return;
 	}
@@ -245,8 +275,9 @@ static void recheck_focus(session_t *ps) {
 	// Determine the currently focused window so we can apply appropriate
 	// opacity on it
 	xcb_window_t wid = XCB_NONE;
-	xcb_get_input_focus_reply_t *reply =
-	    xcb_get_input_focus_reply(ps->c, xcb_get_input_focus(ps->c), NULL);
+	xcb_get_input_focus_reply_t *reply = X_ROUNDTRIP(
+	    "xcb_get_input_focus",
+	    xcb_get_input_focus_reply(ps->c, xcb_get_input_focus(ps->c), NULL));
 
 	if (reply) {
 		wid = reply->focus;
@@ -282,6 +313,12 @@ static void destroy_backend(session_t *ps) {
 			// `w` is freed by win_skip_fading
 			continue;
 		}
+		if (ps->backend_data && w->state == WSTATE_MAPPED) {
+			// A pending rebind is moot, the next backend binds all images
+			// again
+			win_clear_flags(w, WIN_FLAGS_IMAGES_STALE);
+			win_release_images(ps->backend_data, w);
+		}
 		free_paint(ps, &w->paint);
 	}
 
@@ -305,15 +342,14 @@ static void destroy_backend(session_t *ps) {
 	}
 }
 
-/// Init the backend and bind all the window pixmap to backend images
-static bool initialize_backend(session_t *ps) {
+/// Init the backend and mark all the window images for binding. Returns false if the
+/// backend can't be created.
+static bool try_initialize_backend(session_t *ps) {
 	assert(!ps->backend_data);
 	// Reinitialize win_data
 	assert(backend_list[ps->o.backend]);
 	ps->backend_data = backend_list[ps->o.backend]->init(ps);
 	if (!ps->backend_data) {
-		log_fatal("Failed to initialize backend, aborting...");
-		quit(ps);
 		return false;
 	}
 	ps->backend_data->ops = backend_list[ps->o.backend];
@@ -343,7 +379,7 @@ static bool initialize_backend(session_t *ps) {
 	// window_stack shouldn't include window that's
 	// not in the hash table at this point. Since
 	// there cannot be any fading windows.
-	HASH_ITER2(ps->windows, _w) {
+	xid_map_foreach(&ps->windows, struct win, _w) {
 		if (!_w->managed) {
 			continue;
 		}
@@ -361,6 +397,93 @@ static bool initialize_backend(session_t *ps) {
 	return true;
 }
 
+/// Init the backend, quit if that fails.
+static bool initialize_backend(session_t *ps) {
+	if (!try_initialize_backend(ps)) {
+		log_fatal("Failed to initialize backend, aborting...");
+		quit(ps);
+		return false;
+	}
+	return true;
+}
+
+/// Forget the damage of previous frames, for when the back buffer content is lost.
+static void clear_damage_ring(session_t *ps) {
+	for (int i = 0; i < ps->ndamage; i++) {
+		pixman_region32_clear(&ps->damage_ring[i]);
+	}
+	ps->damage = ps->damage_ring + ps->ndamage - 1;
+}
+
+static inline bool device_reset_in_progress(session_t *ps) {
+	return ev_is_active(&ps->device_reset_timer);
+}
+
+/// Give up after this many attempts to create the backend, and reset the session
+#define DEVICE_RESET_MAX_ATTEMPTS 8
+
+void handle_device_reset(session_t *ps) {
+	if (device_reset_in_progress(ps)) {
+		return;
+	}
+	log_error("Device reset detected");
+	// The context is lost, everything created in it is gone. Release the images
+	// now, they are bound again once there is a new context. The window tree and
+	// the rest of the session are kept.
+	destroy_backend(ps);
+	ps->device_reset_attempts = 0;
+	ev_timer_set(&ps->device_reset_timer, 0.1, 0);
+	ev_timer_start(ps->loop, &ps->device_reset_timer);
+}
+
+/// Try to create the backend again after a device reset.
+///
+/// A new context might not be usable while the reset is still in progress, so
+/// its device status is checked, and it is retried with exponential backoff if
+/// not normal. The status of the lost context can't be relied on, according to
+/// ARB_robustness:
+///
+///     "If a reset status other than NO_ERROR is returned and subsequent
+///     calls return NO_ERROR, the context reset was encountered and
+///     completed. If a reset status is repeatedly returned, the context **may**
+///     be in the process of resetting."
+///
+/// e.g. Mesa keeps returning CONTEXT_RESET on AMDGPU devices after the reset has
+/// completed.
+static void
+device_reset_callback(EV_P attr_unused, ev_timer *w, int revents attr_unused) {
+	auto ps = session_ptr(w, device_reset_timer);
+	assert(ps->redirected && !ps->backend_data);
+
+	if (try_initialize_backend(ps)) {
+		auto device_status = ps->backend_data->ops->device_status;
+		if (!device_status ||
+		    device_status(ps->backend_data) == DEVICE_STATUS_NORMAL) {
+			log_info("Recovered from device reset after %d attempt(s)",
+			         ps->device_reset_attempts + 1);
+			clear_damage_ring(ps);
+			ps->nframes_in_flight = 0;
+			ps->first_frame = true;
+			root_damaged(ps);
+			force_repaint(ps);
+			queue_redraw(ps);
+			return;
+		}
+		destroy_backend(ps);
+	}
+
+	ps->device_reset_attempts++;
+	if (ps->device_reset_attempts >= DEVICE_RESET_MAX_ATTEMPTS) {
+		log_error("Failed to recover from device reset, resetting picom");
+		ev_break(ps->loop, EVBREAK_ALL);
+		return;
+	}
+	double delay = min2(0.1 * (1 << ps->device_reset_attempts), 5.0);
+	log_debug("Device is still resetting, retrying in %.1fs", delay);
+	ev_timer_set(&ps->device_reset_timer, delay, 0);
+	ev_timer_start(ps->loop, &ps->device_reset_timer);
+}
+
 /// Handle configure event of the root window
 static void configure_root(session_t *ps) {
 	auto r = XCB_AWAIT(xcb_get_geometry, ps->c, ps->root);
@@ -371,7 +494,10 @@ static void configure_root(session_t *ps) {
 
 	log_info("Root configuration changed, new geometry: %dx%d", r->width, r->height);
 	bool has_root_change = false;
-	if (ps->redirected) {
+	// While recovering from a device reset there is no backend, the new one is
+	// created with the new size.
+	bool has_backend = ps->redirected && !device_reset_in_progress(ps);
+	if (has_backend) {
 		// On root window changes
 		assert(ps->backend_data);
 		has_root_change = ps->backend_data->ops->root_change != NULL;
@@ -396,16 +522,12 @@ static void configure_root(session_t *ps) {
 		top_w->reg_ignore_valid = false;
 	}
 
-	if (ps->redirected) {
-		for (int i = 0; i < ps->ndamage; i++) {
-			pixman_region32_clear(&ps->damage_ring[i]);
-		}
-		ps->damage = ps->damage_ring + ps->ndamage - 1;
+	if (has_backend) {
+		clear_damage_ring(ps);
 		if (has_root_change) {
-			if (ps->backend_data != NULL) {
-				ps->backend_data->ops->root_change(ps->backend_data, ps);
-			}
-			// Old backend's root_change is not a specific function
+			// The window images and the root image stay bound. If the root
+			// pixmap changed too, the property change takes care of it.
+			ps->backend_data->ops->root_change(ps->backend_data, ps);
 		} else {
 			if (!initialize_backend(ps)) {
 				log_fatal("Failed to re-initialize backend after root "
@@ -493,7 +615,7 @@ static struct managed_win *paint_preprocess(session_t *ps) {
 			          "not received any damages",
 			          w->base.id, w->name);
 			to_paint = false;
-		} else if (unlikely(w->g.x + w->g.width < 1 || w->g.y + w->g.height < 1 ||
+		} else if (unlikely(w->g.x + w->width < 1 || w->g.y + w->height < 1 ||
 		                    w->g.x >= ps->root_width || w->g.y >= ps->root_height)) {
 			log_trace("Window %#010x (%s) will not be painted because it is "
 			          "positioned outside of the screen",
@@ -531,15 +653,7 @@ static struct managed_win *paint_preprocess(session_t *ps) {
 		if (w->mode != WMODE_TRANS) {
 			// w->mode == WMODE_SOLID or WMODE_FRAME_TRANS
 			region_t *tmp = rc_region_new();
-			if (w->mode == WMODE_SOLID) {
-				*tmp = win_get_bounding_shape_global_by_val(w);
-			} else {
-				// w->mode == WMODE_FRAME_TRANS
-				win_get_region_noframe_local(w, tmp);
-				pixman_region32_intersect(tmp, tmp, &w->bounding_shape);
-				pixman_region32_translate(tmp, w->g.x, w->g.y);
-			}
-
+			win_get_opaque_region_global(w, tmp);
 			pixman_region32_union(tmp, tmp, last_reg_ignore);
 			rc_region_unref(&last_reg_ignore);
 			last_reg_ignore = tmp;
@@ -566,8 +680,8 @@ static struct managed_win *paint_preprocess(session_t *ps) {
 	rc_region_unref(&last_reg_ignore);
 
 	// If possible, unredirect all windows and stop painting
-	if (ps->screen_is_off) {
-		// Screen is off, unredirect
+	if (ps->screen_is_off || ps->unredirect_forced) {
+		// Screen is off, or we are asked to, unredirect
 		// We do this unconditionally because we need to workaround
 		// problems X server has around screen off.
 		//
@@ -832,6 +946,65 @@ uint8_t session_redirection_mode(session_t *ps) {
 	return XCB_COMPOSITE_REDIRECT_MANUAL;
 }
 
+static void
+damage_latency_add(session_t *ps, uint64_t damage_time, uint64_t complete_time) {
+	if (!damage_time) {
+		// Frame wasn't caused by damage, e.g. a forced repaint
+		return;
+	}
+	auto now = get_time_ns();
+	if (complete_time < damage_time || complete_time > now) {
+		// The X server's clock is not comparable to ours, e.g. it is on
+		// another machine.
+		complete_time = now;
+	}
+	auto latency = complete_time - damage_time;
+	log_trace("Damage to present latency: %.3f ms", (double)latency / 1e6);
+	if (ps->o.benchmark) {
+		sample_stats_add(&ps->damage_latencies, latency);
+	}
+}
+
+void damage_latency_frame_presented(session_t *ps) {
+	auto damage_time = ps->damage_time;
+	ps->damage_time = 0;
+	if (!ps->present_complete_seen) {
+		// Either the X server doesn't support Present, or the backend doesn't
+		// present with it. The best we can do is the return of present.
+		damage_latency_add(ps, damage_time, get_time_ns());
+		return;
+	}
+
+	if (ps->nframes_in_flight == MAX_FRAMES_IN_FLIGHT) {
+		// Drop the oldest frame, we must have missed its completion
+		ps->frames_in_flight_head =
+		    (ps->frames_in_flight_head + 1) % MAX_FRAMES_IN_FLIGHT;
+		ps->nframes_in_flight--;
+	}
+	auto tail =
+	    (ps->frames_in_flight_head + ps->nframes_in_flight) % MAX_FRAMES_IN_FLIGHT;
+	ps->frames_in_flight[tail] = damage_time;
+	ps->nframes_in_flight++;
+}
+
+void damage_latency_frame_completed(session_t *ps, uint64_t complete_time) {
+	if (!ps->present_complete_seen) {
+		// The frame that just completed has already been accounted for when it
+		// was presented.
+		ps->present_complete_seen = true;
+		return;
+	}
+	if (ps->nframes_in_flight == 0) {
+		return;
+	}
+
+	auto damage_time = ps->frames_in_flight[ps->frames_in_flight_head];
+	ps->frames_in_flight_head =
+	    (ps->frames_in_flight_head + 1) % MAX_FRAMES_IN_FLIGHT;
+	ps->nframes_in_flight--;
+	damage_latency_add(ps, damage_time, complete_time);
+}
+
 /**
  * Redirect all windows.
  *
@@ -895,6 +1068,8 @@ static void unredirect(session_t *ps) {
 	assert(ps->redirected);
 	log_debug("Unredirecting the screen.");
 
+	// A new backend is created when redirecting again
+	ev_timer_stop(ps->loop, &ps->device_reset_timer);
 	destroy_backend(ps);
 
 	xcb_composite_unredirect_subwindows(ps->c, ps->root, session_redirection_mode(ps));
@@ -910,6 +1085,8 @@ static void unredirect(session_t *ps) {
 	ps->ndamage = 0;
 	free(ps->damage_ring);
 	ps->damage_ring = ps->damage = NULL;
+	ps->damage_time = 0;
+	ps->nframes_in_flight = 0;
 
 	// Must call XSync() here
 	x_sync(ps->c);
@@ -975,10 +1152,14 @@ static void refresh_images(session_t *ps) {
 static void handle_pending_updates(EV_P_ struct session *ps) {
 	if (ps->pending_updates) {
 		log_debug("Delayed handling of events, entering critical section");
-		auto e = xcb_request_check(ps->c, xcb_grab_server_checked(ps->c));
+		trace_begin("x", "server_grab");
+		auto e = X_ROUNDTRIP(
+		    "xcb_grab_server",
+		    xcb_request_check(ps->c, xcb_grab_server_checked(ps->c)));
 		if (e) {
 			log_fatal("failed to grab x server");
 			free(e);
+			trace_end("x", "server_grab");
 			return quit(ps);
 		}
 
@@ -1000,8 +1181,10 @@ static void handle_pending_updates(EV_P_ struct session *ps) {
 		refresh_windows(ps);
 
 		{
-			auto r = xcb_get_input_focus_reply(
-			    ps->c, xcb_get_input_focus(ps->c), NULL);
+			auto r = X_ROUNDTRIP(
+			    "xcb_get_input_focus",
+			    xcb_get_input_focus_reply(ps->c, xcb_get_input_focus(ps->c),
+			                              NULL));
 			if (!ps->active_win || (r && r->focus != ps->active_win->base.id)) {
 				recheck_focus(ps);
 			}
@@ -1011,7 +1194,10 @@ static void handle_pending_updates(EV_P_ struct session *ps) {
 		// Process window flags (stale images)
 		refresh_images(ps);
 
-		e = xcb_request_check(ps->c, xcb_ungrab_server_checked(ps->c));
+		e = X_ROUNDTRIP(
+		    "xcb_ungrab_server",
+		    xcb_request_check(ps->c, xcb_ungrab_server_checked(ps->c)));
+		trace_end("x", "server_grab");
 		if (e) {
 			log_fatal("failed to ungrab x server");
 			free(e);
@@ -1025,7 +1211,15 @@ static void handle_pending_updates(EV_P_ struct session *ps) {
 }
 
 static void draw_callback_impl(EV_P_ session_t *ps, int revents attr_unused) {
+	if (device_reset_in_progress(ps)) {
+		// Nothing can be drawn without a backend. The pending updates are
+		// handled once it's back, see device_reset_callback.
+		ps->redraw_needed = false;
+		return;
+	}
+	trace_begin("frame", "handle_pending_updates");
 	handle_pending_updates(EV_A_ ps);
+	trace_end("frame", "handle_pending_updates");
 
 	if (ps->first_frame) {
 		// If we are still rendering the first frame, if some of the windows are
@@ -1045,7 +1239,9 @@ static void draw_callback_impl(EV_P_ session_t *ps, int revents attr_unused) {
 	 * screen is not redirected. its sole purpose should be to decide whether the
 	 * screen should be redirected. */
 	bool was_redirected = ps->redirected;
+	trace_begin("frame", "paint_preprocess");
 	auto bottom = paint_preprocess(ps);
+	trace_end("frame", "paint_preprocess");
 
 	if (!was_redirected && ps->redirected) {
 		// paint_preprocess redirected the screen, which might change the state of
@@ -1059,17 +1255,83 @@ static void draw_callback_impl(EV_P_ session_t *ps, int revents attr_unused) {
 		return draw_callback_impl(EV_A_ ps, revents);
 	}
 
+	if (ps->o.benchmark) {
+		if (ps->o.benchmark_wid) {
+			auto w = find_managed_win(ps, ps->o.benchmark_wid);
+			if (!w) {
+				log_fatal("Couldn't find specified benchmark window.");
+				exit(1);
+			}
+			add_damage_from_win(ps, w);
+		} else {
+			force_repaint(ps);
+		}
+	}
+
 	// If the screen is unredirected, free all_damage to stop painting
 	if (ps->redirected) {
 		static int paint = 0;
 
 		log_trace("Render start, frame %d", paint);
-		paint_all_new(ps, bottom, false);
+		// Only repaint the whole screen when no window is selected, so
+		// --benchmark-wid exercises the damage tracking path.
+		auto frame_start = get_time_ns();
+		paint_all_new(ps, bottom, ps->o.benchmark && !ps->o.benchmark_wid);
+		ps->frame_stats.render_ns = get_time_ns() - frame_start;
 		log_trace("Render end");
 
 		ps->first_frame = false;
 		paint++;
 	}
+
+	// Round trips are accounted per call of draw_callback, including the ones that
+	// don't render because the screen is unredirected.
+	auto roundtrips =
+	    x_roundtrip_frame_end((uint64_t)ps->o.x_roundtrip_budget * 1000);
+	if (!ps->redirected) {
+		return;
+	}
+	ps->nframes++;
+	ps->frames_ns += ps->frame_stats.render_ns;
+	ps->pixels_composed += ps->frame_stats.pixels_composed;
+	ps->pixels_presented += ps->frame_stats.pixels_presented;
+	ps->state_calls_issued += ps->frame_stats.state_calls_issued;
+	ps->state_calls_elided += ps->frame_stats.state_calls_elided;
+	ps->frame_stats.x_roundtrips = roundtrips.count;
+	ps->frame_stats.x_roundtrip_ns = roundtrips.ns;
+	log_trace("Frame took %.3f ms, with %" PRIu64 " X round trip(s) taking %.3f ms, "
+	          "composed %" PRIu64 " pixels to present %" PRIu64 ", made %" PRIu64
+	          " and skipped %" PRIu64 " state changing calls",
+	          (double)ps->frame_stats.render_ns / 1e6, ps->frame_stats.x_roundtrips,
+	          (double)ps->frame_stats.x_roundtrip_ns / 1e6,
+	          ps->frame_stats.pixels_composed, ps->frame_stats.pixels_presented,
+	          ps->frame_stats.state_calls_issued, ps->frame_stats.state_calls_elided);
+
+	if (ps->o.benchmark) {
+		sample_stats_add(&ps->frame_times, ps->frame_stats.render_ns);
+		sample_stats_add(&ps->frame_roundtrip_times,
+		                 ps->frame_stats.x_roundtrip_ns);
+		if (ps->frame_times.nsamples >= (size_t)ps->o.benchmark) {
+			sample_stats_print(&ps->frame_times, "Frame time", stdout);
+			sample_stats_print(&ps->frame_roundtrip_times,
+			                   "X round trip time per frame", stdout);
+			sample_stats_print(&ps->damage_latencies,
+			                   "Damage to present latency", stdout);
+			auto presented = max2(ps->pixels_presented, 1);
+			printf("Overdraw: %.3f (%" PRIu64 " pixels composed, %" PRIu64
+			       " presented)\n",
+			       (double)ps->pixels_composed / (double)presented,
+			       ps->pixels_composed, ps->pixels_presented);
+			auto nframes = (double)max2(ps->nframes, 1);
+			printf("State changing calls per frame: %.1f made, %.1f "
+			       "skipped\n",
+			       (double)ps->state_calls_issued / nframes,
+			       (double)ps->state_calls_elided / nframes);
+			x_roundtrip_print_summary(stdout);
+			fflush(stdout);
+			quit(ps);
+		}
+	}
 }
 
 static void draw_callback(EV_P_ ev_idle *w, int revents) {
@@ -1078,8 +1340,8 @@ static void draw_callback(EV_P_ ev_idle *w, int revents) {
 	draw_callback_impl(EV_A_ ps, revents);
 
 	// Don't do painting non-stop unless draw_callback_impl thinks we
-	// should continue painting.
-	if (!ps->redraw_needed) {
+	// should continue painting. In benchmark mode we always keep painting.
+	if (!ps->redraw_needed && !ps->o.benchmark) {
 		ev_idle_stop(EV_A_ & ps->draw_idle);
 	}
 }
@@ -1093,14 +1355,165 @@ static void x_event_callback(EV_P attr_unused, ev_io *w, int revents attr_unused
 	}
 }
 
+static int xcb_window_cmp(const void *a, const void *b) {
+	xcb_window_t wa = *(const xcb_window_t *)a, wb = *(const xcb_window_t *)b;
+	return (wa > wb) - (wa < wb);
+}
+
+/// Check the window table against the X server, for when events might have been
+/// missed. Windows that are gone are destroyed, new ones are added, and the stacking
+/// order, map states and geometries are corrected. The attributes and geometries
+/// of all windows are requested in one batch. Properties aren't fetched again.
+///
+/// Must be called with the server grabbed.
+static bool revalidate_windows(session_t *ps) {
+	assert(ps->server_grabbed);
+
+	// Apply the events sent so far first, so they aren't applied on top of the
+	// state fetched below
+	x_sync(ps->c);
+	xcb_generic_event_t *ev;
+	while ((ev = xcb_poll_for_event(ps->c))) {
+		ev_handle(ps, ev);
+		free(ev);
+	}
+
+	auto tree = X_ROUNDTRIP(
+	    "xcb_query_tree",
+	    xcb_query_tree_reply(ps->c, xcb_query_tree(ps->c, ps->root), NULL));
+	if (!tree) {
+		log_error("Failed to query the window tree");
+		return false;
+	}
+	auto children = xcb_query_tree_children(tree);
+	int nchildren = xcb_query_tree_children_length(tree);
+
+	auto sorted = ccalloc(nchildren, xcb_window_t);
+	memcpy(sorted, children, sizeof(xcb_window_t) * (size_t)nchildren);
+	qsort(sorted, (size_t)nchildren, sizeof(xcb_window_t), xcb_window_cmp);
+	list_foreach_safe(struct win, w, &ps->window_stack, stack_neighbour) {
+		if (!w->destroyed && !bsearch(&w->id, sorted, (size_t)nchildren,
+		                              sizeof(xcb_window_t), xcb_window_cmp)) {
+			log_debug("Window %#010x is gone", w->id);
+			auto _ attr_unused = destroy_win_start(ps, w);
+		}
+	}
+	free(sorted);
+
+	auto attributes = ccalloc(nchildren, xcb_get_window_attributes_cookie_t);
+	auto geometries = ccalloc(nchildren, xcb_get_geometry_cookie_t);
+	for (int i = 0; i < nchildren; i++) {
+		if (find_managed_win(ps, children[i])) {
+			attributes[i] = xcb_get_window_attributes(ps->c, children[i]);
+			geometries[i] = xcb_get_geometry(ps->c, children[i]);
+		}
+	}
+
+	int nadded = 0;
+	for (int i = 0; i < nchildren; i++) {
+		auto below = i ? children[i - 1] : XCB_NONE;
+		auto w = find_win(ps, children[i]);
+		if (!w) {
+			add_win_above(ps, children[i], below);
+			nadded++;
+			continue;
+		}
+		restack_above(ps, w, below);
+		if (!attributes[i].sequence) {
+			continue;
+		}
+
+		auto mw = (struct managed_win *)w;
+		auto a = xcb_get_window_attributes_reply(ps->c, attributes[i], NULL);
+		auto g = xcb_get_geometry_reply(ps->c, geometries[i], NULL);
+		if (a && g) {
+			bool viewable = a->map_state == XCB_MAP_STATE_VIEWABLE;
+			if (viewable && !win_is_mapped_in_x(mw)) {
+				win_set_flags(mw, WIN_FLAGS_MAPPED);
+			} else if (!viewable && win_is_mapped_in_x(mw)) {
+				unmap_win_start(ps, mw);
+			}
+			win_set_pending_geometry(ps, mw, g->x, g->y, g->width, g->height,
+			                         g->border_width);
+		}
+		free(a);
+		free(g);
+	}
+	log_debug("Checked %d windows, %d were new", nchildren, nadded);
+
+	free(attributes);
+	free(geometries);
+	free(tree);
+	ps->pending_updates = true;
+	return true;
+}
+
+/// Reset picom without reconnecting to the X server. The window table, the atoms,
+/// the window properties and the runtime settings are kept. The window table is
+/// checked against the server, and the backend is created again.
+///
+/// Returns false if a full reset is needed.
+static bool session_warm_reset(session_t *ps) {
+	log_info("picom is resetting...");
+	if (ps->redirected) {
+		ev_timer_stop(ps->loop, &ps->device_reset_timer);
+		destroy_backend(ps);
+	}
+
+	auto e = xcb_request_check(ps->c, xcb_grab_server_checked(ps->c));
+	if (e) {
+		log_error("Failed to grab X server");
+		free(e);
+		return false;
+	}
+	ps->server_grabbed = true;
+	bool success = revalidate_windows(ps);
+	e = xcb_request_check(ps->c, xcb_ungrab_server_checked(ps->c));
+	if (e) {
+		log_error("Failed to ungrab server");
+		free(e);
+		return false;
+	}
+	ps->server_grabbed = false;
+	if (!success) {
+		return false;
+	}
+
+	// The root might have changed too
+	set_root_flags(ps, ROOT_FLAGS_CONFIGURED);
+	if (ps->redirected) {
+		if (!try_initialize_backend(ps)) {
+			log_error("Failed to initialize backend");
+			return false;
+		}
+		clear_damage_ring(ps);
+		ps->first_frame = true;
+		root_damaged(ps);
+		force_repaint(ps);
+	}
+	queue_redraw(ps);
+	return true;
+}
+
 /**
- * Turn on the program reset flag.
- *
- * This will result in the compostior resetting itself after next paint.
+ * Reset picom, keeping the connection to the X server if possible.
  */
-static void reset_enable(EV_P_ ev_signal *w attr_unused, int revents attr_unused) {
-	log_info("picom is resetting...");
-	ev_break(EV_A_ EVBREAK_ALL);
+static void reset_enable(EV_P_ ev_signal *w, int revents attr_unused) {
+	session_t *ps = session_ptr(w, usr1_signal);
+	if (!session_warm_reset(ps)) {
+		log_info("Falling back to a full reset");
+		ev_break(EV_A_ EVBREAK_ALL);
+	}
+}
+
+/**
+ * Print the per-window statistics and the X round trips made so far to stderr.
+ */
+static void dump_stats(EV_P attr_unused, ev_signal *w, int revents attr_unused) {
+	session_t *ps = session_ptr(w, usr2_signal);
+	win_stats_print(ps, stderr);
+	x_roundtrip_print_summary(stderr);
+	fflush(stderr);
 }
 
 static void exit_enable(EV_P attr_unused, ev_signal *w, int revents attr_unused) {
@@ -1147,7 +1560,7 @@ session_init(int argc, char **argv, Display *dpy, bool all_xerrors, bool fork) {
 	    .size_expose = 0,
 	    .n_expose = 0,
 
-	    .windows = NULL,
+	    .windows = {0},
 	    .active_win = NULL,
 	    .active_leader = XCB_NONE,
 
@@ -1188,6 +1601,10 @@ session_init(int argc, char **argv, Display *dpy, bool all_xerrors, bool fork) {
 	list_init_head(&ps->window_stack);
 	ps->loop = EV_DEFAULT;
 	pixman_region32_init(&ps->screen_reg);
+	ps->start_time = get_time_ns();
+	sample_stats_init(&ps->frame_times);
+	sample_stats_init(&ps->frame_roundtrip_times);
+	sample_stats_init(&ps->damage_latencies);
 
 	ps->pending_reply_tail = &ps->pending_reply_head;
 
@@ -1241,6 +1658,7 @@ session_init(int argc, char **argv, Display *dpy, bool all_xerrors, bool fork) {
 	}
 	ps->render_event = ext_info->first_event;
 	ps->render_error = ext_info->first_error;
+	x_init_visual_table(ps->c);
 
 	ext_info = xcb_get_extension_data(ps->c, &xcb_composite_id);
 	if (!ext_info || !ext_info->present) {
@@ -1277,6 +1695,13 @@ session_init(int argc, char **argv, Display *dpy, bool all_xerrors, bool fork) {
 	                                                  XCB_DAMAGE_MINOR_VERSION)
 	                             .sequence);
 
+	// Like the trace, the recording is kept open across resets. The windows are
+	// recorded again when they are managed again, which the replay handles fine.
+	if (ps->o.record_path && !event_record_enabled()) {
+		event_record_init(ps->o.record_path, ps->root, ps->root_width,
+		                  ps->root_height, (uint8_t)ps->damage_event);
+	}
+
 	ext_info = xcb_get_extension_data(ps->c, &xcb_xfixes_id);
 	if (!ext_info || !ext_info->present) {
 		log_fatal("No XFixes extension");
@@ -1325,6 +1750,9 @@ session_init(int argc, char **argv, Display *dpy, bool all_xerrors, bool fork) {
 	    .logpath = NULL,
 
 	    .use_damage = true,
+	    .compose_strategy = COMPOSE_STRATEGY_REGION,
+	    .atlas_max_size = 256,
+	    .x_roundtrip_budget = 4000,
 	};
 
 	// Parse all of the rest command line options
@@ -1334,6 +1762,21 @@ session_init(int argc, char **argv, Display *dpy, bool all_xerrors, bool fork) {
 		return NULL;
 	}
 
+	// The trace is kept open across resets, so it covers the whole run
+	if (ps->o.trace_path && !trace_enabled()) {
+		trace_init(ps->o.trace_path);
+	}
+
+	if (ps->o.benchmark < 0) {
+		log_fatal("Invalid number of benchmark cycles: %d", ps->o.benchmark);
+		return NULL;
+	}
+
+	if (ps->o.x_roundtrip_budget < 0) {
+		log_fatal("Invalid X round trip budget: %d", ps->o.x_roundtrip_budget);
+		return NULL;
+	}
+
 	if (ps->o.logpath) {
 		auto l = file_logger_new(ps->o.logpath);
 		if (l) {
@@ -1350,6 +1793,10 @@ session_init(int argc, char **argv, Display *dpy, bool all_xerrors, bool fork) {
 		}
 	}
 
+	if (ps->o.log_async && !log_set_async_tls(true)) {
+		log_error("Failed to start the logging thread, logging synchronously");
+	}
+
 	ps->atoms = init_atoms(ps->c);
 	ps->atoms_wintypes[WINTYPE_UNKNOWN] = 0;
 #define SET_WM_TYPE_ATOM(x)                                                              \
@@ -1401,6 +1848,7 @@ session_init(int argc, char **argv, Display *dpy, bool all_xerrors, bool fork) {
 		    NULL);
 		if (r) {
 			ps->present_exists = true;
+			ps->present_opcode = ext_info->major_opcode;
 			free(r);
 		}
 	}
@@ -1422,20 +1870,30 @@ session_init(int argc, char **argv, Display *dpy, bool all_xerrors, bool fork) {
 		}
 	}
 
-	ps->sync_fence = XCB_NONE;
 	if (ps->xsync_exists) {
-		ps->sync_fence = x_new_id(ps->c);
-		e = xcb_request_check(ps->c, xcb_sync_create_fence_checked(
-		                                 ps->c, ps->root, ps->sync_fence, 0));
-		if (e) {
+		xcb_void_cookie_t cookies[SYNC_FENCE_COUNT];
+		for (int i = 0; i < SYNC_FENCE_COUNT; i++) {
+			ps->sync_fences[i] = x_new_id(ps->c);
+			cookies[i] = xcb_sync_create_fence_checked(
+			    ps->c, ps->root, ps->sync_fences[i], 0);
+		}
+		bool failed = false;
+		for (int i = 0; i < SYNC_FENCE_COUNT; i++) {
+			e = xcb_request_check(ps->c, cookies[i]);
+			if (e) {
+				ps->sync_fences[i] = XCB_NONE;
+				failed = true;
+				free(e);
+			}
+		}
+		if (failed) {
 			if (ps->o.xrender_sync_fence) {
 				log_error("Failed to create a XSync fence. "
 				          "xrender-sync-fence will be "
 				          "disabled");
 				ps->o.xrender_sync_fence = false;
 			}
-			ps->sync_fence = XCB_NONE;
-			free(e);
+			destroy_sync_fences(ps);
 		}
 	} else if (ps->o.xrender_sync_fence) {
 		log_error("XSync extension not found. No XSync fence sync is "
@@ -1470,6 +1928,15 @@ session_init(int argc, char **argv, Display *dpy, bool all_xerrors, bool fork) {
 				goto err;
 			}
 		}
+
+		if (ps->present_exists) {
+			// Get notified when our frames are actually presented, to measure
+			// the damage to present latency
+			ps->present_eid = x_new_id(ps->c);
+			xcb_present_select_input(ps->c, ps->present_eid,
+			                         session_get_target_window(ps),
+			                         XCB_PRESENT_EVENT_MASK_COMPLETE_NOTIFY);
+		}
 	} else {
 		// We are here if we don't really function as a compositor, so we are not
 		// taking over the screen, and we don't need to register as a compositor
@@ -1500,11 +1967,20 @@ session_init(int argc, char **argv, Display *dpy, bool all_xerrors, bool fork) {
 	ev_io_init(&ps->xiow, x_event_callback, ConnectionNumber(ps->dpy), EV_READ);
 	ev_io_start(ps->loop, &ps->xiow);
 	ev_idle_init(&ps->draw_idle, draw_callback);
+	ev_timer_init(&ps->device_reset_timer, device_reset_callback, 0, 0);
 
 	// Set up SIGUSR1 signal handler to reset program
 	ev_signal_init(&ps->usr1_signal, reset_enable, SIGUSR1);
+	// Set up SIGUSR2 signal handler to dump the per-window statistics
+	ev_signal_init(&ps->usr2_signal, dump_stats, SIGUSR2);
 	ev_signal_init(&ps->int_signal, exit_enable, SIGINT);
 	ev_signal_start(ps->loop, &ps->usr1_signal);
+	ev_signal_start(ps->loop, &ps->usr2_signal);
+
+	if (ps->o.control_socket) {
+		// Failing to create the control socket is not fatal
+		ps->control = control_new(ps);
+	}
 	ev_signal_start(ps->loop, &ps->int_signal);
 
 	// xcb can read multiple events from the socket when a request with reply is
@@ -1609,7 +2085,6 @@ static void session_destroy(session_t *ps) {
 	list_foreach_safe(struct win, w, &ps->window_stack, stack_neighbour) {
 		if (!w->destroyed) {
 			win_ev_stop(ps, w);
-			HASH_DEL(ps->windows, w);
 		}
 
 		if (w->managed) {
@@ -1619,6 +2094,7 @@ static void session_destroy(session_t *ps) {
 		free(w);
 	}
 	list_init_head(&ps->window_stack);
+	xid_map_destroy(&ps->windows);
 
 	// Free tracked atom list
 	{
@@ -1661,9 +2137,15 @@ static void session_destroy(session_t *ps) {
 
 	pixman_region32_fini(&ps->screen_reg);
 	free(ps->expose_rects);
+	sample_stats_destroy(&ps->frame_times);
+	sample_stats_destroy(&ps->frame_roundtrip_times);
+	sample_stats_destroy(&ps->damage_latencies);
 
 	free(ps->o.logpath);
+	free(ps->o.trace_path);
+	free(ps->o.record_path);
 	x_free_randr_info(ps);
+	x_free_visual_table();
 
 	// Release custom window shaders
 	struct shader_info *shader, *tmp;
@@ -1681,10 +2163,7 @@ static void session_destroy(session_t *ps) {
 		ps->overlay = XCB_NONE;
 	}
 
-	if (ps->sync_fence != XCB_NONE) {
-		xcb_sync_destroy_fence(ps->c, ps->sync_fence);
-		ps->sync_fence = XCB_NONE;
-	}
+	destroy_sync_fences(ps);
 
 	// Free reg_win
 	if (ps->reg_win != XCB_NONE) {
@@ -1715,9 +2194,15 @@ static void session_destroy(session_t *ps) {
 
 	// Stop libev event handlers
 	ev_timer_stop(ps->loop, &ps->dpms_check_timer);
+	ev_timer_stop(ps->loop, &ps->device_reset_timer);
 	ev_idle_stop(ps->loop, &ps->draw_idle);
 	ev_prepare_stop(ps->loop, &ps->event_check);
 	ev_signal_stop(ps->loop, &ps->usr1_signal);
+	ev_signal_stop(ps->loop, &ps->usr2_signal);
+	if (ps->control) {
+		control_destroy(ps->control);
+		ps->control = NULL;
+	}
 	ev_signal_stop(ps->loop, &ps->int_signal);
 }
 
@@ -1849,6 +2334,8 @@ int main(int argc, char **argv) {
 		free(pid_file);
 	}
 
+	trace_deinit();
+	event_record_deinit();
 	log_deinit_tls();
 
 	return ret_code;
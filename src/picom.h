@@ -46,6 +46,15 @@ void set_root_flags(session_t *ps, uint64_t flags);
 
 void quit(session_t *ps);
 
+/// Start recovering from a GPU device reset. Drawing stops until the backend has
+/// been created again.
+void handle_device_reset(session_t *ps);
+
 xcb_window_t session_get_target_window(session_t *);
+/// Record that a frame containing all the damage received so far has been presented.
+void damage_latency_frame_presented(session_t *ps);
+/// Record that the X server has completed the presentation of the oldest frame in
+/// flight, at `complete_time`.
+void damage_latency_frame_completed(session_t *ps, uint64_t complete_time);
 
 uint8_t session_redirection_mode(session_t *ps);
\ No newline at end of file
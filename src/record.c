@@ -0,0 +1,90 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "record.h"
+#include "utils.h"
+
+bool event_record_enabled_ = false;
+
+static FILE *record_file = NULL;
+static char *record_buffer = NULL;
+static uint64_t record_start = 0;
+
+/// Size of the stdio buffer for the recording. Most records are 48 bytes, so this
+/// holds tens of thousands of them between writes.
+#define RECORD_BUFFER_SIZE (4 * 1024 * 1024)
+
+bool event_record_init(const char *path, xcb_window_t root, int root_width,
+                       int root_height, uint8_t damage_event) {
+	if (record_file) {
+		return true;
+	}
+
+	record_file = fopen(path, "wb");
+	if (!record_file) {
+		log_error_errno("Failed to open event recording %s", path);
+		return false;
+	}
+	record_buffer = malloc(RECORD_BUFFER_SIZE);
+	if (record_buffer) {
+		setvbuf(record_file, record_buffer, _IOFBF, RECORD_BUFFER_SIZE);
+	}
+
+	struct event_record_header header = {
+	    .version = EVENT_RECORD_VERSION,
+	    .root = root,
+	    .root_width = (uint16_t)root_width,
+	    .root_height = (uint16_t)root_height,
+	    .damage_event = damage_event,
+	};
+	memcpy(header.magic, EVENT_RECORD_MAGIC, sizeof(header.magic));
+	fwrite(&header, sizeof(header), 1, record_file);
+
+	record_start = get_time_ns();
+	event_record_enabled_ = true;
+	log_info("Recording X events to %s", path);
+	return true;
+}
+
+void event_record_deinit(void) {
+	if (!record_file) {
+		return;
+	}
+	event_record_enabled_ = false;
+	if (fclose(record_file) != 0) {
+		log_error_errno("Failed to write the event recording");
+	}
+	free(record_buffer);
+	record_file = NULL;
+	record_buffer = NULL;
+}
+
+static void event_record_write(enum event_record_type type, const void *data,
+                               uint32_t length) {
+	struct event_record record = {
+	    .time = get_time_ns() - record_start,
+	    .type = (uint8_t)type,
+	    .length = length,
+	};
+	fwrite(&record, sizeof(record), 1, record_file);
+	fwrite(data, 1, length, record_file);
+}
+
+void event_record_event_(const xcb_generic_event_t *ev) {
+	uint32_t length = sizeof(*ev);
+	if ((ev->response_type & 0x7f) == XCB_GE_GENERIC) {
+		// xcb puts the extra data of generic events after full_sequence
+		length += ((const xcb_ge_generic_event_t *)ev)->length * 4;
+	}
+	event_record_write(EVENT_RECORD_X_EVENT, ev, length);
+}
+
+void event_record_window_(const struct event_record_window *w) {
+	event_record_write(EVENT_RECORD_WINDOW, w, sizeof(*w));
+}
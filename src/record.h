@@ -0,0 +1,95 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+#pragma once
+
+/// Recording of the X events handled by the compositor.
+///
+/// The recording can be played back on another X server with bench/xreplay, which
+/// makes it possible to benchmark the compositor against a real session's traffic.
+/// Like tracing, every record call is just a check of a global flag when recording is
+/// disabled.
+///
+/// The file starts with a `struct event_record_header`, followed by records, each a
+/// `struct event_record` followed by `length` bytes of payload. Everything is in the
+/// byte order of the recording machine.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <xcb/xcb.h>
+
+#include "compiler.h"
+
+#define EVENT_RECORD_MAGIC "PICOMREC"
+#define EVENT_RECORD_VERSION 1
+
+struct event_record_header {
+	char magic[8];
+	uint32_t version;
+	/// Root window of the recording server. Only structure events reported on the
+	/// root window describe the window set.
+	xcb_window_t root;
+	uint16_t root_width;
+	uint16_t root_height;
+	/// First event of the damage extension on the recording server, needed to
+	/// recognize damage notifications.
+	uint8_t damage_event;
+	uint8_t pad[3];
+};
+
+enum event_record_type {
+	/// An X event as received from the server. For generic events, the extra data
+	/// follows the event, after the `full_sequence` field added by xcb.
+	EVENT_RECORD_X_EVENT = 0,
+	/// The state of a window when the compositor started managing it, a
+	/// `struct event_record_window`.
+	EVENT_RECORD_WINDOW = 1,
+};
+
+struct event_record {
+	/// Nanoseconds since the start of the recording
+	uint64_t time;
+	uint8_t type;
+	uint8_t pad[3];
+	uint32_t length;
+};
+
+/// The replies the compositor consumed when it started managing a window.
+struct event_record_window {
+	xcb_window_t id;
+	/// The window right below this one, XCB_NONE if this is the bottom most window.
+	xcb_window_t below;
+	int16_t x, y;
+	uint16_t width, height;
+	uint16_t border_width;
+	uint8_t depth;
+	uint8_t map_state;
+	uint8_t override_redirect;
+	uint8_t pad[3];
+};
+
+extern bool event_record_enabled_;
+
+/// Start recording to the file at `path`. Returns false if the file can't be opened.
+bool event_record_init(const char *path, xcb_window_t root, int root_width,
+                       int root_height, uint8_t damage_event);
+/// Flush and close the recording.
+void event_record_deinit(void);
+
+void event_record_event_(const xcb_generic_event_t *ev);
+void event_record_window_(const struct event_record_window *w);
+
+static inline bool event_record_enabled(void) {
+	return unlikely(event_record_enabled_);
+}
+
+static inline void event_record_event(const xcb_generic_event_t *ev) {
+	if (event_record_enabled()) {
+		event_record_event_(ev);
+	}
+}
+
+static inline void event_record_window(const struct event_record_window *w) {
+	if (event_record_enabled()) {
+		event_record_window_(w);
+	}
+}
@@ -46,4 +46,16 @@ static inline rect_t *from_x_rects(int nrects, const xcb_rectangle_t *rects) {
 		ret[i] = from_x_rect(rects + i);
 	}
 	return ret;
-}
\ No newline at end of file
+}
+
+/// Number of pixels covered by a region
+static inline uint64_t region_area(const region_t *x) {
+	int nrects;
+	const rect_t *rects = pixman_region32_rectangles((region_t *)x, &nrects);
+	uint64_t area = 0;
+	for (int i = 0; i < nrects; i++) {
+		area += (uint64_t)(rects[i].x2 - rects[i].x1) *
+		        (uint64_t)(rects[i].y2 - rects[i].y1);
+	}
+	return area;
+}
@@ -0,0 +1,71 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+
+#include <inttypes.h>
+#include <stdlib.h>
+
+#include "statistics.h"
+#include "utils.h"
+
+void sample_stats_init(struct sample_stats *s) {
+	*s = (struct sample_stats){0};
+}
+
+void sample_stats_destroy(struct sample_stats *s) {
+	free(s->samples);
+	*s = (struct sample_stats){0};
+}
+
+void sample_stats_reset(struct sample_stats *s) {
+	s->nsamples = 0;
+}
+
+void sample_stats_add(struct sample_stats *s, uint64_t sample) {
+	if (s->nsamples == s->capacity) {
+		s->capacity = s->capacity ? s->capacity * 2 : 64;
+		s->samples = crealloc(s->samples, s->capacity);
+	}
+	s->samples[s->nsamples++] = sample;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+uint64_t sample_stats_percentile(struct sample_stats *s, double p) {
+	if (s->nsamples == 0) {
+		return 0;
+	}
+	qsort(s->samples, s->nsamples, sizeof(uint64_t), cmp_u64);
+
+	// Nearest-rank percentile
+	auto rank = (size_t)(p / 100.0 * (double)s->nsamples + 0.5);
+	if (rank > 0) {
+		rank--;
+	}
+	return s->samples[min2(rank, s->nsamples - 1)];
+}
+
+void sample_stats_print(struct sample_stats *s, const char *name, FILE *f) {
+	if (s->nsamples == 0) {
+		fprintf(f, "%s: no samples\n", name);
+		return;
+	}
+
+	// Sorts the samples, so min/max can be read off the ends below
+	auto p50 = sample_stats_percentile(s, 50);
+	auto p90 = sample_stats_percentile(s, 90);
+	auto p99 = sample_stats_percentile(s, 99);
+	double sum = 0;
+	for (size_t i = 0; i < s->nsamples; i++) {
+		sum += (double)s->samples[i];
+	}
+
+	fprintf(f,
+	        "%s: %zu samples, mean %.1f us, min %.1f us, p50 %.1f us, p90 %.1f us, "
+	        "p99 %.1f us, max %.1f us\n",
+	        name, s->nsamples, sum / (double)s->nsamples / 1e3,
+	        (double)s->samples[0] / 1e3, (double)p50 / 1e3, (double)p90 / 1e3,
+	        (double)p99 / 1e3, (double)s->samples[s->nsamples - 1] / 1e3);
+}
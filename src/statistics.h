@@ -0,0 +1,47 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+/// A growable collection of samples (e.g. frame times in nanoseconds), used to report
+/// the distribution of a measurement.
+struct sample_stats {
+	uint64_t *samples;
+	size_t nsamples;
+	size_t capacity;
+};
+
+void sample_stats_init(struct sample_stats *s);
+void sample_stats_destroy(struct sample_stats *s);
+/// Drop all collected samples, but keep the allocated storage.
+void sample_stats_reset(struct sample_stats *s);
+void sample_stats_add(struct sample_stats *s, uint64_t sample);
+
+/// Get the value at percentile `p` (between 0 and 100) of the collected samples. Sorts
+/// the samples in place. Returns 0 if there are no samples.
+uint64_t sample_stats_percentile(struct sample_stats *s, double p);
+
+/// Print the distribution of the collected samples, which are assumed to be in
+/// nanoseconds, to `f`. Sorts the samples in place.
+void sample_stats_print(struct sample_stats *s, const char *name, FILE *f);
+
+/// Measurements of the last rendered frame.
+struct frame_stats {
+	/// Time from the start of painting to the return of present
+	uint64_t render_ns;
+	/// Number of synchronous round trips to the X server made during the frame
+	uint64_t x_roundtrips;
+	/// Time spent waiting for those round trips
+	uint64_t x_roundtrip_ns;
+	/// Number of pixels composed, including the root. Pixels covered by several
+	/// windows are counted once for each of them.
+	uint64_t pixels_composed;
+	/// Number of pixels presented, i.e. the area of the damage
+	uint64_t pixels_presented;
+	/// Number of state changing calls the backend made to the graphics API, and the
+	/// number of redundant ones it skipped
+	uint64_t state_calls_issued;
+	uint64_t state_calls_elided;
+};
@@ -0,0 +1,83 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "trace.h"
+#include "utils.h"
+
+bool trace_enabled_ = false;
+
+static FILE *trace_file = NULL;
+static char *trace_buffer = NULL;
+static bool trace_first_event = true;
+static int trace_pid = 0;
+
+/// Size of the stdio buffer for the trace file. Events are small, a big buffer keeps
+/// us from doing a write syscall every few events.
+#define TRACE_BUFFER_SIZE (1024 * 1024)
+
+bool trace_init(const char *path) {
+	if (trace_file) {
+		return true;
+	}
+
+	trace_file = fopen(path, "w");
+	if (!trace_file) {
+		log_error_errno("Failed to open trace file %s", path);
+		return false;
+	}
+	trace_buffer = malloc(TRACE_BUFFER_SIZE);
+	if (trace_buffer) {
+		setvbuf(trace_file, trace_buffer, _IOFBF, TRACE_BUFFER_SIZE);
+	}
+
+	trace_pid = getpid();
+	trace_first_event = true;
+	fputs("{\"traceEvents\":[\n", trace_file);
+	trace_enabled_ = true;
+	log_info("Writing trace to %s", path);
+	return true;
+}
+
+void trace_deinit(void) {
+	if (!trace_file) {
+		return;
+	}
+	trace_enabled_ = false;
+	fputs("\n],\"displayTimeUnit\":\"ms\"}\n", trace_file);
+	fclose(trace_file);
+	free(trace_buffer);
+	trace_file = NULL;
+	trace_buffer = NULL;
+}
+
+void trace_event_(char phase, const char *category, const char *name, uint32_t window) {
+	static thread_local int tid = 0;
+	if (!tid) {
+		tid = (int)syscall(SYS_gettid);
+	}
+
+	auto ts = get_time_ns();
+	fprintf(trace_file,
+	        "%s{\"ph\":\"%c\",\"cat\":\"%s\",\"name\":\"%s\",\"ts\":%" PRIu64
+	        ".%03u,\"pid\":%d,\"tid\":%d",
+	        trace_first_event ? "" : ",\n", phase, category, name, ts / 1000,
+	        (unsigned)(ts % 1000), trace_pid, tid);
+	if (phase == 'i') {
+		// Thread scoped instant event
+		fputs(",\"s\":\"t\"", trace_file);
+	}
+	if (window) {
+		fprintf(trace_file, ",\"args\":{\"window\":\"%#010x\"}", window);
+	}
+	fputc('}', trace_file);
+	trace_first_event = false;
+}
@@ -0,0 +1,56 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+#pragma once
+
+/// Tracing in the Chrome trace event format.
+///
+/// The output can be loaded into chrome://tracing or https://ui.perfetto.dev. When
+/// tracing is disabled, every trace call is just a check of a global flag, so the
+/// instrumentation can be left in hot paths.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "compiler.h"
+
+extern bool trace_enabled_;
+
+/// Start writing trace events to the file at `path`. Returns false if the file can't
+/// be opened.
+bool trace_init(const char *path);
+/// Finish the trace file and stop tracing.
+void trace_deinit(void);
+
+void trace_event_(char phase, const char *category, const char *name, uint32_t window);
+
+static inline bool trace_enabled(void) {
+	return unlikely(trace_enabled_);
+}
+
+/// Begin a span. Spans on the same thread must be properly nested, and ended with
+/// trace_end with the same name.
+static inline void trace_begin(const char *category, const char *name) {
+	if (trace_enabled()) {
+		trace_event_('B', category, name, 0);
+	}
+}
+
+/// Begin a span related to a window, the window id is attached to the span.
+static inline void trace_begin_window(const char *category, const char *name, uint32_t window) {
+	if (trace_enabled()) {
+		trace_event_('B', category, name, window);
+	}
+}
+
+static inline void trace_end(const char *category, const char *name) {
+	if (trace_enabled()) {
+		trace_event_('E', category, name, 0);
+	}
+}
+
+/// Record an event without a duration
+static inline void trace_instant(const char *category, const char *name) {
+	if (trace_enabled()) {
+		trace_event_('i', category, name, 0);
+	}
+}
@@ -111,23 +111,44 @@ safe_isnan(double a) {
 #define min2(a, b) ((a) > (b) ? (b) : (a))
 #define max2(a, b) ((a) > (b) ? (a) : (b))
 
+/// @brief Quit if an allocation failed, i.e. if `ptr` is NULL.
+static inline void *allocchk_(const char *func_name, const char *file, unsigned int line,
+                              void *ptr) {
+	if (unlikely(!ptr)) {
+		// Not through the logger, the allocation wrappers are also used by
+		// tools that don't have one
+		fprintf(stderr, "%s:%u (%s): Failed to allocate memory.\n", file, line,
+		        func_name);
+		abort();
+	}
+	return ptr;
+}
+
+/// @brief Wrapper of allocchk_().
+#define allocchk(ptr) allocchk_(__func__, __FILE__, __LINE__, ptr)
+
 /// @brief Wrapper of malloc().
-#define cmalloc(type) ((type *)malloc(sizeof(type)))
+#define cmalloc(type) ((type *)allocchk(malloc(sizeof(type))))
 
 /// @brief Wrapper of calloc().
 #define ccalloc(nmemb, type)                                                             \
 	({                                                                               \
 		auto tmp = (nmemb);                                                      \
 		ASSERT_GEQ(tmp, 0);                                                      \
-		((type *)calloc((size_t)tmp, sizeof(type)));                             \
+		((type *)allocchk(calloc((size_t)tmp, sizeof(type))));                   \
 	})
 
-/// @brief Wrapper of ealloc().
+/// @brief Wrapper of realloc(). Shrinking to 0 may free `ptr` and return NULL.
 #define crealloc(ptr, nmemb)                                                             \
 	({                                                                               \
 		auto tmp = (nmemb);                                                      \
 		ASSERT_GEQ(tmp, 0);                                                      \
-		((__typeof__(ptr))realloc((ptr), (size_t)tmp * sizeof(*(ptr))));         \
+		size_t __crealloc_size = (size_t)tmp * sizeof(*(ptr));                   \
+		void *__crealloc_ret = realloc((ptr), __crealloc_size);                  \
+		if (__crealloc_size) {                                                   \
+			allocchk(__crealloc_ret);                                        \
+		}                                                                        \
+		((__typeof__(ptr))__crealloc_ret);                                       \
 	})
 
 /// RC_TYPE generates a reference counted type from `type`
@@ -184,6 +205,13 @@ safe_isnan(double a) {
 	void name##_ref(type *a);                                                        \
 	void name##_unref(type **a);
 
+/// Get the current monotonic time in nanoseconds.
+static inline uint64_t get_time_ns(void) {
+	struct timespec tp;
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	return (uint64_t)tp.tv_sec * 1000000000ULL + (uint64_t)tp.tv_nsec;
+}
+
 // Some versions of the Android libc do not have timespec_get(), use
 // clock_gettime() instead.
 #ifdef __ANDROID__
@@ -22,8 +22,10 @@
 #include "list.h"
 #include "log.h"
 #include "picom.h"
+#include "record.h"
 #include "region.h"
 #include "render.h"
+#include "trace.h"
 #include "types.h"
 #include "uthash_extra.h"
 #include "utils.h"
@@ -125,7 +127,7 @@ static inline void group_on_factor_change(session_t *ps, xcb_window_t leader) {
 		return;
 	}
 
-	HASH_ITER2(ps->windows, w) {
+	xid_map_foreach(&ps->windows, struct win, w) {
 		assert(!w->destroyed);
 		if (!w->managed) {
 			continue;
@@ -156,7 +158,7 @@ static inline bool group_is_focused(session_t *ps, xcb_window_t leader) {
 		return false;
 	}
 
-	HASH_ITER2(ps->windows, w) {
+	xid_map_foreach(&ps->windows, struct win, w) {
 		assert(!w->destroyed);
 		if (!w->managed) {
 			continue;
@@ -227,6 +229,20 @@ void win_get_region_frame_local(const struct managed_win *w, region_t *res) {
 
 gen_by_val(win_get_region_frame_local);
 
+void win_get_opaque_region_global(const struct managed_win *w, region_t *res) {
+	switch (w->mode) {
+	case WMODE_SOLID:
+		pixman_region32_copy(res, (region_t *)&w->bounding_shape);
+		break;
+	case WMODE_FRAME_TRANS:
+		win_get_region_noframe_local(w, res);
+		pixman_region32_intersect(res, res, (region_t *)&w->bounding_shape);
+		break;
+	case WMODE_TRANS: pixman_region32_clear(res); return;
+	}
+	pixman_region32_translate(res, w->g.x, w->g.y);
+}
+
 /**
  * Add a window to damaged area.
  *
@@ -261,17 +277,25 @@ static inline void win_release_pixmap(backend_t *base, struct managed_win *w) {
 static inline bool win_bind_pixmap(struct backend_base *b, struct managed_win *w) {
 	assert(!w->win_image);
 	auto pixmap = x_new_id(b->c);
-	auto e = xcb_request_check(
-	    b->c, xcb_composite_name_window_pixmap_checked(b->c, w->base.id, pixmap));
+	auto bind_start = get_time_ns();
+	trace_begin_window("render", "bind_pixmap", w->base.id);
+	auto e = X_ROUNDTRIP(
+	    "xcb_composite_name_window_pixmap",
+	    xcb_request_check(b->c, xcb_composite_name_window_pixmap_checked(
+	                                b->c, w->base.id, pixmap)));
 	if (e) {
 		log_error("Failed to get named pixmap for window %#010x(%s)", w->base.id,
 		          w->name);
 		free(e);
+		trace_end("render", "bind_pixmap");
 		return false;
 	}
 	log_debug("New named pixmap for %#010x (%s) : %#010x", w->base.id, w->name, pixmap);
 	w->win_image =
 	    b->ops->bind_pixmap(b, pixmap, x_get_visual_info(b->c, w->a.visual), true);
+	trace_end("render", "bind_pixmap");
+	w->stats.nbind++;
+	w->stats.bind_ns += get_time_ns() - bind_start;
 	if (!w->win_image) {
 		log_error("Failed to bind pixmap");
 		win_set_flags(w, WIN_FLAGS_IMAGE_ERROR);
@@ -525,8 +549,10 @@ static inline bool win_bounding_shaped(const session_t *ps, xcb_window_t wid) {
 		xcb_shape_query_extents_reply_t *reply;
 		Bool bounding_shaped;
 
-		reply = xcb_shape_query_extents_reply(
-		    ps->c, xcb_shape_query_extents(ps->c, wid), NULL);
+		reply = X_ROUNDTRIP(
+		    "xcb_shape_query_extents",
+		    xcb_shape_query_extents_reply(
+		        ps->c, xcb_shape_query_extents(ps->c, wid), NULL));
 		bounding_shaped = reply && reply->bounding_shaped;
 		free(reply);
 
@@ -612,8 +638,9 @@ void win_on_factor_change(session_t *ps, struct managed_win *w) {
  * Update cache data in struct _win that depends on window size.
  */
 void win_on_win_size_change(session_t *ps, struct managed_win *w) {
-	w->width = w->g.width;
-	w->height = w->g.height;
+	// The window's pixmap includes its border
+	w->width = w->g.width + w->g.border_width * 2;
+	w->height = w->g.height + w->g.border_width * 2;
 
 	// We don't handle property updates of non-visible windows until they are
 	// mapped.
@@ -630,6 +657,15 @@ void win_on_win_size_change(session_t *ps, struct managed_win *w) {
 void win_update_wintype(session_t *ps, struct managed_win *w) {
 	const wintype_t wtype_old = w->window_type;
 
+	// WM_TRANSIENT_FOR is only needed if _NET_WM_WINDOW_TYPE isn't set, but ask for
+	// it together with the type, so it doesn't cost another round trip.
+	xcb_get_property_cookie_t transient_for = {0};
+	if (!w->a.override_redirect) {
+		transient_for = xcb_get_property(ps->c, 0, w->client_win,
+		                                 ps->atoms->aWM_TRANSIENT_FOR,
+		                                 XCB_GET_PROPERTY_TYPE_ANY, 0, 0);
+	}
+
 	// Detect window type here
 	w->window_type = wid_get_prop_wintype(ps, w->client_win);
 
@@ -637,11 +673,22 @@ void win_update_wintype(session_t *ps, struct managed_win *w) {
 	// override-redirect windows or windows without WM_TRANSIENT_FOR as
 	// _NET_WM_WINDOW_TYPE_NORMAL, otherwise as _NET_WM_WINDOW_TYPE_DIALOG.
 	if (WINTYPE_UNKNOWN == w->window_type) {
-		if (w->a.override_redirect ||
-		    !wid_has_prop(ps, w->client_win, ps->atoms->aWM_TRANSIENT_FOR))
-			w->window_type = WINTYPE_NORMAL;
-		else
-			w->window_type = WINTYPE_DIALOG;
+		w->window_type = WINTYPE_NORMAL;
+		if (!w->a.override_redirect) {
+			xcb_generic_error_t *e = NULL;
+			auto r = xcb_get_property_reply(ps->c, transient_for, &e);
+			if (e) {
+				x_print_error(e->sequence, e->major_code, e->minor_code,
+				              e->error_code);
+				free(e);
+			}
+			if (r && r->type != XCB_NONE) {
+				w->window_type = WINTYPE_DIALOG;
+			}
+			free(r);
+		}
+	} else if (!w->a.override_redirect) {
+		xcb_discard_reply(ps->c, transient_for.sequence);
 	}
 
 	if (w->window_type != wtype_old) {
@@ -665,10 +712,13 @@ void win_mark_client(session_t *ps, struct managed_win *w, xcb_window_t client)
 		return;
 	}
 
-	auto e = xcb_request_check(
-	    ps->c, xcb_change_window_attributes_checked(
-	               ps->c, client, XCB_CW_EVENT_MASK,
-	               (const uint32_t[]){determine_evmask(ps, client, WIN_EVMODE_CLIENT)}));
+	auto e = X_ROUNDTRIP(
+	    "xcb_change_window_attributes",
+	    xcb_request_check(
+	        ps->c, xcb_change_window_attributes_checked(
+	                   ps->c, client, XCB_CW_EVENT_MASK,
+	                   (const uint32_t[]){
+	                       determine_evmask(ps, client, WIN_EVMODE_CLIENT)})));
 	if (e) {
 		log_error("Failed to change event mask of window %#010x", client);
 		free(e);
@@ -687,8 +737,10 @@ void win_mark_client(session_t *ps, struct managed_win *w, xcb_window_t client)
 	// Update everything related to conditions
 	win_on_factor_change(ps, w);
 
-	auto r = xcb_get_window_attributes_reply(
-	    ps->c, xcb_get_window_attributes(ps->c, w->client_win), &e);
+	auto r = X_ROUNDTRIP(
+	    "xcb_get_window_attributes",
+	    xcb_get_window_attributes_reply(
+	        ps->c, xcb_get_window_attributes(ps->c, w->client_win), &e));
 	if (!r) {
 		log_error("Failed to get client window attributes");
 		return;
@@ -717,36 +769,83 @@ void win_unmark_client(session_t *ps, struct managed_win *w) {
 	    (const uint32_t[]){determine_evmask(ps, client, WIN_EVMODE_UNKNOWN)});
 }
 
+/// Requests find_client_win sends for a window: whether it has WM_STATE, and its
+/// children, in case it doesn't.
+struct client_win_query {
+	xcb_get_property_cookie_t wm_state;
+	xcb_query_tree_cookie_t tree;
+};
+
+static void
+client_win_query_send(session_t *ps, xcb_window_t w, struct client_win_query *q) {
+	q->wm_state = xcb_get_property(ps->c, 0, w, ps->atoms->aWM_STATE,
+	                               XCB_GET_PROPERTY_TYPE_ANY, 0, 0);
+	q->tree = xcb_query_tree(ps->c, w);
+}
+
+static void client_win_query_discard(session_t *ps, const struct client_win_query *q) {
+	xcb_discard_reply(ps->c, q->wm_state.sequence);
+	xcb_discard_reply(ps->c, q->tree.sequence);
+}
+
 /**
- * Look for the client window of a particular window.
+ * Look for the client window of a particular window, depth first.
+ *
+ * The queries for all children of a window are sent before the replies for the first
+ * one are read, so each level of the tree costs one round trip.
  */
-static xcb_window_t find_client_win(session_t *ps, xcb_window_t w) {
-	if (wid_has_prop(ps, w, ps->atoms->aWM_STATE)) {
+static xcb_window_t
+find_client_win_reply(session_t *ps, xcb_window_t w, const struct client_win_query *q) {
+	auto r = X_ROUNDTRIP("xcb_get_property",
+	                     xcb_get_property_reply(ps->c, q->wm_state, NULL));
+	bool has_wm_state = r && r->type != XCB_NONE;
+	free(r);
+	if (has_wm_state) {
+		xcb_discard_reply(ps->c, q->tree.sequence);
 		return w;
 	}
 
-	xcb_query_tree_reply_t *reply =
-	    xcb_query_tree_reply(ps->c, xcb_query_tree(ps->c, w), NULL);
+	// Sent together with the WM_STATE query, so this isn't another round trip
+	xcb_generic_error_t *e = NULL;
+	xcb_query_tree_reply_t *reply = xcb_query_tree_reply(ps->c, q->tree, &e);
 	if (!reply) {
+		if (e) {
+			x_print_error(e->sequence, e->major_code, e->minor_code,
+			              e->error_code);
+			free(e);
+		}
 		return 0;
 	}
 
 	xcb_window_t *children = xcb_query_tree_children(reply);
 	int nchildren = xcb_query_tree_children_length(reply);
-	int i;
-	xcb_window_t ret = 0;
+	auto queries = ccalloc(nchildren, struct client_win_query);
+	for (int i = 0; i < nchildren; i++) {
+		client_win_query_send(ps, children[i], &queries[i]);
+	}
 
-	for (i = 0; i < nchildren; ++i) {
-		if ((ret = find_client_win(ps, children[i]))) {
-			break;
-		}
+	xcb_window_t ret = 0;
+	int i = 0;
+	while (i < nchildren && !ret) {
+		ret = find_client_win_reply(ps, children[i], &queries[i]);
+		i++;
+	}
+	for (; i < nchildren; i++) {
+		client_win_query_discard(ps, &queries[i]);
 	}
 
+	free(queries);
 	free(reply);
 
 	return ret;
 }
 
+static xcb_window_t find_client_win(session_t *ps, xcb_window_t w) {
+	struct client_win_query q;
+	client_win_query_send(ps, w, &q);
+	return find_client_win_reply(ps, w, &q);
+}
+
 /**
  * Recheck client window of a window.
  *
@@ -815,9 +914,7 @@ void free_win_res(session_t *ps, struct managed_win *w) {
 /// New window will be in unmapped state
 static struct win *add_win(session_t *ps, xcb_window_t id, struct list_node *prev) {
 	log_debug("Adding window %#010x", id);
-	struct win *old_w = NULL;
-	HASH_FIND_INT(ps->windows, &id, old_w);
-	assert(old_w == NULL);
+	assert(xid_map_get(&ps->windows, id) == NULL);
 
 	auto new_w = cmalloc(struct win);
 	list_insert_after(prev, &new_w->stack_neighbour);
@@ -826,7 +923,7 @@ static struct win *add_win(session_t *ps, xcb_window_t id, struct list_node *pre
 	new_w->is_new = true;
 	new_w->destroyed = false;
 
-	HASH_ADD_INT(ps->windows, id, new_w);
+	xid_map_set(&ps->windows, id, new_w);
 	ps->pending_updates = true;
 	return new_w;
 }
@@ -839,8 +936,7 @@ struct win *add_win_top(session_t *ps, xcb_window_t id) {
 /// Insert a new window above window with id `below`, if there is no window, add
 /// to top New window will be in unmapped state
 struct win *add_win_above(session_t *ps, xcb_window_t id, xcb_window_t below) {
-	struct win *w = NULL;
-	HASH_FIND_INT(ps->windows, &below, w);
+	struct win *w = xid_map_get(&ps->windows, below);
 	if (!w) {
 		if (!list_is_empty(&ps->window_stack)) {
 			// `below` window is not found even if the window stack is
@@ -934,7 +1030,8 @@ struct win *fill_win(session_t *ps, struct win *w) {
 	log_debug("Managing window %#010x", w->id);
 	xcb_get_window_attributes_cookie_t acookie = xcb_get_window_attributes(ps->c, w->id);
 	xcb_get_window_attributes_reply_t *a =
-	    xcb_get_window_attributes_reply(ps->c, acookie, NULL);
+	    X_ROUNDTRIP("xcb_get_window_attributes",
+	                xcb_get_window_attributes_reply(ps->c, acookie, NULL));
 	if (!a || a->map_state == XCB_MAP_STATE_UNVIEWABLE) {
 		// Failed to get window attributes or geometry probably means
 		// the window is gone already. Unviewable means the window is
@@ -961,6 +1058,7 @@ struct win *fill_win(session_t *ps, struct win *w) {
 	// We only need to initialize the part that are not initialized
 	// by map_win
 	*new = win_def;
+	new->stats.since = get_time_ns();
 	new->base = *w;
 	new->base.managed = true;
 	new->a = *a;
@@ -969,7 +1067,9 @@ struct win *fill_win(session_t *ps, struct win *w) {
 	free(a);
 
 	xcb_generic_error_t *e;
-	auto g = xcb_get_geometry_reply(ps->c, xcb_get_geometry(ps->c, w->id), &e);
+	auto g = X_ROUNDTRIP(
+	    "xcb_get_geometry",
+	    xcb_get_geometry_reply(ps->c, xcb_get_geometry(ps->c, w->id), &e));
 	if (!g) {
 		log_error("Failed to get geometry of window %#010x", w->id);
 		free(e);
@@ -981,15 +1081,36 @@ struct win *fill_win(session_t *ps, struct win *w) {
 	    .y = g->y,
 	    .width = g->width,
 	    .height = g->height,
+	    .border_width = g->border_width,
 	};
 
+	if (event_record_enabled()) {
+		xcb_window_t below = XCB_NONE;
+		if (!list_node_is_last(&ps->window_stack, &w->stack_neighbour)) {
+			below = list_next_entry(w, stack_neighbour)->id;
+		}
+		event_record_window_(&(struct event_record_window){
+		    .id = w->id,
+		    .below = below,
+		    .x = g->x,
+		    .y = g->y,
+		    .width = g->width,
+		    .height = g->height,
+		    .border_width = g->border_width,
+		    .depth = g->depth,
+		    .map_state = new->a.map_state,
+		    .override_redirect = new->a.override_redirect,
+		});
+	}
+
 	free(g);
 
 	// Create Damage for window (if not Input Only)
 	new->damage = x_new_id(ps->c);
-	e = xcb_request_check(
-	    ps->c, xcb_damage_create_checked(ps->c, new->damage, w->id,
-	                                     XCB_DAMAGE_REPORT_LEVEL_NON_EMPTY));
+	e = X_ROUNDTRIP("xcb_damage_create",
+	                xcb_request_check(ps->c, xcb_damage_create_checked(
+	                                             ps->c, new->damage, w->id,
+	                                             XCB_DAMAGE_REPORT_LEVEL_NON_EMPTY)));
 	if (e) {
 		log_error("Failed to create damage");
 		free(e);
@@ -1011,8 +1132,7 @@ struct win *fill_win(session_t *ps, struct win *w) {
 	new->client_pictfmt = NULL;
 
 	list_replace(&w->stack_neighbour, &new->base.stack_neighbour);
-	struct win *replaced = NULL;
-	HASH_REPLACE_INT(ps->windows, id, &new->base, replaced);
+	attr_unused struct win *replaced = xid_map_set(&ps->windows, w->id, &new->base);
 	assert(replaced == w);
 	free(w);
 
@@ -1211,9 +1331,13 @@ void win_update_bounding_shape(session_t *ps, struct managed_win *w) {
 		 * as well as not generate a region.
 		 */
 
-		xcb_shape_get_rectangles_reply_t *r = xcb_shape_get_rectangles_reply(
-		    ps->c,
-		    xcb_shape_get_rectangles(ps->c, w->base.id, XCB_SHAPE_SK_BOUNDING), NULL);
+		xcb_shape_get_rectangles_reply_t *r = X_ROUNDTRIP(
+		    "xcb_shape_get_rectangles",
+		    xcb_shape_get_rectangles_reply(
+		        ps->c,
+		        xcb_shape_get_rectangles(ps->c, w->base.id,
+		                                 XCB_SHAPE_SK_BOUNDING),
+		        NULL));
 
 		if (!r) {
 			break;
@@ -1227,6 +1351,8 @@ void win_update_bounding_shape(session_t *ps, struct managed_win *w) {
 		region_t br;
 		pixman_region32_init_rects(&br, rects, nrects);
 		free(rects);
+		// The rectangles are relative to the inside of the border
+		pixman_region32_translate(&br, w->g.border_width, w->g.border_width);
 
 		// Intersect the bounding region we got with the window rectangle,
 		// to make sure the bounding region is not bigger than the window
@@ -1453,8 +1579,7 @@ void restack_above(session_t *ps, struct win *w, xcb_window_t below) {
 		if (!below) {
 			new_next = &ps->window_stack;
 		} else {
-			struct win *tmp_w = NULL;
-			HASH_FIND_INT(ps->windows, &below, tmp_w);
+			struct win *tmp_w = xid_map_get(&ps->windows, below);
 
 			if (!tmp_w) {
 				log_error("Failed to found new below window %#010x.", below);
@@ -1497,7 +1622,7 @@ bool destroy_win_start(session_t *ps, struct win *w) {
 	// stack if it's managed and mapped, since we might still need to render
 	// it (e.g. fading out). Window will be removed from the stack when it
 	// finishes destroying.
-	HASH_DEL(ps->windows, w);
+	xid_map_remove(&ps->windows, w->id);
 
 	if (!w->managed || mw->state == WSTATE_UNMAPPED) {
 		// Window is already unmapped, or is an unmanged window, just
@@ -1622,6 +1747,43 @@ void win_update_monitor(int nmons, region_t *mons, struct managed_win *mw) {
 	          mw->base.id, mw->name, mw->g.x, mw->g.y, mw->width, mw->height);
 }
 
+void win_set_pending_geometry(session_t *ps, struct managed_win *mw, int16_t x, int16_t y,
+                              uint16_t width, uint16_t height, uint16_t border_width) {
+	// We check against pending_g here, because there might have been multiple
+	// configure notifies in this cycle, or the window could receive multiple updates
+	// while it's unmapped.
+	bool position_changed = mw->pending_g.x != x || mw->pending_g.y != y;
+	bool size_changed = mw->pending_g.width != width ||
+	                    mw->pending_g.height != height ||
+	                    mw->pending_g.border_width != border_width;
+	if (!position_changed && !size_changed) {
+		return;
+	}
+
+	// Queue pending updates
+	win_set_flags(mw, WIN_FLAGS_FACTOR_CHANGED);
+	// TODO(yshui) don't set pending_updates if the window is not
+	// visible/mapped
+	ps->pending_updates = true;
+
+	// At least one of the following if's is true
+	if (position_changed) {
+		mw->pending_g.x = x;
+		mw->pending_g.y = y;
+		win_set_flags(mw, WIN_FLAGS_POSITION_STALE);
+	}
+
+	if (size_changed) {
+		mw->pending_g.width = width;
+		mw->pending_g.height = height;
+		mw->pending_g.border_width = border_width;
+		win_set_flags(mw, WIN_FLAGS_SIZE_STALE);
+	}
+
+	// Recalculate which monitor this window is on
+	win_update_monitor(ps->randr_nmonitors, ps->randr_monitor_regs, mw);
+}
+
 /// Map an already registered window
 void map_win_start(session_t *ps, struct managed_win *w) {
 	assert(ps->server_grabbed);
@@ -1697,8 +1859,7 @@ struct win *find_win(session_t *ps, xcb_window_t id) {
 		return NULL;
 	}
 
-	struct win *w = NULL;
-	HASH_FIND_INT(ps->windows, &id, w);
+	struct win *w = xid_map_get(&ps->windows, id);
 	assert(w == NULL || !w->destroyed);
 	return w;
 }
@@ -1728,7 +1889,7 @@ struct managed_win *find_toplevel(session_t *ps, xcb_window_t id) {
 		return NULL;
 	}
 
-	HASH_ITER2(ps->windows, w) {
+	xid_map_foreach(&ps->windows, struct win, w) {
 		assert(!w->destroyed);
 		if (!w->managed) {
 			continue;
@@ -1763,7 +1924,9 @@ struct managed_win *find_managed_window_or_parent(session_t *ps, xcb_window_t wi
 		// xcb_query_tree probably fails if you run picom when X is
 		// somehow initializing (like add it in .xinitrc). In this case
 		// just leave it alone.
-		auto reply = xcb_query_tree_reply(ps->c, xcb_query_tree(ps->c, wid), NULL);
+		auto reply = X_ROUNDTRIP(
+		    "xcb_query_tree",
+		    xcb_query_tree_reply(ps->c, xcb_query_tree(ps->c, wid), NULL));
 		if (reply == NULL) {
 			break;
 		}
@@ -1795,7 +1958,8 @@ static inline bool
 win_is_fullscreen_xcb(xcb_connection_t *c, const struct atom *a, const xcb_window_t w) {
 	xcb_get_property_cookie_t prop =
 	    xcb_get_property(c, 0, w, a->a_NET_WM_STATE, XCB_ATOM_ATOM, 0, 12);
-	xcb_get_property_reply_t *reply = xcb_get_property_reply(c, prop, NULL);
+	xcb_get_property_reply_t *reply =
+	    X_ROUNDTRIP("xcb_get_property", xcb_get_property_reply(c, prop, NULL));
 	if (!reply) {
 		return false;
 	}
@@ -1926,3 +2090,59 @@ bool win_is_mapped_in_x(const struct managed_win *w) {
 	return w->state == WSTATE_MAPPING || w->state == WSTATE_MAPPED ||
 	       (w->flags & WIN_FLAGS_MAPPED);
 }
+
+uint64_t win_texture_bytes(const struct managed_win *w) {
+	if (!w->win_image) {
+		return 0;
+	}
+	// Assume the backend stores 4 bytes per pixel
+	return (uint64_t)w->width * (uint64_t)w->height * 4;
+}
+
+/// Cost of a window used to sort the windows in win_stats_print, i.e. the time the
+/// compositor has spent on the window.
+static inline uint64_t win_stats_cost(const struct managed_win *w) {
+	return w->stats.bind_ns + w->stats.compose_ns;
+}
+
+static int win_stats_cmp(const void *a, const void *b) {
+	auto x = win_stats_cost(*(struct managed_win *const *)a);
+	auto y = win_stats_cost(*(struct managed_win *const *)b);
+	return (x < y) - (x > y);
+}
+
+void win_stats_print(session_t *ps, FILE *f) {
+	size_t nwins = 0;
+	win_stack_foreach_managed(w, &ps->window_stack) {
+		nwins++;
+	}
+
+	auto wins = ccalloc(nwins, struct managed_win *);
+	nwins = 0;
+	win_stack_foreach_managed(w, &ps->window_stack) {
+		wins[nwins++] = w;
+	}
+	qsort(wins, nwins, sizeof(*wins), win_stats_cmp);
+
+	auto now = get_time_ns();
+	uint64_t total_texture_bytes = 0;
+	fprintf(f, "%zu managed windows, most expensive first:\n", nwins);
+	for (size_t i = 0; i < nwins; i++) {
+		auto w = wins[i];
+		auto seconds = (double)(now - w->stats.since) / 1e9;
+		auto damage_rate = seconds > 0 ? (double)w->stats.ndamage / seconds : 0;
+		auto texture_bytes = win_texture_bytes(w);
+		total_texture_bytes += texture_bytes;
+		fprintf(f,
+		        "%#010x (%s): damage %.1f/s, %" PRIu64 " pixels damaged; "
+		        "%" PRIu64 " binds, %.3f ms binding; %" PRIu64 " composes, "
+		        "%" PRIu64 " rects, %.3f ms composing; texture %" PRIu64 " KiB\n",
+		        w->base.id, w->name ? w->name : "", damage_rate,
+		        w->stats.damaged_area, w->stats.nbind, (double)w->stats.bind_ns / 1e6,
+		        w->stats.ncompose, w->stats.compose_rects,
+		        (double)w->stats.compose_ns / 1e6, texture_bytes / 1024);
+	}
+	fprintf(f, "Estimated total texture memory: %" PRIu64 " KiB\n",
+	        total_texture_bytes / 1024);
+	free(wins);
+}
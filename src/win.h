@@ -9,7 +9,6 @@
 
 #include <backend/backend.h>
 
-#include "uthash_extra.h"
 
 // FIXME shouldn't need this
 #include <GL/gl.h>
@@ -59,7 +58,6 @@ struct window_stack_entry {
 /// Structure representing a top-level managed window.
 typedef struct win win;
 struct win {
-	UT_hash_handle hh;
 	struct list_node stack_neighbour;
 	/// ID of the top-level frame window.
 	xcb_window_t id;
@@ -78,6 +76,27 @@ struct win_geometry {
 	int16_t y;
 	uint16_t width;
 	uint16_t height;
+	uint16_t border_width;
+};
+
+/// Counters of the work a window has caused the compositor, since `since`.
+struct win_stats {
+	/// When the counting started
+	uint64_t since;
+	/// Number of damage notifications received
+	uint64_t ndamage;
+	/// Total number of pixels damaged
+	uint64_t damaged_area;
+	/// Number of times the window pixmap was bound
+	uint64_t nbind;
+	/// Time spent binding the window pixmap
+	uint64_t bind_ns;
+	/// Number of times the window was composed onto the screen
+	uint64_t ncompose;
+	/// Total number of rectangles composed
+	uint64_t compose_rects;
+	/// Time spent issuing the compose calls
+	uint64_t compose_ns;
 };
 
 struct managed_win {
@@ -176,6 +195,9 @@ struct managed_win {
 
 	/// Frame extents. Acquired from _NET_FRAME_EXTENTS.
 	margin_t frame_extents;
+
+	/// Performance counters
+	struct win_stats stats;
 };
 
 /// Process pending updates/images flags on a window. Has to be called in X critical
@@ -201,6 +223,10 @@ bool must_use destroy_win_start(session_t *ps, struct win *w);
 /// used when de-initializing the backend outside of win.c
 void win_release_images(struct backend_base *base, struct managed_win *w);
 winmode_t attr_pure win_calc_mode(const struct managed_win *w);
+/// Estimate the memory used by the image of the window in the backend.
+uint64_t win_texture_bytes(const struct managed_win *w);
+/// Print the performance counters of all managed windows to `f`, most expensive first.
+void win_stats_print(session_t *ps, FILE *f);
 /**
  * Set real focused state of a window.
  */
@@ -216,6 +242,10 @@ void win_recheck_client(session_t *ps, struct managed_win *w);
 // TODO(absolutelynothelix): rename to x_update_win_(randr_?)monitor and move to
 // the x.h.
 void win_update_monitor(int nmons, region_t *mons, struct managed_win *mw);
+/// Record the geometry of `w` reported by the X server. It's applied in the next
+/// update cycle if it's different from the pending one.
+void win_set_pending_geometry(session_t *ps, struct managed_win *w, int16_t x, int16_t y,
+                              uint16_t width, uint16_t height, uint16_t border_width);
 
 /**
  * Retrieve the bounding shape of a window.
@@ -245,6 +275,9 @@ void win_get_region_noframe_local(const struct managed_win *w, region_t *);
 void win_get_region_frame_local(const struct managed_win *w, region_t *res);
 /// Get the region for the frame of the window, by value
 region_t win_get_region_frame_local_by_val(const struct managed_win *w);
+/// Get the region of a window nothing below it shows through, according to its mode,
+/// in global coordinates. `res` must be initialized.
+void win_get_opaque_region_global(const struct managed_win *w, region_t *res);
 /// Insert a new window above window with id `below`, if there is no window, add to top
 /// New window will be in unmapped state
 struct win *add_win_above(session_t *ps, xcb_window_t id, xcb_window_t below);
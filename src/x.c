@@ -1,5 +1,6 @@
 // SPDX-License-Identifier: MPL-2.0
 // Copyright (c) 2018 Yuxuan Shui <yshuiv7@gmail.com>
+#include <inttypes.h>
 #include <stdalign.h>
 #include <stdbool.h>
 #include <stdlib.h>
@@ -18,10 +19,12 @@
 
 #include "atom.h"
 #include "backend/gl/glx.h"
+#include "cache.h"
 #include "common.h"
 #include "compiler.h"
 #include "log.h"
 #include "region.h"
+#include "trace.h"
 #include "utils.h"
 #include "x.h"
 
@@ -42,11 +45,13 @@
  */
 winprop_t x_get_prop_with_offset(xcb_connection_t *c, xcb_window_t w, xcb_atom_t atom,
                                  int offset, int length, xcb_atom_t rtype, int rformat) {
-	xcb_get_property_reply_t *r = xcb_get_property_reply(
-	    c,
-	    xcb_get_property(c, 0, w, atom, rtype, to_u32_checked(offset),
-	                     to_u32_checked(length)),
-	    NULL);
+	xcb_get_property_reply_t *r = X_ROUNDTRIP(
+	    "xcb_get_property",
+	    xcb_get_property_reply(
+	        c,
+	        xcb_get_property(c, 0, w, atom, rtype, to_u32_checked(offset),
+	                         to_u32_checked(length)),
+	        NULL));
 
 	if (r && xcb_get_property_value_length(r) &&
 	    (rtype == XCB_GET_PROPERTY_TYPE_ANY || r->type == rtype) &&
@@ -70,8 +75,10 @@ winprop_t x_get_prop_with_offset(xcb_connection_t *c, xcb_window_t w, xcb_atom_t
 /// Get the type, format and size in bytes of a window's specific attribute.
 winprop_info_t x_get_prop_info(xcb_connection_t *c, xcb_window_t w, xcb_atom_t atom) {
 	xcb_generic_error_t *e = NULL;
-	auto r = xcb_get_property_reply(
-	    c, xcb_get_property(c, 0, w, atom, XCB_ATOM_ANY, 0, 0), &e);
+	auto r = X_ROUNDTRIP(
+	    "xcb_get_property",
+	    xcb_get_property_reply(
+	        c, xcb_get_property(c, 0, w, atom, XCB_ATOM_ANY, 0, 0), &e));
 	if (!r) {
 		log_debug("Failed to get property info for window %#010x", w);
 		free(e);
@@ -106,18 +113,35 @@ xcb_window_t wid_get_prop_window(xcb_connection_t *c, xcb_window_t wid, xcb_atom
 	return p;
 }
 
+/// Length in 32-bit words of the first request for a text property, long enough for
+/// any window title seen in practice.
+#define TEXT_PROP_FETCH_WORDS 1024
+
 /**
  * Get the value of a text property of a window.
  */
 bool wid_get_text_prop(session_t *ps, xcb_window_t wid, xcb_atom_t prop, char ***pstrlst,
                        int *pnstr) {
 	assert(ps->server_grabbed);
-	auto prop_info = x_get_prop_info(ps->c, wid, prop);
-	auto type = prop_info.type;
-	auto format = prop_info.format;
-	auto length = prop_info.length;
+	// Most text properties are short, so fetch them whole with a single request, and
+	// only ask again if there turns out to be more
+	xcb_generic_error_t *e = NULL;
+	auto r = X_ROUNDTRIP(
+	    "xcb_get_property",
+	    xcb_get_property_reply(ps->c,
+	                           xcb_get_property(ps->c, 0, wid, prop, XCB_ATOM_ANY, 0,
+	                                            TEXT_PROP_FETCH_WORDS),
+	                           &e));
+	if (!r) {
+		log_debug("Failed to get window property for %#010x", wid);
+		free(e);
+		return false;
+	}
 
+	auto type = r->type;
+	auto format = r->format;
 	if (type == XCB_ATOM_NONE) {
+		free(r);
 		return false;
 	}
 
@@ -125,26 +149,35 @@ bool wid_get_text_prop(session_t *ps, xcb_window_t wid, xcb_atom_t prop, char **
 	    type != ps->atoms->aC_STRING) {
 		log_warn("Text property %d of window %#010x has unsupported type: %d",
 		         prop, wid, type);
+		free(r);
 		return false;
 	}
 
 	if (format != 8) {
 		log_warn("Text property %d of window %#010x has unexpected format: %d",
 		         prop, wid, format);
+		free(r);
 		return false;
 	}
 
-	xcb_generic_error_t *e = NULL;
-	auto word_count = (length + 4 - 1) / 4;
-	auto r = xcb_get_property_reply(
-	    ps->c, xcb_get_property(ps->c, 0, wid, prop, type, 0, word_count), &e);
-	if (!r) {
-		log_debug("Failed to get window property for %#010x", wid);
-		free(e);
-		return false;
+	if (r->bytes_after > 0) {
+		// The server is grabbed, so the property can't have changed in between
+		auto word_count =
+		    ((uint32_t)xcb_get_property_value_length(r) + r->bytes_after + 3) / 4;
+		free(r);
+		r = X_ROUNDTRIP(
+		    "xcb_get_property",
+		    xcb_get_property_reply(
+		        ps->c, xcb_get_property(ps->c, 0, wid, prop, type, 0, word_count),
+		        &e));
+		if (!r) {
+			log_debug("Failed to get window property for %#010x", wid);
+			free(e);
+			return false;
+		}
 	}
 
-	assert(length == (uint32_t)xcb_get_property_value_length(r));
+	auto length = (uint32_t)xcb_get_property_value_length(r);
 
 	void *data = xcb_get_property_value(r);
 	unsigned int nstr = 0;
@@ -201,21 +234,24 @@ static inline void x_get_server_pictfmts(xcb_connection_t *c) {
 	}
 	xcb_generic_error_t *e = NULL;
 	// Get window picture format
-	g_pictfmts =
-	    xcb_render_query_pict_formats_reply(c, xcb_render_query_pict_formats(c), &e);
+	g_pictfmts = X_ROUNDTRIP(
+	    "xcb_render_query_pict_formats",
+	    xcb_render_query_pict_formats_reply(c, xcb_render_query_pict_formats(c), &e));
 	if (e || !g_pictfmts) {
 		log_fatal("failed to get pict formats\n");
 		abort();
 	}
 }
 
-const xcb_render_pictforminfo_t *
-x_get_pictform_for_visual(xcb_connection_t *c, xcb_visualid_t visual) {
-	x_get_server_pictfmts(c);
-
-	xcb_render_pictvisual_t *pv = xcb_render_util_find_visual_format(g_pictfmts, visual);
+static const xcb_render_pictforminfo_t *
+x_find_pictform_for_visual(xcb_render_query_pict_formats_reply_t *r,
+                           xcb_visualid_t visual) {
+	xcb_render_pictvisual_t *pv = xcb_render_util_find_visual_format(r, visual);
+	if (!pv) {
+		return NULL;
+	}
 	for (xcb_render_pictforminfo_iterator_t i =
-	         xcb_render_query_pict_formats_formats_iterator(g_pictfmts);
+	         xcb_render_query_pict_formats_formats_iterator(r);
 	     i.rem; xcb_render_pictforminfo_next(&i)) {
 		if (i.data->id == pv->format) {
 			return i.data;
@@ -224,6 +260,109 @@ x_get_pictform_for_visual(xcb_connection_t *c, xcb_visualid_t visual) {
 	return NULL;
 }
 
+// Everything we need to know about the visuals, keyed by visual ID. Like the pict
+// formats, the visuals don't change during the lifetime of the connection, so all of
+// them are added when the table is built.
+static thread_local struct cache *g_visuals = NULL;
+
+/// Depth of `visual`, or -1 if the visual doesn't exist.
+static int x_find_visual_depth(xcb_connection_t *c, xcb_visualid_t visual) {
+	for (auto screen = xcb_setup_roots_iterator(xcb_get_setup(c)); screen.rem;
+	     xcb_screen_next(&screen)) {
+		for (auto depth = xcb_screen_allowed_depths_iterator(screen.data);
+		     depth.rem; xcb_depth_next(&depth)) {
+			const int len = xcb_depth_visuals_length(depth.data);
+			const xcb_visualtype_t *visuals = xcb_depth_visuals(depth.data);
+			for (int i = 0; i < len; i++) {
+				if (visuals[i].visual_id == visual) {
+					return depth.data->depth;
+				}
+			}
+		}
+	}
+	return -1;
+}
+
+static void *
+x_visual_getter(void *ud, const void *key, size_t key_size attr_unused, int *err) {
+	xcb_connection_t *c = ud;
+	uint64_t id;
+	memcpy(&id, key, sizeof(id));
+	auto visual = (xcb_visualid_t)id;
+	auto depth = x_find_visual_depth(c, visual);
+	if (depth < 0) {
+		*err = 1;
+		return NULL;
+	}
+
+	auto entry = ccalloc(1, struct x_visual_entry);
+	auto pictfmt = x_find_pictform_for_visual(g_pictfmts, visual);
+	entry->pictfmt = pictfmt;
+	entry->info = (struct xvisual_info){-1, -1, -1, -1, depth, visual};
+	if (pictfmt && pictfmt->type == XCB_RENDER_PICT_TYPE_DIRECT) {
+		entry->info.red_size = popcntul(pictfmt->direct.red_mask);
+		entry->info.green_size = popcntul(pictfmt->direct.green_mask);
+		entry->info.blue_size = popcntul(pictfmt->direct.blue_mask);
+		entry->info.alpha_size = popcntul(pictfmt->direct.alpha_mask);
+	}
+	return entry;
+}
+
+static void x_visual_free(void *ud attr_unused, void *data) {
+	struct x_visual_entry *entry = data;
+	free(entry->fbconfig);
+	free(entry);
+}
+
+void x_init_visual_table(xcb_connection_t *c) {
+	if (g_visuals) {
+		return;
+	}
+	x_get_server_pictfmts(c);
+
+	g_visuals = new_cache(c, x_visual_getter, x_visual_free);
+	size_t nvisuals = 0;
+	for (auto screen = xcb_setup_roots_iterator(xcb_get_setup(c)); screen.rem;
+	     xcb_screen_next(&screen)) {
+		for (auto depth = xcb_screen_allowed_depths_iterator(screen.data);
+		     depth.rem; xcb_depth_next(&depth)) {
+			const int len = xcb_depth_visuals_length(depth.data);
+			const xcb_visualtype_t *visuals = xcb_depth_visuals(depth.data);
+			for (int i = 0; i < len; i++) {
+				cache_get_int(g_visuals, visuals[i].visual_id, NULL);
+			}
+			nvisuals += (size_t)len;
+		}
+	}
+	log_debug("Built the visual table, %zu visuals", nvisuals);
+}
+
+void x_free_visual_table(void) {
+	if (g_visuals) {
+		auto stats = cache_get_stats(g_visuals);
+		log_debug("Visual table: %" PRIu64 " hits, %" PRIu64 " misses",
+		          stats->hits, stats->misses);
+		cache_free(g_visuals);
+		g_visuals = NULL;
+	}
+	free(g_pictfmts);
+	g_pictfmts = NULL;
+}
+
+struct x_visual_entry *x_get_visual_entry(xcb_connection_t *c, xcb_visualid_t visual) {
+	x_init_visual_table(c);
+	if (visual == XCB_NONE) {
+		return NULL;
+	}
+	return cache_get_int(g_visuals, visual, NULL);
+}
+
+const xcb_render_pictforminfo_t *
+x_get_pictform_for_visual(xcb_connection_t *c, xcb_visualid_t visual) {
+	auto entry = x_get_visual_entry(c, visual);
+	return entry ? entry->pictfmt : NULL;
+}
+
 static xcb_visualid_t attr_pure x_get_visual_for_pictfmt(xcb_render_query_pict_formats_reply_t *r,
                                                          xcb_render_pictformat_t fmt) {
 	for (auto screen = xcb_render_query_pict_formats_screens_iterator(r); screen.rem;
@@ -250,21 +389,8 @@ xcb_visualid_t x_get_visual_for_standard(xcb_connection_t *c, xcb_pict_standard_
 }
 
 int x_get_visual_depth(xcb_connection_t *c, xcb_visualid_t visual) {
-	auto setup = xcb_get_setup(c);
-	for (auto screen = xcb_setup_roots_iterator(setup); screen.rem;
-	     xcb_screen_next(&screen)) {
-		for (auto depth = xcb_screen_allowed_depths_iterator(screen.data);
-		     depth.rem; xcb_depth_next(&depth)) {
-			const int len = xcb_depth_visuals_length(depth.data);
-			const xcb_visualtype_t *visuals = xcb_depth_visuals(depth.data);
-			for (int i = 0; i < len; i++) {
-				if (visual == visuals[i].visual_id) {
-					return depth.data->depth;
-				}
-			}
-		}
-	}
-	return -1;
+	auto entry = x_get_visual_entry(c, visual);
+	return entry ? entry->info.visual_depth : -1;
 }
 
 xcb_render_picture_t
@@ -282,9 +408,11 @@ x_create_picture_with_pictfmt_and_pixmap(xcb_connection_t *c,
 	}
 
 	xcb_render_picture_t tmp_picture = x_new_id(c);
-	xcb_generic_error_t *e =
-	    xcb_request_check(c, xcb_render_create_picture_checked(
-	                             c, tmp_picture, pixmap, pictfmt->id, valuemask, buf));
+	xcb_generic_error_t *e = X_ROUNDTRIP(
+	    "xcb_render_create_picture",
+	    xcb_request_check(c, xcb_render_create_picture_checked(c, tmp_picture, pixmap,
+	                                                           pictfmt->id, valuemask,
+	                                                           buf)));
 	free(buf);
 	if (e) {
 		log_error("failed to create picture");
@@ -334,8 +462,9 @@ x_create_picture_with_visual(xcb_connection_t *c, xcb_drawable_t d, int w, int h
 
 bool x_fetch_region(xcb_connection_t *c, xcb_xfixes_region_t r, pixman_region32_t *res) {
 	xcb_generic_error_t *e = NULL;
-	xcb_xfixes_fetch_region_reply_t *xr =
-	    xcb_xfixes_fetch_region_reply(c, xcb_xfixes_fetch_region(c, r), &e);
+	xcb_xfixes_fetch_region_reply_t *xr = X_ROUNDTRIP(
+	    "xcb_xfixes_fetch_region",
+	    xcb_xfixes_fetch_region_reply(c, xcb_xfixes_fetch_region(c, r), &e));
 	if (!xr) {
 		log_error("Failed to fetch rectangles");
 		return false;
@@ -480,7 +609,8 @@ xcb_pixmap_t x_create_pixmap(xcb_connection_t *c, uint8_t depth, xcb_drawable_t
 	xcb_pixmap_t pix = x_new_id(c);
 	xcb_void_cookie_t cookie = xcb_create_pixmap_checked(
 	    c, depth, pix, drawable, to_u16_checked(width), to_u16_checked(height));
-	xcb_generic_error_t *err = xcb_request_check(c, cookie);
+	xcb_generic_error_t *err =
+	    X_ROUNDTRIP("xcb_create_pixmap", xcb_request_check(c, cookie));
 	if (err == NULL) {
 		return pix;
 	}
@@ -501,7 +631,9 @@ bool x_validate_pixmap(xcb_connection_t *c, xcb_pixmap_t pixmap) {
 		return false;
 	}
 
-	auto r = xcb_get_geometry_reply(c, xcb_get_geometry(c, pixmap), NULL);
+	auto r = X_ROUNDTRIP(
+	    "xcb_get_geometry",
+	    xcb_get_geometry_reply(c, xcb_get_geometry(c, pixmap), NULL));
 	if (!r) {
 		return false;
 	}
@@ -548,66 +680,52 @@ bool x_is_root_back_pixmap_atom(struct atom *atoms, xcb_atom_t atom) {
 }
 
 /**
- * Synchronizes a X Render drawable to ensure all pending painting requests
- * are completed.
+ * Make the X server finish all pending painting requests before it handles any
+ * request sent after this, without waiting for the server.
+ *
+ * The fences are used in turn. A fence is triggered and awaited, and only reset right
+ * before it is triggered again, SYNC_FENCE_COUNT frames later, long after the server
+ * is done with the await. None of the requests is checked, if one of them fails,
+ * handle_error stops using the fences.
  */
-bool x_fence_sync(xcb_connection_t *c, xcb_sync_fence_t f) {
-	// TODO(richardgv): If everybody just follows the rules stated in X Sync
-	// prototype, we need only one fence per screen, but let's stay a bit
-	// cautious right now
-
-	auto e = xcb_request_check(c, xcb_sync_trigger_fence_checked(c, f));
-	if (e) {
-		log_error("Failed to trigger the fence");
-		goto err;
-	}
-
-	e = xcb_request_check(c, xcb_sync_await_fence_checked(c, 1, &f));
-	if (e) {
-		log_error("Failed to await on a fence");
-		goto err;
-	}
-
-	e = xcb_request_check(c, xcb_sync_reset_fence_checked(c, f));
-	if (e) {
-		log_error("Failed to reset the fence");
-		goto err;
+void x_fence_sync(session_t *ps) {
+	auto i = ps->sync_fence_index;
+	auto f = ps->sync_fences[i];
+	if (f == XCB_NONE) {
+		return;
 	}
-	return true;
 
-err:
-	free(e);
-	return false;
+	trace_begin("x", "x_fence_sync");
+	if (ps->sync_fences_triggered & (1U << i)) {
+		set_reply_action(ps, xcb_sync_reset_fence(ps->c, f).sequence,
+		                 PENDING_REPLY_ACTION_DISABLE_SYNC_FENCE);
+	}
+	set_reply_action(ps, xcb_sync_trigger_fence(ps->c, f).sequence,
+	                 PENDING_REPLY_ACTION_DISABLE_SYNC_FENCE);
+	set_reply_action(ps, xcb_sync_await_fence(ps->c, 1, &f).sequence,
+	                 PENDING_REPLY_ACTION_DISABLE_SYNC_FENCE);
+	// The X server has to see the requests before GL samples the pixmaps, don't
+	// leave them in the output buffer
+	xcb_flush(ps->c);
+	ps->sync_fences_triggered |= 1U << i;
+	ps->sync_fence_index = (i + 1) % SYNC_FENCE_COUNT;
+	trace_end("x", "x_fence_sync");
 }
 
 /// Generate a search criteria for fbconfig from a X visual.
 /// Returns {-1, -1, -1, -1, -1, 0} on failure
 struct xvisual_info x_get_visual_info(xcb_connection_t *c, xcb_visualid_t visual) {
-	auto pictfmt = x_get_pictform_for_visual(c, visual);
-	auto depth = x_get_visual_depth(c, visual);
-	if (!pictfmt || depth == -1) {
+	auto entry = x_get_visual_entry(c, visual);
+	if (!entry || !entry->pictfmt) {
 		log_error("Invalid visual %#03x", visual);
 		return (struct xvisual_info){-1, -1, -1, -1, -1, 0};
 	}
-	if (pictfmt->type != XCB_RENDER_PICT_TYPE_DIRECT) {
+	if (entry->pictfmt->type != XCB_RENDER_PICT_TYPE_DIRECT) {
 		log_error("We cannot handle non-DirectColor visuals. Report an "
 		          "issue if you see this error message.");
 		return (struct xvisual_info){-1, -1, -1, -1, -1, 0};
 	}
-
-	int red_size = popcntul(pictfmt->direct.red_mask),
-	    blue_size = popcntul(pictfmt->direct.blue_mask),
-	    green_size = popcntul(pictfmt->direct.green_mask),
-	    alpha_size = popcntul(pictfmt->direct.alpha_mask);
-
-	return (struct xvisual_info){
-	    .red_size = red_size,
-	    .green_size = green_size,
-	    .blue_size = blue_size,
-	    .alpha_size = alpha_size,
-	    .visual_depth = depth,
-	    .visual = visual,
-	};
+	return entry->info;
 }
 
 xcb_screen_t *x_screen_of_display(xcb_connection_t *c, int screen) {
@@ -630,8 +748,10 @@ void x_update_randr_monitors(session_t *ps) {
 		return;
 	}
 
-	xcb_randr_get_monitors_reply_t *r = xcb_randr_get_monitors_reply(
-	    ps->c, xcb_randr_get_monitors(ps->c, ps->root, true), NULL);
+	xcb_randr_get_monitors_reply_t *r = X_ROUNDTRIP(
+	    "xcb_randr_get_monitors",
+	    xcb_randr_get_monitors_reply(
+	        ps->c, xcb_randr_get_monitors(ps->c, ps->root, true), NULL));
 	if (!r) {
 		return;
 	}
@@ -659,3 +779,88 @@ void x_free_randr_info(session_t *ps) {
 	}
 	ps->randr_nmonitors = 0;
 }
+
+/// All the call sites that have made a round trip so far
+static struct x_roundtrip_site *x_roundtrip_sites = NULL;
+/// Totals of the current frame
+static struct x_roundtrip_totals x_roundtrip_frame_totals = {0};
+/// Totals since the start
+static struct x_roundtrip_totals x_roundtrip_all_totals = {0};
+
+uint64_t x_roundtrip_begin(struct x_roundtrip_site *site) {
+	if (!site->registered) {
+		site->next = x_roundtrip_sites;
+		x_roundtrip_sites = site;
+		site->registered = true;
+	}
+	trace_begin("x", site->name);
+	return get_time_ns();
+}
+
+void x_roundtrip_end(struct x_roundtrip_site *site, uint64_t start) {
+	auto elapsed = get_time_ns() - start;
+	trace_end("x", site->name);
+	site->count++;
+	site->total_ns += elapsed;
+	site->frame_count++;
+	site->frame_ns += elapsed;
+	x_roundtrip_frame_totals.count++;
+	x_roundtrip_frame_totals.ns += elapsed;
+	x_roundtrip_all_totals.count++;
+	x_roundtrip_all_totals.ns += elapsed;
+}
+
+struct x_roundtrip_totals x_roundtrip_frame_end(uint64_t budget_ns) {
+	auto ret = x_roundtrip_frame_totals;
+	if (ret.count == 0) {
+		return ret;
+	}
+
+	for (auto site = x_roundtrip_sites; site; site = site->next) {
+		if (budget_ns && site->frame_ns > budget_ns) {
+			log_warn("%" PRIu64 " X round trip(s) to %s at %s:%d took "
+			         "%.3f ms in one frame, over the budget of %.3f ms",
+			         site->frame_count, site->name, site->file, site->line,
+			         (double)site->frame_ns / 1e6, (double)budget_ns / 1e6);
+		}
+		site->frame_count = 0;
+		site->frame_ns = 0;
+	}
+	x_roundtrip_frame_totals = (struct x_roundtrip_totals){0};
+	return ret;
+}
+
+struct x_roundtrip_totals x_roundtrip_get_totals(void) {
+	return x_roundtrip_all_totals;
+}
+
+static int x_roundtrip_site_cmp(const void *a, const void *b) {
+	const struct x_roundtrip_site *x = *(struct x_roundtrip_site *const *)a,
+	                              *y = *(struct x_roundtrip_site *const *)b;
+	return (x->total_ns < y->total_ns) - (x->total_ns > y->total_ns);
+}
+
+void x_roundtrip_print_summary(FILE *f) {
+	size_t nsites = 0;
+	for (auto site = x_roundtrip_sites; site; site = site->next) {
+		nsites++;
+	}
+	if (!nsites) {
+		return;
+	}
+
+	auto sites = ccalloc(nsites, struct x_roundtrip_site *);
+	nsites = 0;
+	for (auto site = x_roundtrip_sites; site; site = site->next) {
+		sites[nsites++] = site;
+	}
+	qsort(sites, nsites, sizeof(*sites), x_roundtrip_site_cmp);
+
+	fprintf(f, "X round trips by call site:\n");
+	for (size_t i = 0; i < nsites; i++) {
+		fprintf(f, "  %10.3f ms %8" PRIu64 " calls  %s (%s:%d)\n",
+		        (double)sites[i]->total_ns / 1e6, sites[i]->count, sites[i]->name,
+		        sites[i]->file, sites[i]->line);
+	}
+	free(sites);
+}
@@ -3,6 +3,7 @@
 #pragma once
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <xcb/render.h>
 #include <xcb/sync.h>
@@ -13,6 +14,7 @@
 #include "compiler.h"
 #include "log.h"
 #include "region.h"
+#include "trace.h"
 
 typedef struct session session_t;
 struct atom;
@@ -54,10 +56,70 @@ struct xvisual_info {
 	xcb_visualid_t visual;
 };
 
+struct glx_fbconfig_info;
+
+/// An entry of the visual table.
+struct x_visual_entry {
+	/// Channel sizes are -1 if the visual isn't DirectColor, or has no pict format.
+	struct xvisual_info info;
+	const xcb_render_pictforminfo_t *pictfmt;
+	/// FBConfig matching the visual, found by the GLX backend on first use
+	struct glx_fbconfig_info *fbconfig;
+};
+
+/// Accounting of the synchronous round trips to the X server made at one call site.
+struct x_roundtrip_site {
+	const char *name;
+	const char *file;
+	int line;
+	/// Whether this site has been added to the list of known call sites
+	bool registered;
+	/// Number of round trips and time spent waiting for them, since the start
+	uint64_t count, total_ns;
+	/// Same, but since the last x_roundtrip_frame_end
+	uint64_t frame_count, frame_ns;
+	struct x_roundtrip_site *next;
+};
+
+struct x_roundtrip_totals {
+	uint64_t count;
+	uint64_t ns;
+};
+
+uint64_t x_roundtrip_begin(struct x_roundtrip_site *site);
+void x_roundtrip_end(struct x_roundtrip_site *site, uint64_t start);
+
+/// Finish accounting the round trips for the current frame. Call sites that spent
+/// more than `budget_ns` waiting for the X server during the frame are logged, unless
+/// `budget_ns` is 0.
+///
+/// @return the totals of the frame
+struct x_roundtrip_totals x_roundtrip_frame_end(uint64_t budget_ns);
+
+/// Get the totals of all the round trips made so far.
+struct x_roundtrip_totals x_roundtrip_get_totals(void);
+
+/// Print the round trips made so far, by call site, most expensive first.
+void x_roundtrip_print_summary(FILE *f);
+
+/// Evaluate `expr`, which waits for the X server (e.g. a xcb_*_reply or a
+/// xcb_request_check call), and account the round trip to this call site, under the
+/// name `site_name`.
+#define X_ROUNDTRIP(site_name, expr)                                                     \
+	({                                                                               \
+		static struct x_roundtrip_site __site = {                                \
+		    .name = (site_name), .file = __FILE__, .line = __LINE__};            \
+		__auto_type __start = x_roundtrip_begin(&__site);                        \
+		__auto_type __ret = (expr);                                              \
+		x_roundtrip_end(&__site, __start);                                       \
+		__ret;                                                                   \
+	})
+
 #define XCB_AWAIT_VOID(func, c, ...)                                                     \
 	({                                                                               \
 		bool __success = true;                                                   \
-		__auto_type __e = xcb_request_check(c, func##_checked(c, __VA_ARGS__));  \
+		__auto_type __e = X_ROUNDTRIP(                                           \
+		    #func, xcb_request_check(c, func##_checked(c, __VA_ARGS__)));        \
 		if (__e) {                                                               \
 			x_print_error(__e->sequence, __e->major_code, __e->minor_code,   \
 			              __e->error_code);                                  \
@@ -70,7 +132,8 @@ struct xvisual_info {
 #define XCB_AWAIT(func, c, ...)                                                          \
 	({                                                                               \
 		xcb_generic_error_t *__e = NULL;                                         \
-		__auto_type __r = func##_reply(c, func(c, __VA_ARGS__), &__e);           \
+		__auto_type __r =                                                        \
+		    X_ROUNDTRIP(#func, func##_reply(c, func(c, __VA_ARGS__), &__e));     \
 		if (__e) {                                                               \
 			x_print_error(__e->sequence, __e->major_code, __e->minor_code,   \
 			              __e->error_code);                                  \
@@ -102,9 +165,9 @@ static inline uint32_t x_new_id(xcb_connection_t *c) {
  * xcb_get_input_focus is used here because it is the same request used by
  * libX11
  */
-static inline void x_sync(xcb_connection_t *c) {
-	free(xcb_get_input_focus_reply(c, xcb_get_input_focus(c), NULL));
-}
+#define x_sync(c)                                                                        \
+	free(X_ROUNDTRIP("x_sync",                                                       \
+	                 xcb_get_input_focus_reply(c, xcb_get_input_focus(c), NULL)))
 
 /**
  * Get a specific attribute of a window.
@@ -161,6 +224,15 @@ xcb_window_t wid_get_prop_window(xcb_connection_t *c, xcb_window_t wid, xcb_atom
 bool wid_get_text_prop(session_t *ps, xcb_window_t wid, xcb_atom_t prop, char ***pstrlst,
                        int *pnstr);
 
+/// Build the table of visuals, with their pict formats and channel sizes. The table is
+/// a cache keyed by visual ID, filled with every visual of the connection. The lookups
+/// below build it on first use, if this hasn't been called.
+void x_init_visual_table(xcb_connection_t *c);
+/// Free the visual table, and the FBConfigs stored in it.
+void x_free_visual_table(void);
+/// Find a visual in the visual table. Returns NULL if the visual doesn't exist.
+struct x_visual_entry *x_get_visual_entry(xcb_connection_t *c, xcb_visualid_t visual);
+
 const xcb_render_pictforminfo_t *
 x_get_pictform_for_visual(xcb_connection_t *, xcb_visualid_t);
 int x_get_visual_depth(xcb_connection_t *, xcb_visualid_t);
@@ -241,7 +313,7 @@ x_get_root_back_pixmap(xcb_connection_t *c, xcb_window_t root, struct atom *atom
 /// root window background pixmap
 bool x_is_root_back_pixmap_atom(struct atom *atoms, xcb_atom_t atom);
 
-bool x_fence_sync(xcb_connection_t *, xcb_sync_fence_t);
+void x_fence_sync(session_t *ps);
 
 /// Generate a search criteria for fbconfig from a X visual.
 /// Returns {-1, -1, -1, -1, -1, -1} on failure
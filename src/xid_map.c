@@ -0,0 +1,81 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+#include <assert.h>
+#include <stdlib.h>
+
+#include "compiler.h"
+#include "utils.h"
+#include "xid_map.h"
+
+#define XID_MAP_MIN_BITS 4
+
+static void xid_map_grow(struct xid_map *map) {
+	auto old_slots = map->slots;
+	uint32_t old_nslots = old_slots ? map->mask + 1 : 0;
+
+	map->bits = old_slots ? map->bits + 1 : XID_MAP_MIN_BITS;
+	map->mask = (1U << map->bits) - 1;
+	map->slots = ccalloc(map->mask + 1, struct xid_map_slot);
+	for (uint32_t i = 0; i < old_nslots; i++) {
+		if (old_slots[i].xid == 0) {
+			continue;
+		}
+		auto j = xid_map_home(map, old_slots[i].xid);
+		while (map->slots[j].xid != 0) {
+			j = (j + 1) & map->mask;
+		}
+		map->slots[j] = old_slots[i];
+	}
+	free(old_slots);
+}
+
+void *xid_map_set(struct xid_map *map, uint32_t xid, void *value) {
+	assert(xid != 0 && value != NULL);
+	if (!map->slots || (map->count + 1) * 2 > map->mask + 1) {
+		xid_map_grow(map);
+	}
+
+	auto i = xid_map_home(map, xid);
+	while (map->slots[i].xid != 0 && map->slots[i].xid != xid) {
+		i = (i + 1) & map->mask;
+	}
+	void *old = map->slots[i].value;
+	if (map->slots[i].xid == 0) {
+		map->slots[i].xid = xid;
+		map->count++;
+	}
+	map->slots[i].value = value;
+	return old;
+}
+
+void *xid_map_remove(struct xid_map *map, uint32_t xid) {
+	if (map->count == 0) {
+		return NULL;
+	}
+	auto i = xid_map_home(map, xid);
+	while (map->slots[i].xid != xid) {
+		if (map->slots[i].xid == 0) {
+			return NULL;
+		}
+		i = (i + 1) & map->mask;
+	}
+
+	void *old = map->slots[i].value;
+	// Fill the hole with the next entry whose probe sequence passes through it, and
+	// repeat with the hole that leaves, until the end of the run.
+	for (auto j = (i + 1) & map->mask; map->slots[j].xid != 0; j = (j + 1) & map->mask) {
+		auto home = xid_map_home(map, map->slots[j].xid);
+		if (((j - home) & map->mask) >= ((j - i) & map->mask)) {
+			map->slots[i] = map->slots[j];
+			i = j;
+		}
+	}
+	map->slots[i] = (struct xid_map_slot){0};
+	map->count--;
+	return old;
+}
+
+void xid_map_destroy(struct xid_map *map) {
+	free(map->slots);
+	*map = (struct xid_map){0};
+}
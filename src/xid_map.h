@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+#pragma once
+
+/// A map from X IDs to pointers.
+///
+/// The slots are kept in one flat array, and collisions are resolved by linear
+/// probing, so a lookup usually reads a single cache line. The array is at most half
+/// full. Removing an entry moves the entries after it in the probe sequence back, so
+/// there are no tombstones. A zeroed `struct xid_map` is an empty map.
+
+#include <stdint.h>
+
+#include "compiler.h"
+
+struct xid_map_slot {
+	/// 0 for empty slots, which is never a valid X ID
+	uint32_t xid;
+	void *value;
+};
+
+struct xid_map {
+	struct xid_map_slot *slots;
+	/// Number of slots minus 1, the number of slots is a power of 2
+	uint32_t mask;
+	/// log2 of the number of slots
+	unsigned int bits;
+	/// Number of entries
+	uint32_t count;
+};
+
+/// Home slot of `xid`. IDs are handed out sequentially in each client's range,
+/// multiplying by 2^32 / phi spreads them over the high bits.
+static inline uint32_t xid_map_home(const struct xid_map *map, uint32_t xid) {
+	return (uint32_t)(xid * 2654435769U) >> (32 - map->bits);
+}
+
+static inline void *xid_map_get(const struct xid_map *map, uint32_t xid) {
+	if (map->count == 0) {
+		return NULL;
+	}
+	for (auto i = xid_map_home(map, xid);; i = (i + 1) & map->mask) {
+		if (map->slots[i].xid == xid) {
+			return map->slots[i].value;
+		}
+		if (map->slots[i].xid == 0) {
+			return NULL;
+		}
+	}
+}
+
+/// Map `xid` to `value`. Returns the value `xid` was mapped to before, or NULL.
+void *xid_map_set(struct xid_map *map, uint32_t xid, void *value);
+
+/// Remove `xid` from the map. Returns the value it was mapped to, or NULL.
+void *xid_map_remove(struct xid_map *map, uint32_t xid);
+
+/// Free the slots of the map, leaving it empty. The values are not freed.
+void xid_map_destroy(struct xid_map *map);
+
+/// Iterate over the values in the map, in no particular order. The map must not be
+/// changed while iterating.
+#define xid_map_foreach(map, type, el)                                                   \
+	for (uint32_t __i = 0, __brk = 0; !__brk && (map)->slots && __i <= (map)->mask;  \
+	     __i++)                                                                      \
+		for (type *el = (map)->slots[__i].value; el && (__brk = 1);              \
+		     __brk = 0, el = NULL)
@@ -0,0 +1,342 @@
+// SPDX-License-Identifier: MPL-2.0
+// Copyright (c) Yuxuan Shui <yshuiv7@gmail.com>
+
+/// Unit tests for the cache.
+///
+/// Usage: test_cache [NAME]...
+/// Runs the named tests, or all of them if no name is given.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "compiler.h"
+#include "utils.h"
+
+static bool failed = false;
+
+#define TEST_TRUE(expr)                                                                  \
+	do {                                                                             \
+		if (!(expr)) {                                                           \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+			        #expr);                                                  \
+			failed = true;                                                   \
+		}                                                                        \
+	} while (0)
+
+#define TEST_EQUAL(a, b) TEST_TRUE((a) == (b))
+
+/// Bookkeeping of the getter and free callbacks, passed to them as the user data.
+struct test_state {
+	/// Number of calls to the getter
+	unsigned int gets;
+	/// Number of calls to the free callback
+	unsigned int frees;
+	/// Id of the value freed last, 0 if none has been freed
+	uint64_t last_freed;
+	/// Size of the key the getter was called with last
+	size_t last_key_size;
+	/// Last byte of the key the getter was called with last
+	char last_key_end;
+	/// Make the getter fail
+	bool fail;
+};
+
+struct test_value {
+	/// Number of the getter call that produced this value, starting from 1
+	uint64_t id;
+};
+
+static void *test_getter(void *ud, const void *key, size_t key_size, int *err) {
+	struct test_state *st = ud;
+	st->gets++;
+	st->last_key_size = key_size;
+	st->last_key_end = key_size ? ((const char *)key)[key_size - 1] : 0;
+	if (st->fail) {
+		*err = -1;
+		return NULL;
+	}
+	struct test_value *v = malloc(sizeof(*v));
+	v->id = st->gets;
+	return v;
+}
+
+static void test_free(void *ud, void *data) {
+	struct test_state *st = ud;
+	struct test_value *v = data;
+	st->frees++;
+	st->last_freed = v->id;
+	free(v);
+}
+
+static struct cache *test_cache_new(struct test_state *st) {
+	*st = (struct test_state){0};
+	return new_cache(st, test_getter, test_free);
+}
+
+static uint64_t get_id(struct cache *c, uint64_t key) {
+	struct test_value *v = cache_get_int(c, key, NULL);
+	return v ? v->id : 0;
+}
+
+static void test_blob_keys(void) {
+	struct test_state st;
+	auto c = test_cache_new(&st);
+
+	// Integer keys of the same size only differ in their bytes
+	auto v1 = get_id(c, 1);
+	auto v2 = get_id(c, 2);
+	TEST_EQUAL(st.gets, 2);
+	TEST_TRUE(v1 != v2);
+	TEST_EQUAL(get_id(c, 1), v1);
+	TEST_EQUAL(get_id(c, 2), v2);
+	TEST_EQUAL(st.gets, 2);
+
+	// The size is part of the key, a 32-bit 1 is not the same as a 64-bit 1
+	uint32_t small = 1;
+	struct test_value *v = cache_get_blob(c, &small, sizeof(small), NULL);
+	TEST_EQUAL(st.gets, 3);
+	TEST_TRUE(v && v->id != v1);
+	TEST_EQUAL(st.last_key_size, sizeof(small));
+
+	cache_free(c);
+	TEST_EQUAL(st.frees, 3);
+}
+
+static void test_string_keys(void) {
+	struct test_state st;
+	auto c = test_cache_new(&st);
+
+	// String keys are passed with their terminating NUL
+	struct test_value *v = cache_get(c, "abc", NULL);
+	auto id = v->id;
+	TEST_EQUAL(st.gets, 1);
+	TEST_EQUAL(st.last_key_size, 4);
+	TEST_EQUAL(st.last_key_end, '\0');
+
+	TEST_EQUAL(cache_get_blob(c, "abc", 4, NULL), v);
+	TEST_EQUAL(st.gets, 1);
+
+	// Without the NUL, it's a different key
+	TEST_TRUE(cache_get_blob(c, "abc", 3, NULL) != v);
+	TEST_EQUAL(st.gets, 2);
+
+	// A prefix of the key is a different key too
+	TEST_TRUE(cache_get(c, "ab", NULL) != v);
+	TEST_EQUAL(st.gets, 3);
+
+	cache_invalidate(c, "abc");
+	TEST_EQUAL(st.frees, 1);
+	TEST_EQUAL(st.last_freed, id);
+	// The key without the NUL is untouched
+	cache_get_blob(c, "abc", 3, NULL);
+	TEST_EQUAL(st.gets, 3);
+
+	cache_free(c);
+}
+
+static void test_lru_order(void) {
+	struct test_state st;
+	auto c = test_cache_new(&st);
+	cache_set_capacity(c, 3);
+
+	get_id(c, 1);
+	auto v2 = get_id(c, 2);
+	auto v3 = get_id(c, 3);
+	// A hit makes 1 the most recently used, so 2 is evicted first
+	get_id(c, 1);
+	get_id(c, 4);
+	TEST_EQUAL(st.frees, 1);
+	TEST_EQUAL(st.last_freed, v2);
+
+	get_id(c, 5);
+	TEST_EQUAL(st.frees, 2);
+	TEST_EQUAL(st.last_freed, v3);
+
+	cache_free(c);
+}
+
+static void test_capacity(void) {
+	struct test_state st;
+	auto c = test_cache_new(&st);
+	cache_set_capacity(c, 2);
+
+	auto v1 = get_id(c, 1);
+	get_id(c, 2);
+	// At the capacity, but not over it
+	TEST_EQUAL(st.frees, 0);
+	TEST_EQUAL(cache_get_stats(c)->evictions, 0);
+
+	// One more value evicts exactly one
+	get_id(c, 3);
+	TEST_EQUAL(st.frees, 1);
+	TEST_EQUAL(st.last_freed, v1);
+	TEST_EQUAL(cache_get_stats(c)->evictions, 1);
+
+	// 2 and 3 are still there
+	get_id(c, 2);
+	get_id(c, 3);
+	TEST_EQUAL(st.gets, 3);
+
+	cache_free(c);
+}
+
+static void test_shrink(void) {
+	struct test_state st;
+	auto c = test_cache_new(&st);
+
+	auto v1 = get_id(c, 1);
+	get_id(c, 2);
+	get_id(c, 3);
+	auto v4 = get_id(c, 4);
+	// Most recently used first: 1, 4, 3, 2
+	get_id(c, 1);
+
+	cache_set_capacity(c, 2);
+	TEST_EQUAL(st.frees, 2);
+	TEST_EQUAL(cache_get_stats(c)->evictions, 2);
+
+	TEST_EQUAL(get_id(c, 1), v1);
+	TEST_EQUAL(get_id(c, 4), v4);
+	TEST_EQUAL(st.gets, 4);
+
+	// Adding a value still stays within the new capacity
+	get_id(c, 5);
+	TEST_EQUAL(st.frees, 3);
+	TEST_EQUAL(st.last_freed, v1);
+
+	cache_free(c);
+}
+
+static void test_free_callback(void) {
+	struct test_state st;
+	auto c = test_cache_new(&st);
+
+	get_id(c, 1);
+	auto v2 = get_id(c, 2);
+	get_id(c, 3);
+	get_id(c, 4);
+
+	cache_invalidate_int(c, 2);
+	TEST_EQUAL(st.frees, 1);
+	TEST_EQUAL(st.last_freed, v2);
+	// Invalidating a key that isn't there does nothing
+	cache_invalidate_int(c, 2);
+	TEST_EQUAL(st.frees, 1);
+
+	// Evictions free the value too
+	cache_set_capacity(c, 2);
+	TEST_EQUAL(st.frees, 2);
+
+	cache_invalidate_all(c);
+	TEST_EQUAL(st.frees, 4);
+
+	get_id(c, 1);
+	TEST_EQUAL(st.gets, 5);
+	TEST_EQUAL(cache_free(c), &st);
+	TEST_EQUAL(st.frees, 5);
+}
+
+static void test_stats(void) {
+	struct test_state st;
+	auto c = test_cache_new(&st);
+	auto stats = cache_get_stats(c);
+	TEST_EQUAL(stats->hits, 0);
+	TEST_EQUAL(stats->misses, 0);
+	TEST_EQUAL(stats->evictions, 0);
+
+	get_id(c, 1);
+	get_id(c, 2);
+	get_id(c, 1);
+	get_id(c, 1);
+	TEST_EQUAL(stats->hits, 2);
+	TEST_EQUAL(stats->misses, 2);
+
+	// Invalidation is not an eviction
+	cache_invalidate_int(c, 2);
+	TEST_EQUAL(stats->evictions, 0);
+
+	cache_set_capacity(c, 1);
+	get_id(c, 3);
+	TEST_EQUAL(stats->misses, 3);
+	TEST_EQUAL(stats->evictions, 1);
+
+	// Values inserted with cache_set are not counted as misses
+	cache_set_capacity(c, 0);
+	struct test_value *v = malloc(sizeof(*v));
+	v->id = 100;
+	cache_set(c, "set", v);
+	TEST_EQUAL(cache_get(c, "set", NULL), v);
+	TEST_EQUAL(stats->hits, 3);
+	TEST_EQUAL(stats->misses, 3);
+
+	cache_free(c);
+}
+
+static void test_getter_error(void) {
+	struct test_state st;
+	auto c = test_cache_new(&st);
+
+	st.fail = true;
+	int err = 0;
+	TEST_EQUAL(cache_get_int(c, 1, &err), NULL);
+	TEST_TRUE(err != 0);
+	TEST_EQUAL(cache_get_int(c, 1, NULL), NULL);
+	TEST_EQUAL(cache_get_stats(c)->misses, 2);
+
+	// Nothing was inserted, so the getter is called again
+	st.fail = false;
+	auto v = cache_get_int(c, 1, &err);
+	TEST_TRUE(v != NULL);
+	TEST_EQUAL(err, 0);
+	TEST_EQUAL(st.gets, 3);
+	TEST_EQUAL(cache_get_stats(c)->hits, 0);
+
+	// A failed get doesn't evict anything either
+	cache_set_capacity(c, 1);
+	st.fail = true;
+	TEST_EQUAL(cache_get_int(c, 2, NULL), NULL);
+	TEST_EQUAL(st.frees, 0);
+	TEST_EQUAL(cache_get_int(c, 1, NULL), v);
+
+	cache_free(c);
+	TEST_EQUAL(st.frees, 1);
+}
+
+static const struct {
+	const char *name;
+	void (*fn)(void);
+} tests[] = {
+    {"blob_keys", test_blob_keys},
+    {"string_keys", test_string_keys},
+    {"lru_order", test_lru_order},
+    {"capacity", test_capacity},
+    {"shrink", test_shrink},
+    {"free_callback", test_free_callback},
+    {"stats", test_stats},
+    {"getter_error", test_getter_error},
+};
+
+int main(int argc, char **argv) {
+	for (size_t i = 0; i < ARR_SIZE(tests); i++) {
+		bool selected = argc <= 1;
+		for (int j = 1; j < argc; j++) {
+			if (strcmp(argv[j], tests[i].name) == 0) {
+				selected = true;
+			}
+		}
+		if (!selected) {
+			continue;
+		}
+
+		bool failed_before = failed;
+		failed = false;
+		tests[i].fn();
+		printf("%s: %s\n", tests[i].name, failed ? "FAIL" : "ok");
+		failed = failed || failed_before;
+	}
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}